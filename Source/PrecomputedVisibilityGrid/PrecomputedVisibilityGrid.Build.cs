@@ -42,6 +42,9 @@ public class PrecomputedVisibilityGrid : ModuleRules
 				"RenderCore",
 				"DeveloperSettings",
 				"Foliage",
+				"Json",
+				"NavigationSystem",
+				"Projects",
 				// ... add private dependencies that you statically link with here ...	
 			}
 			);
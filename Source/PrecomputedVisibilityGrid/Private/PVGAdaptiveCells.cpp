@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGAdaptiveCells.h"
+
+#include "PrecomputedVisibilityGrid.h"
+#include "PVGOccupancyVolume.h"
+#include "Async/ParallelFor.h"
+
+namespace PVGAdaptiveCells
+{
+	struct FContext
+	{
+		UWorld* World;
+		FIntVector GridSize;
+		FVector GridOrigin;
+		FVector CellSize;
+		int32 MaxLevel;
+		const FCollisionQueryParams& QueryParams;
+		const FCollisionResponseParams& ResponseParams;
+	};
+
+	void Subdivide(const FContext& Context, const FIntVector& Min, int32 Level, TArray<uint64>& OutCodes, TArray<uint8>& OutLevels)
+	{
+		if (Min.X >= Context.GridSize.X || Min.Y >= Context.GridSize.Y || Min.Z >= Context.GridSize.Z)
+		{
+			// Node is outside the grid, no cell will ever look it up.
+			return;
+		}
+
+		if (Level == 0)
+		{
+			OutCodes.Add(CellToMortonCode(Min));
+			OutLevels.Add(0);
+			return;
+		}
+
+		if (Level <= Context.MaxLevel)
+		{
+			FIntVector RangeMin, RangeMax;
+			FPVGAdaptiveCells::GetLeafRange(CellToMortonCode(Min),Level,Context.GridSize,RangeMin,RangeMax);
+			const FBox Box(
+				Context.GridOrigin + FVector(RangeMin) * Context.CellSize,
+				Context.GridOrigin + FVector(RangeMax + FIntVector(1)) * Context.CellSize);
+			
+			if (FPVGOccupancyVolume::ClassifyBox(Context.World,Box,Context.QueryParams,Context.ResponseParams) != EPVGOccupancy::Partial)
+			{
+				OutCodes.Add(CellToMortonCode(Min));
+				OutLevels.Add(Level);
+				return;
+			}
+		}
+
+		// Children in Morton order so the leaves come out sorted.
+		const int32 ChildSize = 1 << (Level - 1);
+		TArray<uint64> ChildCodes[8];
+		TArray<uint8> ChildLevels[8];
+		
+		ParallelFor(8,[&](int32 Child)
+		{
+			const FIntVector ChildMin = Min + FIntVector(Child & 1,(Child >> 1) & 1,(Child >> 2) & 1) * ChildSize;
+			Subdivide(Context,ChildMin,Level - 1,ChildCodes[Child],ChildLevels[Child]);
+		},EParallelForFlags::Unbalanced);
+
+		for (int32 Child = 0; Child < 8; Child++)
+		{
+			OutCodes.Append(ChildCodes[Child]);
+			OutLevels.Append(ChildLevels[Child]);
+		}
+	}
+}
+
+void FPVGAdaptiveCells::Build(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, int32 MaxLevel,
+	const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams,
+	TArray<uint64>& OutCodes, TArray<uint8>& OutLevels)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	
+	OutCodes.Reset();
+	OutLevels.Reset();
+
+	const int32 MaxSize = FMath::Max3(GridSize.X,GridSize.Y,GridSize.Z);
+	const int32 RootLevel = FMath::CeilLogTwo(FMath::Max(1,MaxSize));
+
+	const PVGAdaptiveCells::FContext Context{World,GridSize,GridOrigin,CellSize,MaxLevel,QueryParams,ResponseParams};
+	PVGAdaptiveCells::Subdivide(Context,FIntVector::ZeroValue,RootLevel,OutCodes,OutLevels);
+
+	UE_LOG(LogTemp,Warning,TEXT("Adaptive cells: %d leaves for %d grid cells, built in %.2f sec."),
+		OutCodes.Num(),GridSize.X * GridSize.Y * GridSize.Z,FPlatformTime::Seconds() - StartTime);
+}
+
+void FPVGAdaptiveCells::GetLeafRange(uint64 Code, uint8 Level, const FIntVector& GridSize, FIntVector& OutMin, FIntVector& OutMax)
+{
+	OutMin = MortonCodeToCell(Code);
+	const int32 Size = 1 << Level;
+	OutMax = FIntVector(
+		FMath::Min(OutMin.X + Size,GridSize.X) - 1,
+		FMath::Min(OutMin.Y + Size,GridSize.Y) - 1,
+		FMath::Min(OutMin.Z + Size,GridSize.Z) - 1);
+}
@@ -0,0 +1,22 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/*
+ * Linear octree over the grid cells, aligned blocks of cells that are fully empty or fully solid get merged into a single
+ * build cell. Leaves are stored as the sorted Morton codes of their min corner and their level, a leaf of level L covers
+ * 2^L cells along each axis.
+ */
+struct FPVGAdaptiveCells
+{
+	/* Subdivide the grid down to single cells wherever blocking collision passes through, leaves are emitted in Morton order.
+	 * MaxLevel limits the size of merged leaves. */
+	static void Build(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, int32 MaxLevel,
+		const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams,
+		TArray<uint64>& OutCodes, TArray<uint8>& OutLevels);
+
+	/* Inclusive cell range of a leaf, clipped to the grid. */
+	static void GetLeafRange(uint64 Code, uint8 Level, const FIntVector& GridSize, FIntVector& OutMin, FIntVector& OutMax);
+};
@@ -0,0 +1,240 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGBoxDecomposition.h"
+
+#include "PrecomputedVisibilityGrid.h"
+
+void FPVGBitVolume::Init(const FIntVector& InSize)
+{
+	Size = InSize;
+	WordsPerRow = FMath::DivideAndRoundUp(Size.X,64);
+	Words.Empty();
+	Words.SetNumZeroed(WordsPerRow * Size.Y * Size.Z);
+}
+
+void FPVGBitVolume::Reset()
+{
+	FMemory::Memzero(Words.GetData(),Words.Num() * sizeof(uint64));
+}
+
+bool FPVGBitVolume::IsRowSet(int32 X0, int32 X1, int32 Y, int32 Z) const
+{
+	const uint64* Row = GetRow(Y,Z);
+	const int32 FirstWord = X0 >> 6;
+	const int32 LastWord = X1 >> 6;
+	
+	for (int32 Word = FirstWord; Word <= LastWord; Word++)
+	{
+		const uint64 Mask = GetWordMask(Word == FirstWord ? X0 & 63 : 0,Word == LastWord ? X1 & 63 : 63);
+		if ((Row[Word] & Mask) != Mask)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool FPVGBitVolume::IsRowClear(int32 X0, int32 X1, int32 Y, int32 Z) const
+{
+	const uint64* Row = GetRow(Y,Z);
+	const int32 FirstWord = X0 >> 6;
+	const int32 LastWord = X1 >> 6;
+	
+	for (int32 Word = FirstWord; Word <= LastWord; Word++)
+	{
+		const uint64 Mask = GetWordMask(Word == FirstWord ? X0 & 63 : 0,Word == LastWord ? X1 & 63 : 63);
+		if (Row[Word] & Mask)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+void FPVGBitVolume::SetRow(int32 X0, int32 X1, int32 Y, int32 Z)
+{
+	uint64* Row = GetRow(Y,Z);
+	const int32 FirstWord = X0 >> 6;
+	const int32 LastWord = X1 >> 6;
+	
+	for (int32 Word = FirstWord; Word <= LastWord; Word++)
+	{
+		Row[Word] |= GetWordMask(Word == FirstWord ? X0 & 63 : 0,Word == LastWord ? X1 & 63 : 63);
+	}
+}
+
+void FPVGBitVolume::SetBox(const FPVGCellBox& Box)
+{
+	for (int32 z = Box.Min.Z; z <= Box.Max.Z; z++)
+	{
+		for (int32 y = Box.Min.Y; y <= Box.Max.Y; y++)
+		{
+			SetRow(Box.Min.X,Box.Max.X,y,z);
+		}
+	}
+}
+
+int32 FPVGBitVolume::CountSetBits() const
+{
+	int32 Count = 0;
+	for (const uint64 Word : Words)
+	{
+		Count += int32(FMath::CountBits(Word));
+	}
+	return Count;
+}
+
+FPVGCellBox FPVGBoxDecomposition::GrowBox(const FPVGBitVolume& Cells, const FPVGBitVolume& Covered, bool bAllowOverlap, const FIntVector& Origin)
+{
+	const FIntVector& Size = Cells.GetSize();
+	FPVGCellBox Box(Origin,Origin);
+
+	auto IsFree = [&](int32 X0, int32 X1, int32 Y, int32 Z)
+	{
+		return Cells.IsRowSet(X0,X1,Y,Z) && (bAllowOverlap || Covered.IsRowClear(X0,X1,Y,Z));
+	};
+
+	bool bCanGrowX = true;
+	bool bCanGrowY = true;
+	bool bCanGrowZ = true;
+	while (bCanGrowX || bCanGrowY || bCanGrowZ)
+	{
+		if (bCanGrowX)
+		{
+			// One bit per row of the new YZ slab.
+			const int32 X = Box.Max.X + 1;
+			bCanGrowX = X < Size.X;
+			for (int32 z = Box.Min.Z; z <= Box.Max.Z && bCanGrowX; z++)
+			{
+				for (int32 y = Box.Min.Y; y <= Box.Max.Y && bCanGrowX; y++)
+				{
+					bCanGrowX = IsFree(X,X,y,z);
+				}
+			}
+			Box.Max.X += bCanGrowX ? 1 : 0;
+		}
+
+		if (bCanGrowY)
+		{
+			const int32 Y = Box.Max.Y + 1;
+			bCanGrowY = Y < Size.Y;
+			for (int32 z = Box.Min.Z; z <= Box.Max.Z && bCanGrowY; z++)
+			{
+				bCanGrowY = IsFree(Box.Min.X,Box.Max.X,Y,z);
+			}
+			Box.Max.Y += bCanGrowY ? 1 : 0;
+		}
+
+		if (bCanGrowZ)
+		{
+			const int32 Z = Box.Max.Z + 1;
+			bCanGrowZ = Z < Size.Z;
+			for (int32 y = Box.Min.Y; y <= Box.Max.Y && bCanGrowZ; y++)
+			{
+				bCanGrowZ = IsFree(Box.Min.X,Box.Max.X,y,Z);
+			}
+			Box.Max.Z += bCanGrowZ ? 1 : 0;
+		}
+	}
+
+	return Box;
+}
+
+void FPVGBoxDecomposition::Decompose(const FPVGBitVolume& Cells, EPVGBoxPacking Packing, bool bAllowOverlap, TArray<FPVGCellBox>& OutBoxes)
+{
+	FPVGBitVolume Covered;
+	Decompose(Cells,Packing,bAllowOverlap,Covered,OutBoxes);
+}
+
+void FPVGBoxDecomposition::Decompose(const FPVGBitVolume& Cells, EPVGBoxPacking Packing, bool bAllowOverlap, FPVGBitVolume& Covered, TArray<FPVGCellBox>& OutBoxes)
+{
+	OutBoxes.Reset();
+	if (Covered.GetSize() == Cells.GetSize())
+	{
+		Covered.Reset();
+	}
+	else
+	{
+		Covered.Init(Cells.GetSize());
+	}
+
+	auto TryOrigin = [&](const FIntVector& Origin)
+	{
+		if (!Covered.IsSet(Origin.X,Origin.Y,Origin.Z))
+		{
+			const FPVGCellBox Box = GrowBox(Cells,Covered,bAllowOverlap,Origin);
+			Covered.SetBox(Box);
+			OutBoxes.Add(Box);
+		}
+	};
+
+	switch (Packing)
+	{
+	case EPVGBoxPacking::FirstFit:
+		{
+			Cells.ForEachSetBit([&](int32 X, int32 Y, int32 Z)
+			{
+				TryOrigin(FIntVector(X,Y,Z));
+			});
+			break;
+		}
+	case EPVGBoxPacking::Morton:
+		{
+			TArray<TPair<uint64,FIntVector>> Origins;
+			Origins.Reserve(Cells.CountSetBits());
+			Cells.ForEachSetBit([&](int32 X, int32 Y, int32 Z)
+			{
+				Origins.Emplace(CellToMortonCode(FIntVector(X,Y,Z)),FIntVector(X,Y,Z));
+			});
+			Origins.Sort([](const TPair<uint64,FIntVector>& A, const TPair<uint64,FIntVector>& B) { return A.Key < B.Key; });
+
+			for (const TPair<uint64,FIntVector>& Origin : Origins)
+			{
+				TryOrigin(Origin.Value);
+			}
+			break;
+		}
+	case EPVGBoxPacking::LargestFirst:
+		{
+			struct FCandidate
+			{
+				FPVGCellBox Box;
+				int32 NumCells;
+			};
+			auto IsLarger = [](const FCandidate& A, const FCandidate& B) { return A.NumCells > B.NumCells; };
+
+			// Boxes never grow once cells get covered, so a candidate that still has its size can be placed right away.
+			TArray<FCandidate> Candidates;
+			Cells.ForEachSetBit([&](int32 X, int32 Y, int32 Z)
+			{
+				const FPVGCellBox Box = GrowBox(Cells,Covered,bAllowOverlap,FIntVector(X,Y,Z));
+				Candidates.Add({Box,Box.GetNumCells()});
+			});
+			Candidates.Heapify(IsLarger);
+
+			while (Candidates.Num() > 0)
+			{
+				FCandidate Candidate;
+				Candidates.HeapPop(Candidate,IsLarger);
+				
+				const FIntVector& Origin = Candidate.Box.Min;
+				if (Covered.IsSet(Origin.X,Origin.Y,Origin.Z))
+				{
+					continue;
+				}
+
+				const FPVGCellBox Box = GrowBox(Cells,Covered,bAllowOverlap,Origin);
+				if (Box.GetNumCells() < Candidate.NumCells)
+				{
+					Candidates.HeapPush({Box,Box.GetNumCells()},IsLarger);
+					continue;
+				}
+				
+				Covered.SetBox(Box);
+				OutBoxes.Add(Box);
+			}
+			break;
+		}
+	}
+}
@@ -0,0 +1,124 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PVGBoxDecomposition.generated.h"
+
+UENUM()
+enum class EPVGBoxPacking : uint8
+{
+	/* Start boxes at the lowest uncovered cell index, same order as the original packing. */
+	FirstFit,
+	/* Always place the biggest box that still covers new cells, fewest boxes but slowest. */
+	LargestFirst,
+	/* Start boxes in Morton order, keeps boxes closer to cubes than the row order does. */
+	Morton,
+};
+
+/* Inclusive cell coordinates. */
+struct FPVGCellBox
+{
+	FIntVector Min;
+	FIntVector Max;
+
+	FPVGCellBox() = default;
+	FPVGCellBox(const FIntVector& InMin, const FIntVector& InMax) : Min(InMin), Max(InMax) {}
+
+	int32 GetNumCells() const { return (Max.X - Min.X + 1) * (Max.Y - Min.Y + 1) * (Max.Z - Min.Z + 1); }
+};
+
+/* Dense bit per cell of a grid, rows along X are padded to whole words so row ranges can be tested a word at a time. */
+class FPVGBitVolume
+{
+public:
+	FPVGBitVolume() = default;
+	explicit FPVGBitVolume(const FIntVector& InSize) { Init(InSize); }
+
+	void Init(const FIntVector& InSize);
+
+	/* Clear all bits, keeps the size. */
+	void Reset();
+
+	const FIntVector& GetSize() const { return Size; }
+	int32 GetNumCells() const { return Size.X * Size.Y * Size.Z; }
+
+	bool IsSet(int32 X, int32 Y, int32 Z) const
+	{
+		return (GetRow(Y,Z)[X >> 6] >> (X & 63)) & 1;
+	}
+
+	void Set(int32 X, int32 Y, int32 Z)
+	{
+		GetRow(Y,Z)[X >> 6] |= uint64(1) << (X & 63);
+	}
+
+	/* Linear cell index, X first. */
+	bool IsSet(int32 Index) const { return IsSet(Index % Size.X,(Index / Size.X) % Size.Y,Index / (Size.X * Size.Y)); }
+	void Set(int32 Index) { Set(Index % Size.X,(Index / Size.X) % Size.Y,Index / (Size.X * Size.Y)); }
+
+	/* True when all bits X0..X1 of the row are set. */
+	bool IsRowSet(int32 X0, int32 X1, int32 Y, int32 Z) const;
+
+	/* True when none of the bits X0..X1 of the row are set. */
+	bool IsRowClear(int32 X0, int32 X1, int32 Y, int32 Z) const;
+
+	void SetRow(int32 X0, int32 X1, int32 Y, int32 Z);
+	void SetBox(const FPVGCellBox& Box);
+
+	int32 CountSetBits() const;
+
+	/* Calls Func(X,Y,Z) for every set bit, in linear index order. */
+	template<typename FuncType>
+	void ForEachSetBit(FuncType Func) const
+	{
+		for (int32 z = 0; z < Size.Z; z++)
+		{
+			for (int32 y = 0; y < Size.Y; y++)
+			{
+				const uint64* Row = GetRow(y,z);
+				for (int32 Word = 0; Word < WordsPerRow; Word++)
+				{
+					uint64 Bits = Row[Word];
+					while (Bits)
+					{
+						Func(Word * 64 + int32(FMath::CountTrailingZeros64(Bits)),y,z);
+						Bits &= Bits - 1;
+					}
+				}
+			}
+		}
+	}
+
+private:
+	const uint64* GetRow(int32 Y, int32 Z) const { return Words.GetData() + (int64(Z) * Size.Y + Y) * WordsPerRow; }
+	uint64* GetRow(int32 Y, int32 Z) { return Words.GetData() + (int64(Z) * Size.Y + Y) * WordsPerRow; }
+
+	/* Mask of bits From..To (inclusive) within one word. */
+	static uint64 GetWordMask(int32 From, int32 To)
+	{
+		const uint64 High = To == 63 ? ~uint64(0) : (uint64(1) << (To + 1)) - 1;
+		return High & ~((uint64(1) << From) - 1);
+	}
+
+	FIntVector Size = FIntVector::ZeroValue;
+	int32 WordsPerRow = 0;
+	TArray<uint64> Words;
+};
+
+/**
+ * Greedy box cover of a bit volume, used for the packed cell data and both occlusion scenes.
+ * Every box starts at an uncovered cell and grows by one cell along X, Y and Z in turn until no axis can grow.
+ */
+struct FPVGBoxDecomposition
+{
+	/* Cover every set cell of Cells. With bAllowOverlap boxes may grow over cells covered by earlier boxes,
+	 * giving fewer but overlapping boxes. */
+	static void Decompose(const FPVGBitVolume& Cells, EPVGBoxPacking Packing, bool bAllowOverlap, TArray<FPVGCellBox>& OutBoxes);
+
+	/* Same as above, Covered is scratch space that keeps its allocation for callers decomposing every frame. */
+	static void Decompose(const FPVGBitVolume& Cells, EPVGBoxPacking Packing, bool bAllowOverlap, FPVGBitVolume& Covered, TArray<FPVGCellBox>& OutBoxes);
+
+	/* Grow a box from Origin over set cells of Cells, skipping cells of Covered unless bAllowOverlap. */
+	static FPVGCellBox GrowBox(const FPVGBitVolume& Cells, const FPVGBitVolume& Covered, bool bAllowOverlap, const FIntVector& Origin);
+};
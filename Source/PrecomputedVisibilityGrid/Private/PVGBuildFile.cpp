@@ -0,0 +1,94 @@
+#include "PVGBuildFile.h"
+
+#include "PVGPairMatrix.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+
+FArchive& operator<<(FArchive& Ar, FPVGBuildFileHeader& Header)
+{
+	Ar << Header.Version;
+	Ar << Header.GridSignature;
+	Ar << Header.GridSize;
+	Ar << Header.CellExtents;
+	Ar << Header.GridBounds;
+	Ar << Header.AssetPath;
+	Ar << Header.WorldPackage;
+	Ar << Header.ShardIndex;
+	Ar << Header.NumShards;
+	Ar << Header.CurrentCell;
+	return Ar;
+}
+
+bool FPVGBuildFile::Write(const FString& Filename, FPVGBuildFileHeader& Header, FPVGPairMatrix& PairMatrix)
+{
+	const FString TempFilename = Filename + TEXT(".tmp");
+	
+	{
+		TUniquePtr<FArchive> Ar(IFileManager::Get().CreateFileWriter(*TempFilename));
+		if (!Ar)
+		{
+			UE_LOG(LogTemp,Error,TEXT("Couldn't write '%s'"),*TempFilename);
+			return false;
+		}
+
+		uint32 Magic = FPVGBuildFileHeader::Magic;
+		*Ar << Magic;
+		*Ar << Header;
+		PairMatrix.Serialize(*Ar);
+
+		if (!Ar->Close())
+		{
+			UE_LOG(LogTemp,Error,TEXT("Couldn't write '%s'"),*TempFilename);
+			return false;
+		}
+	}
+
+	return IFileManager::Get().Move(*Filename, *TempFilename, true, true);
+}
+
+bool FPVGBuildFile::Read(const FString& Filename, FPVGBuildFileHeader& OutHeader, FPVGPairMatrix& OutPairMatrix)
+{
+	TUniquePtr<FArchive> Ar(IFileManager::Get().CreateFileReader(*Filename));
+	if (!Ar)
+	{
+		UE_LOG(LogTemp,Error,TEXT("Couldn't open '%s'"),*Filename);
+		return false;
+	}
+
+	uint32 Magic = 0;
+	*Ar << Magic;
+	if (Magic != FPVGBuildFileHeader::Magic)
+	{
+		UE_LOG(LogTemp,Error,TEXT("'%s' isn't a PVG build file"),*Filename);
+		return false;
+	}
+
+	*Ar << OutHeader;
+	if (OutHeader.Version != FPVGBuildFileHeader::LatestVersion)
+	{
+		UE_LOG(LogTemp,Error,TEXT("'%s' has version %d, expected %d"),*Filename,OutHeader.Version,FPVGBuildFileHeader::LatestVersion);
+		return false;
+	}
+	
+	OutPairMatrix.Serialize(*Ar);
+	return !Ar->IsError();
+}
+
+FString FPVGBuildFile::GetDirectory()
+{
+	return FPaths::ProjectSavedDir() / TEXT("PVG");
+}
+
+FString FPVGBuildFile::GetShardFilename(const FString& AssetName, int32 ShardIndex, int32 NumShards)
+{
+	return GetDirectory() / FString::Printf(TEXT("%s_%dof%d.pvgpart"),*AssetName,ShardIndex,NumShards);
+}
+
+FString FPVGBuildFile::GetCheckpointFilename(const FString& AssetName, int32 ShardIndex, int32 NumShards)
+{
+	if (ShardIndex == INDEX_NONE)
+	{
+		return GetDirectory() / FString::Printf(TEXT("%s.pvgcheckpoint"),*AssetName);
+	}
+	return GetDirectory() / FString::Printf(TEXT("%s_%dof%d.pvgcheckpoint"),*AssetName,ShardIndex,NumShards);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class FPVGPairMatrix;
+
+/* Header of the builder's sidecar files, used to check the pair state belongs to the same grid. */
+struct FPVGBuildFileHeader
+{
+	static constexpr uint32 Magic = 0x50564742; // "PVGB"
+	static constexpr int32 LatestVersion = 4;
+
+	int32 Version = LatestVersion;
+
+	/* UPVGPrecomputedGridDataAsset::GetGridSignature of the grid that was built. */
+	uint32 GridSignature = 0;
+	
+	FIntVector GridSize = FIntVector::ZeroValue;
+	FVector CellExtents = FVector::ZeroVector;
+	FBox GridBounds = FBox(ForceInit);
+
+	/* Package of the grid data asset the result belongs to. */
+	FString AssetPath;
+
+	/* Map holding the manager the merged asset gets assigned to. */
+	FString WorldPackage;
+
+	/* Shard that produced the file, INDEX_NONE when it holds the whole grid. */
+	int32 ShardIndex = INDEX_NONE;
+	int32 NumShards = 1;
+
+	/* Next source cell of a shell build, all cells before it are fully resolved. */
+	int32 CurrentCell = 0;
+
+	friend FArchive& operator<<(FArchive& Ar, FPVGBuildFileHeader& Header);
+};
+
+/* Reading and writing of partial/intermediate builder results. */
+class FPVGBuildFile
+{
+public:
+	/* Written to a temporary file first so a crash mid write never leaves a broken file behind. */
+	static bool Write(const FString& Filename, FPVGBuildFileHeader& Header, FPVGPairMatrix& PairMatrix);
+
+	static bool Read(const FString& Filename, FPVGBuildFileHeader& OutHeader, FPVGPairMatrix& OutPairMatrix);
+
+	static FString GetDirectory();
+	
+	static FString GetShardFilename(const FString& AssetName, int32 ShardIndex, int32 NumShards);
+
+	/* Sidecar file the builder periodically flushes its progress to. */
+	static FString GetCheckpointFilename(const FString& AssetName, int32 ShardIndex, int32 NumShards);
+};
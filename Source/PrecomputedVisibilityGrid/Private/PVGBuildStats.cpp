@@ -0,0 +1,152 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGBuildStats.h"
+
+#include "PVGBuildFile.h"
+#include "HAL/PlatformMemory.h"
+#include "Misc/FileHelper.h"
+#include "ProfilingDebugging/CountersTrace.h"
+#include "Serialization/JsonWriter.h"
+
+TRACE_DECLARE_INT_COUNTER(PVGPairsResolved,TEXT("PVG/PairsResolved"));
+TRACE_DECLARE_INT_COUNTER(PVGRaysTraced,TEXT("PVG/RaysTraced"));
+TRACE_DECLARE_MEMORY_COUNTER(PVGPeakMemory,TEXT("PVG/PeakUsedPhysical"));
+
+const TCHAR* FPVGBuildStats::GetStageName(EPVGBuildStage Stage)
+{
+	switch (Stage)
+	{
+	case EPVGBuildStage::Known:				return TEXT("Known");
+	case EPVGBuildStage::Distance:			return TEXT("Distance");
+	case EPVGBuildStage::DirectTrace:		return TEXT("DirectTrace");
+	case EPVGBuildStage::CornerTrace:		return TEXT("CornerTrace");
+	case EPVGBuildStage::SuperCells:		return TEXT("SuperCells");
+	case EPVGBuildStage::SolidOccluders:	return TEXT("SolidOccluders");
+	case EPVGBuildStage::BoxScene:			return TEXT("BoxScene");
+	case EPVGBuildStage::Shotgun:			return TEXT("Shotgun");
+	default:								return TEXT("Unknown");
+	}
+}
+
+void FPVGBuildStats::Reset()
+{
+	for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+	{
+		Resolved[Stage] = 0;
+		StageCycles[Stage] = 0;
+	}
+	NumRays = 0;
+
+	BeginTime = FPlatformTime::Seconds();
+	PeakUsedPhysical = FPlatformMemory::GetStats().PeakUsedPhysical;
+	LastStep = FStep();
+	Steps.Reset();
+}
+
+FPVGBuildStats::FStep FPVGBuildStats::Snapshot() const
+{
+	FStep Step;
+	Step.Seconds = FPlatformTime::Seconds() - BeginTime;
+	Step.Rays = NumRays.load(std::memory_order_relaxed);
+	for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+	{
+		Step.Resolved[Stage] = Resolved[Stage].load(std::memory_order_relaxed);
+		Step.StageSeconds[Stage] = StageCycles[Stage].load(std::memory_order_relaxed) * FPlatformTime::GetSecondsPerCycle64();
+	}
+	return Step;
+}
+
+void FPVGBuildStats::EndStep(int32 Id)
+{
+	const FStep Total = Snapshot();
+
+	FStep& Step = Steps.AddDefaulted_GetRef();
+	Step.Id = Id;
+	Step.Seconds = Total.Seconds - LastStep.Seconds;
+	Step.Rays = Total.Rays - LastStep.Rays;
+	int64 NumResolved = 0;
+	for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+	{
+		Step.Resolved[Stage] = Total.Resolved[Stage] - LastStep.Resolved[Stage];
+		Step.StageSeconds[Stage] = Total.StageSeconds[Stage] - LastStep.StageSeconds[Stage];
+		NumResolved += Total.Resolved[Stage];
+	}
+	LastStep = Total;
+
+	PeakUsedPhysical = FMath::Max<uint64>(PeakUsedPhysical,FPlatformMemory::GetStats().PeakUsedPhysical);
+
+	TRACE_COUNTER_SET(PVGPairsResolved,NumResolved);
+	TRACE_COUNTER_SET(PVGRaysTraced,Total.Rays);
+	TRACE_COUNTER_SET(PVGPeakMemory,PeakUsedPhysical);
+}
+
+bool FPVGBuildStats::WriteReport(const FString& AssetName, const FString& Mode) const
+{
+	const FStep Total = Snapshot();
+	const FString BaseFilename = FPVGBuildFile::GetDirectory() / AssetName + TEXT("_report");
+
+	// One row per step, stage seconds are summed over all threads.
+	FString Csv = TEXT("Step,Id,Seconds,Rays,RaysPerSecond");
+	for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+	{
+		Csv += FString::Printf(TEXT(",%sPairs,%sSeconds"),GetStageName((EPVGBuildStage)Stage),GetStageName((EPVGBuildStage)Stage));
+	}
+	Csv += LINE_TERMINATOR;
+
+	for (int32 i = 0; i < Steps.Num(); i++)
+	{
+		const FStep& Step = Steps[i];
+		Csv += FString::Printf(TEXT("%d,%d,%.3f,%lld,%.0f"),i,Step.Id,Step.Seconds,Step.Rays,Step.Seconds > 0 ? Step.Rays / Step.Seconds : 0.0);
+		for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+		{
+			Csv += FString::Printf(TEXT(",%lld,%.3f"),Step.Resolved[Stage],Step.StageSeconds[Stage]);
+		}
+		Csv += LINE_TERMINATOR;
+	}
+
+	FString Json;
+	const TSharedRef<TJsonWriter<>> Writer = TJsonWriterFactory<>::Create(&Json);
+	Writer->WriteObjectStart();
+	Writer->WriteValue(TEXT("Asset"),AssetName);
+	Writer->WriteValue(TEXT("Mode"),Mode);
+	Writer->WriteValue(TEXT("Seconds"),Total.Seconds);
+	Writer->WriteValue(TEXT("Steps"),Steps.Num());
+	Writer->WriteValue(TEXT("Rays"),Total.Rays);
+	Writer->WriteValue(TEXT("RaysPerSecond"),Total.Seconds > 0 ? Total.Rays / Total.Seconds : 0.0);
+	Writer->WriteValue(TEXT("PeakUsedPhysicalMB"),PeakUsedPhysical / (1024.0 * 1024.0));
+	Writer->WriteObjectStart(TEXT("Stages"));
+	for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+	{
+		Writer->WriteObjectStart(GetStageName((EPVGBuildStage)Stage));
+		Writer->WriteValue(TEXT("Pairs"),Total.Resolved[Stage]);
+		Writer->WriteValue(TEXT("Seconds"),Total.StageSeconds[Stage]);
+		Writer->WriteObjectEnd();
+	}
+	Writer->WriteObjectEnd();
+	Writer->WriteObjectEnd();
+	Writer->Close();
+
+	const bool bSucceeded = FFileHelper::SaveStringToFile(Csv,*(BaseFilename + TEXT(".csv"))) && FFileHelper::SaveStringToFile(Json,*(BaseFilename + TEXT(".json")));
+	if (bSucceeded)
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Build report written to %s.csv/.json"),*BaseFilename);
+	}
+	else
+	{
+		UE_LOG(LogTemp,Error,TEXT("Failed to write the build report to %s."),*BaseFilename);
+	}
+	return bSucceeded;
+}
+
+void FPVGBuildStats::LogSummary() const
+{
+	const FStep Total = Snapshot();
+	UE_LOG(LogTemp,Warning,TEXT("Build stats: %lld rays in %.1f sec (%.0f rays/sec), peak memory %.1f MB."),
+		Total.Rays,Total.Seconds,Total.Seconds > 0 ? Total.Rays / Total.Seconds : 0.0,PeakUsedPhysical / (1024.0 * 1024.0));
+
+	for (int32 Stage = 0; Stage < (int32)EPVGBuildStage::Num; Stage++)
+	{
+		UE_LOG(LogTemp,Warning,TEXT("\t%-16s %12lld pairs %10.2f sec"),GetStageName((EPVGBuildStage)Stage),Total.Resolved[Stage],Total.StageSeconds[Stage]);
+	}
+}
@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/* Builder stages that can resolve a cell pair, in the order a pair goes through them. */
+enum class EPVGBuildStage : uint8
+{
+	/* Already resolved when the builder got to it, e.g. reused by an incremental build, skipped as unreachable or resolved
+	 * from the other side. */
+	Known,
+	/* Beyond the view distance of a streamed batch. */
+	Distance,
+	DirectTrace,
+	CornerTrace,
+	SuperCells,
+	SolidOccluders,
+	BoxScene,
+	Shotgun,
+	Num
+};
+
+/*
+ * Counters and timings of a single build, written to a CSV/JSON report next to the checkpoints when the build finishes.
+ * Counters are safe to bump from the builder's worker threads. Steps (shell cells, streamed batches or pair pool progress
+ * samples) are closed on the game thread and record what changed since the previous step.
+ */
+class FPVGBuildStats
+{
+public:
+	static const TCHAR* GetStageName(EPVGBuildStage Stage);
+
+	void Reset();
+
+	void AddResolved(EPVGBuildStage Stage, int64 NumPairs = 1)
+	{
+		Resolved[(int32)Stage].fetch_add(NumPairs,std::memory_order_relaxed);
+	}
+
+	void AddTime(EPVGBuildStage Stage, double Seconds)
+	{
+		StageCycles[(int32)Stage].fetch_add(FMath::TruncToInt64(Seconds / FPlatformTime::GetSecondsPerCycle64()),std::memory_order_relaxed);
+	}
+
+	void AddRays(int64 Num)
+	{
+		NumRays.fetch_add(Num,std::memory_order_relaxed);
+	}
+
+	/* Close the current step, Id is the source cell or batch it belongs to. */
+	void EndStep(int32 Id);
+
+	/* Writes <AssetName>_report.csv with one row per step and <AssetName>_report.json with the totals. */
+	bool WriteReport(const FString& AssetName, const FString& Mode) const;
+
+	void LogSummary() const;
+
+private:
+	struct FStep
+	{
+		int32 Id = 0;
+		double Seconds = 0;
+		int64 Rays = 0;
+		int64 Resolved[(int32)EPVGBuildStage::Num] = {};
+		double StageSeconds[(int32)EPVGBuildStage::Num] = {};
+	};
+
+	/* Totals so far, a step with all counters taken right now. */
+	FStep Snapshot() const;
+
+	std::atomic<int64> Resolved[(int32)EPVGBuildStage::Num] = {};
+	std::atomic<int64> StageCycles[(int32)EPVGBuildStage::Num] = {};
+	std::atomic<int64> NumRays = 0;
+
+	double BeginTime = 0;
+	uint64 PeakUsedPhysical = 0;
+
+	FStep LastStep;
+	TArray<FStep> Steps;
+};
+
+/* Adds the time spent in its scope to a stage. */
+struct FPVGStageTimer
+{
+	FPVGStageTimer(FPVGBuildStats& InStats, EPVGBuildStage InStage)
+		: Stats(InStats), Stage(InStage), Start(FPlatformTime::Seconds())
+	{
+	}
+
+	~FPVGStageTimer()
+	{
+		Stats.AddTime(Stage,FPlatformTime::Seconds() - Start);
+	}
+
+private:
+	FPVGBuildStats& Stats;
+	EPVGBuildStage Stage;
+	double Start;
+};
@@ -5,15 +5,29 @@
 
 #include "EngineUtils.h"
 #include "PrecomputedVisibilityGrid.h"
+#include "PVGAdaptiveCells.h"
+#include "PVGBoxDecomposition.h"
+#include "PVGBuildFile.h"
+#include "PVGBuildStats.h"
 #include "PVGManager.h"
+#include "PVGDeveloperSettings.h"
+#include "PVGOccupancyVolume.h"
+#include "PVGCollisionBVH.h"
 #include "PVGPrecomputedGridDataAsset.h"
+#include "PVGRaySampler.h"
+#include "PVGReachability.h"
+#include "PVGSoftwareOcclusion.h"
 #include "AssetRegistry/AssetRegistryModule.h"
 #include "InstancedFoliageActor.h"
 #include "Async/ParallelFor.h"
+#include "Async/TaskGraphInterfaces.h"
+#include "Components/InstancedStaticMeshComponent.h"
 #include "Components/WorldPartitionStreamingSourceComponent.h"
+#include "HAL/FileManager.h"
 #include "Kismet/GameplayStatics.h"
 #include "Kismet/KismetMathLibrary.h"
 #include "UObject/SavePackage.h"
+#include "WorldPartition/LoaderAdapter/LoaderAdapterShape.h"
 
 #define BOX_SCENE 1
 
@@ -21,10 +35,10 @@ TAutoConsoleVariable<float> CVARPVGBuilderOcclusionTestMultiplier(TEXT("r.Cullin
 
 FIntVector IndexTo3D_(int32 Index, const UPVGPrecomputedGridDataAsset* Self)
 {
-	uint16 z = Index / (Self->GetGridSizeX() * Self->GetGridSizeY());
+	int32 z = Index / (Self->GetGridSizeX() * Self->GetGridSizeY());
 	Index -= (z * Self->GetGridSizeX() * Self->GetGridSizeY());
-	uint16 y = Index / Self->GetGridSizeX();
-	uint16 x = Index % Self->GetGridSizeX();
+	int32 y = Index / Self->GetGridSizeX();
+	int32 x = Index % Self->GetGridSizeX();
 
 	return FIntVector(x,y,z);
 };
@@ -40,25 +54,137 @@ APVGBuilder::APVGBuilder()
 	StreamingSourceComponent = CreateDefaultSubobject<UWorldPartitionStreamingSourceComponent>(TEXT("StreamingSourceComp"));
 }
 
-void APVGBuilder::Initialize(const TArray<FVector>& InLocations, FIntVector GridSize)
+void APVGBuilder::Initialize(const TArray<FVector>& InLocations, FIntVector GridSize, const FPVGBuildOptions& Options)
 {
-	LocationsToBuild = InLocations;
-	
-	if (InLocations.Num() >= MAX_uint16)
+	GridLocations = InLocations;
+	BuildOptions = Options;
+	RefreshTraceParams();
+
+	BuildStats = MakeShared<FPVGBuildStats>();
+	BuildStats->Reset();
+
+	BuildMode = UPVGDeveloperSettings::GetBuildMode();
+	if (BuildOptions.IsSharded() && BuildMode != EPVGBuildMode::PairPool)
+	{
+		// Shells depend on the order cells get resolved in, only pairs split deterministically.
+		UE_LOG(LogTemp,Warning,TEXT("Sharded builds always use the pair pool."));
+		BuildMode = EPVGBuildMode::PairPool;
+	}
+
+	// Streamed builds start with nothing loaded, the passes that look at the whole world up front would see an empty one.
+	const bool bIsStreamed = BuildMode == EPVGBuildMode::Streamed;
+	if (bIsStreamed)
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Streamed build, skipping adaptive cells, solid occluders, reachability and incremental reuse."));
+		BuildOptions.bIncremental = false;
+	}
+
+	LeafCodes.Reset();
+	LeafLevels.Reset();
+	BuildCellExtents.Reset();
+	if (UPVGDeveloperSettings::UseAdaptiveCells() && !BuildOptions.IsSharded() && !bIsStreamed)
+	{
+		BuildAdaptiveCells(GridSize);
+	}
+	else
 	{
-		UE_LOG(LogTemp,Warning,TEXT("Max num cells, please reduce resolution"));
-		if ( APlayerController* TargetPC = UGameplayStatics::GetPlayerController(GetWorld(), 0) )
+		if (UPVGDeveloperSettings::UseAdaptiveCells() && BuildOptions.IsSharded())
 		{
-			TargetPC->ConsoleCommand(TEXT("Exit"), true);
+			// Every shard would have to come up with the exact same leaves, keep the plain grid.
+			UE_LOG(LogTemp,Warning,TEXT("Sharded builds don't support adaptive cells, building the plain grid."));
 		}
+		LocationsToBuild = InLocations;
+	}
+
+	if (LocationsToBuild.Num() > FPVGPairMatrix::MaxCells)
+	{
+		// The streamed mode doesn't lift this, it has no adaptive cells either.
+		UE_LOG(LogTemp,Error,TEXT("%d cells to build, the pair state supports at most %d in every build mode. Use bigger cells%s."),
+			LocationsToBuild.Num(),FPVGPairMatrix::MaxCells,bIsStreamed ? TEXT("") : TEXT(" or adaptive cells"));
+		SetActorTickEnabled(false);
 		return;
 	}
-	
+
+	if (LeafCodes.Num() > 0 && BuildMode != EPVGBuildMode::PairPool)
+	{
+		// Shells walk the uniform grid around the current cell.
+		UE_LOG(LogTemp,Warning,TEXT("Adaptive cells always use the pair pool."));
+		BuildMode = EPVGBuildMode::PairPool;
+	}
+
+	// Remember the previous result before the grid gets reset.
+	uint32 PreviousSignature = 0;
+	TArray<uint32> PreviousHashes;
+	if (const UPVGPrecomputedGridDataAsset* PreviousAsset = APVGManager::GetManager()->GridDataAsset)
+	{
+		PreviousSignature = PreviousAsset->GetGridSignature();
+		PreviousHashes = PreviousAsset->CellGeometryHashes;
+	}
 
 	UPVGPrecomputedGridDataAsset* Asset = GetOrCreateCellData(GridSize);
+	UE_LOG(LogTemp,Warning,TEXT("Building %d cells in %d sectors, pair state starts at %.1f MB and takes up to %.1f MB once every pair is written."),
+		LocationsToBuild.Num(),Asset->GetNumSectors(),Asset->PairMatrix.GetAllocatedSize() / (1024.f * 1024.f),
+		Asset->PairMatrix.GetNumPairs() / (8.f * 1024.f * 1024.f) * 2.f);
+
+	// Hashes of a world that isn't loaded would make the next incremental build skip real changes.
+	TArray<uint32> CellHashes;
+	if (!bIsStreamed)
+	{
+		ComputeCellGeometryHashes(CellHashes);
+	}
+
+	if (BuildOptions.bIncremental && !PrepareIncrementalBuild(PreviousSignature,PreviousHashes,CellHashes))
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Previous grid data can't be reused, doing a full build."));
+	}
+	Asset->CellGeometryHashes = MoveTemp(CellHashes);
+	
+	if (BuildMode == EPVGBuildMode::PairPool)
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Building %lld pairs in the pair pool, the whole grid needs to be loaded."),Asset->PairMatrix.GetNumPairs());
+	}
+
+	if (BuildOptions.bResume && !ReadCheckpoint())
+	{
+		UE_LOG(LogTemp,Warning,TEXT("No matching checkpoint found, starting from scratch."));
+	}
+
+	CellOccupancy.Empty();
+	SolidOccluders.Empty();
+	ReachableCells.Empty();
+	Asset->ReachableBuildCells.Empty();
+	if (!bIsStreamed)
+	{
+		ClassifyCells(GridSize);
+		BuildSolidOccluders(GridSize);
+		BuildReachability(GridSize);
+	}
+
+	if (bIsStreamed)
+	{
+		SetupStreamedBuild();
+	}
+	else if (UPVGDeveloperSettings::UseOccupancyVolume() || UPVGDeveloperSettings::UseCollisionSnapshot())
+	{
+		FBox Bounds(ForceInit);
+		for (int32 Cell = 0; Cell < LocationsToBuild.Num(); Cell++)
+		{
+			Bounds += GetBuildCellBox(Cell);
+		}
+
+		if (UPVGDeveloperSettings::UseOccupancyVolume())
+		{
+			BuildOccupancyVolume(Bounds);
+		}
+		if (UPVGDeveloperSettings::UseCollisionSnapshot())
+		{
+			BuildCollisionSnapshot(Bounds);
+		}
+	}
 	
 	bIsInitialized = true;
 	BeginTime = FPlatformTime::Seconds();
+	LastCheckpointTime = BeginTime;
 }
 
 // Called when the game starts or when spawned
@@ -68,6 +194,21 @@ void APVGBuilder::BeginPlay()
 	
 }
 
+void APVGBuilder::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	// Don't leave the workers running on a dead builder.
+	if (PairPoolTask.IsValid())
+	{
+		bCancelPairPool = true;
+		PairPoolTask.Wait();
+	}
+	OccupancyVolume.Reset();
+	CollisionBVH.Reset();
+	StreamedLoader.Reset();
+	
+	Super::EndPlay(EndPlayReason);
+}
+
 UPVGPrecomputedGridDataAsset* APVGBuilder::GetOrCreateCellData(FIntVector GridSize)
 {
 	APVGManager* Manager = APVGManager::GetManager();
@@ -85,6 +226,8 @@ UPVGPrecomputedGridDataAsset* APVGBuilder::GetOrCreateCellData(FIntVector GridSi
 		UPVGPrecomputedGridDataAsset* Obj = NewObject<UPVGPrecomputedGridDataAsset>(CellDataAsset, UPVGPrecomputedGridDataAsset::StaticClass(), *Name, EObjectFlags::RF_Public | EObjectFlags::RF_Standalone);
 		FAssetRegistryModule::AssetCreated(Obj);
 
+		// Shards only write partial files and the merge step fills the asset, but it has to exist on disk for the
+		// manager to keep referencing it.
 		if (Obj)
 		{
 			FSavePackageArgs SaveArgs;
@@ -110,37 +253,30 @@ UPVGPrecomputedGridDataAsset* APVGBuilder::GetOrCreateCellData(FIntVector GridSi
 	}
 	
 	// Setup save data.
-	Manager->GridDataAsset->GridSizeX = GridSize.X;
-	Manager->GridDataAsset->GridSizeY = GridSize.Y;
-	Manager->GridDataAsset->GridSizeZ = GridSize.Z;
-	Manager->GridDataAsset->CellExtents = APVGManager::GetManager()->CellSize.GetExtent();
-	Manager->GridDataAsset->GridBounds = APVGManager::GetManager()->GridBounds;
-
-	Manager->GridDataAsset->Modify();
-	
-	// Setup default array.
-	const int32 GridArraySize = GridSize.X * GridSize.Y * GridSize.Z;
-	Manager->GridDataAsset->GridData.Empty();
-	Manager->GridDataAsset->GridData.SetNumZeroed(GridArraySize);
+	Manager->GridDataAsset->InitializeGrid(GridSize,Manager->CellSize.GetExtent(),Manager->GridBounds,LeafCodes,LeafLevels);
 		
 	return Manager->GridDataAsset;
 }
 
-bool APVGBuilder::BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox)
+bool APVGBuilder::BoxOcclusion(int32 Location, const FBox& TargetBox)
+{
+	return BoxOcclusion(LocationsToBuild[Location],TargetBox,BoxScene);
+}
+
+bool APVGBuilder::BoxOcclusion(const FVector& CameraLocation, const FBox& TargetBox, const TArray<FBox>& Scene, bool bParallel) const
 {
 	TArray<FBox> Blockers;
 	
-	const FVector CameraLocation =		LocationsToBuild[Location];
-	const FRotator CameraViewRotator =	UKismetMathLibrary::FindLookAtRotation(LocationsToBuild[Location],LocationsToBuild[Target]);
-	const FVector TargetLocation =		LocationsToBuild[Target];
+	const FVector TargetLocation =		TargetBox.GetCenter();
+	const FRotator CameraViewRotator =	UKismetMathLibrary::FindLookAtRotation(CameraLocation,TargetLocation);
 	
-	for (int32 i = 0; i < BoxScene.Num(); i++)
+	for (int32 i = 0; i < Scene.Num(); i++)
 	{
 		FVector Hit, Normal;
 		float Time;
-		if (FMath::LineExtentBoxIntersection(BoxScene[i],CameraLocation,TargetLocation,BaseBox.GetExtent(),Hit,Normal,Time))
+		if (!Scene[i].IsInside(CameraLocation) && FMath::LineExtentBoxIntersection(Scene[i],CameraLocation,TargetLocation,TargetBox.GetExtent(),Hit,Normal,Time))
 		{
-			Blockers.Add(BoxScene[i]);
+			Blockers.Add(Scene[i]);
 		}
 	}
 
@@ -148,6 +284,23 @@ bool APVGBuilder::BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox)
 	{
 		return false;
 	}
+
+	if (UPVGDeveloperSettings::UseSoftwareOcclusion())
+	{
+		FPVGSoftwareOcclusion Occlusion;
+		if (!Occlusion.SetupView(CameraLocation,TargetBox))
+		{
+			return false;
+		}
+
+		for (const FBox& Blocker : Blockers)
+		{
+			Occlusion.RenderBox(Blocker);
+		}
+		Occlusion.BuildHiZ();
+		
+		return Occlusion.IsTargetOccluded();
+	}
 	
 	constexpr float HalfFOVRadians = FMath::DegreesToRadians<float>(50) * 0.5f;
 	FMatrix const ViewRotationMatrix = FInverseRotationMatrix(CameraViewRotator) * FMatrix( FPlane(0,	0,	1,	0), FPlane(1,	0,	0,	0), FPlane(0,	1,	0,	0), FPlane(0,	0,	0,	1));
@@ -158,7 +311,6 @@ bool APVGBuilder::BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox)
 	FVector TargetVerts3D[8];
 	TArray<FVector2d> TargetVertsInScreenSpace;
 		
-	const FBox TargetBox = BaseBox.MoveTo(LocationsToBuild[Target]);
 	TargetBox.GetVertices(TargetVerts3D);
 
 	for (int32 i = 0; i < 8; i++)
@@ -185,7 +337,7 @@ bool APVGBuilder::BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox)
 			// check if we can grow the box.
 			FVector BlockerVerts3D[8];
 			TArray<FVector2d> BlockerVertsInScreenSpace;
-			const FBox& BlockerBox = BoxScene[i];
+			const FBox& BlockerBox = Blockers[i];
 			BlockerBox.GetVertices(BlockerVerts3D);
 			
 			for (int32 j = 0; j < 8; j++)
@@ -235,7 +387,7 @@ bool APVGBuilder::BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox)
 				break;
 			}
 		}
-	});
+	},bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
 
 	for (bool Result : Results)
 	{
@@ -246,7 +398,139 @@ bool APVGBuilder::BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox)
 	return false;
 }
 
-bool APVGBuilder::BoxCornerTraceCheck(FVector A, FVector B, FBox Base)
+int32 APVGBuilder::ResolveSuperCells(int32 Ring, int32 SuperCellSize)
+{
+	const UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	const FIntVector GridSize(Asset->GetGridSizeX(),Asset->GetGridSizeY(),Asset->GetGridSizeZ());
+	const FIntVector Origin = IndexTo3D(CurrentCell,GridSize.X,GridSize.Y);
+
+	// Only blocks touching the ring box, their nearest cell can't be further out.
+	FIntVector FirstBlock, LastBlock;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		FirstBlock[Axis] = FMath::Max(0,Origin[Axis] - Ring) / SuperCellSize;
+		LastBlock[Axis] = FMath::Min(GridSize[Axis] - 1,Origin[Axis] + Ring) / SuperCellSize;
+	}
+
+	int32 NumResolved = 0;
+	for (int32 bz = FirstBlock.Z; bz <= LastBlock.Z; bz++)
+	{
+		for (int32 by = FirstBlock.Y; by <= LastBlock.Y; by++)
+		{
+			for (int32 bx = FirstBlock.X; bx <= LastBlock.X; bx++)
+			{
+				const FIntVector BlockMin = FIntVector(bx,by,bz) * SuperCellSize;
+				FIntVector BlockMax;
+				int32 Distance = 0;
+				for (int32 Axis = 0; Axis < 3; Axis++)
+				{
+					BlockMax[Axis] = FMath::Min(BlockMin[Axis] + SuperCellSize,GridSize[Axis]) - 1;
+					Distance = FMath::Max(Distance,FMath::Max(BlockMin[Axis] - Origin[Axis],Origin[Axis] - BlockMax[Axis]));
+				}
+
+				// Every block gets tested once, on the ring of its nearest cell, against the blockers of all rings inside it.
+				if (Distance == Ring)
+				{
+					NumResolved += ResolveSuperCell(BlockMin,BlockMax);
+				}
+			}
+		}
+	}
+	return NumResolved;
+}
+
+int32 APVGBuilder::ResolveSuperCell(const FIntVector& BlockMin, const FIntVector& BlockMax)
+{
+	// Single cells go through the regular tests.
+	if (BlockMin == BlockMax)
+	{
+		return 0;
+	}
+
+	UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	const FPVGPairMatrix& PairMatrix = Asset->PairMatrix;
+	const int32 MaxX = Asset->GetGridSizeX();
+	const int32 MaxY = Asset->GetGridSizeY();
+
+	TArray<int32, TInlineAllocator<64>> Unresolved;
+	for (int32 z = BlockMin.Z; z <= BlockMax.Z; z++)
+	{
+		for (int32 y = BlockMin.Y; y <= BlockMax.Y; y++)
+		{
+			for (int32 x = BlockMin.X; x <= BlockMax.X; x++)
+			{
+				const int32 Cell = XYZToIndex(x,y,z,MaxX,MaxY);
+				if (!PairMatrix.IsResolved(CurrentCell,Cell))
+				{
+					Unresolved.Add(Cell);
+				}
+			}
+		}
+	}
+
+	if (Unresolved.Num() <= 1)
+	{
+		return 0;
+	}
+
+	const FVector Extent = Asset->GetCellExtents();
+	const FBox BlockBox(LocationsToBuild[XYZToIndex(BlockMin,MaxX,MaxY)] - Extent,LocationsToBuild[XYZToIndex(BlockMax,MaxX,MaxY)] + Extent);
+	if (BoxOcclusion(CurrentCell,BlockBox))
+	{
+		// The box scene only approximates the blockers, cells of the block still need to pass the same cheap traces as
+		// single cells before they count as occluded.
+		FCollisionQueryParams QueryParams;
+		FCollisionResponseParams ResponseParams;
+		GetTraceParams(QueryParams,ResponseParams);
+		UWorld* World = GEditor->GetEditorWorldContext().World();
+		
+		std::atomic<int32> NumOccluded = 0;
+		ParallelFor(Unresolved.Num(),[&](int32 i)
+		{
+			const int32 Cell = Unresolved[i];
+			BuildStats->AddRays(1);
+			if (!IsTraceBlocked(World,LocationsToBuild[Cell],LocationsToBuild[CurrentCell],QueryParams,ResponseParams))
+			{
+				BuildStats->AddResolved(EPVGBuildStage::DirectTrace);
+				Asset->SetDataCell(CurrentCell,Cell,true);
+				return;
+			}
+			if (BoxCornerTraceCheck(GetBuildCellBox(Cell),GetBuildCellBox(CurrentCell)))
+			{
+				BuildStats->AddResolved(EPVGBuildStage::CornerTrace);
+				Asset->SetDataCell(CurrentCell,Cell,true);
+				return;
+			}
+			Asset->SetDataCell(CurrentCell,Cell,false);
+			NumOccluded++;
+		});
+		return NumOccluded.load();
+	}
+
+	// Mixed block, descend into its octants.
+	const FIntVector Mid = BlockMin + (BlockMax - BlockMin + FIntVector(1)) / 2;
+	int32 NumResolved = 0;
+	for (int32 Octant = 0; Octant < 8; Octant++)
+	{
+		FIntVector ChildMin, ChildMax;
+		bool bIsEmpty = false;
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			const bool bUpper = (Octant >> Axis) & 1;
+			ChildMin[Axis] = bUpper ? Mid[Axis] : BlockMin[Axis];
+			ChildMax[Axis] = bUpper ? BlockMax[Axis] : Mid[Axis] - 1;
+			bIsEmpty |= ChildMin[Axis] > ChildMax[Axis];
+		}
+		
+		if (!bIsEmpty)
+		{
+			NumResolved += ResolveSuperCell(ChildMin,ChildMax);
+		}
+	}
+	return NumResolved;
+}
+
+bool APVGBuilder::BoxCornerTraceCheck(const FBox& ABox, const FBox& BBox)
 {
 	FWorldContext& EditorWorldContext = GEditor->GetEditorWorldContext();
 	
@@ -257,9 +541,6 @@ bool APVGBuilder::BoxCornerTraceCheck(FVector A, FVector B, FBox Base)
 	QueryParams.bTraceComplex = true;
 	QueryParams.AddIgnoredActor(APVGManager::GetManager()->Player);
 	
-	FBox ABox = Base.MoveTo(A);
-	FBox BBox = Base.MoveTo(B);
-
 	FVector AVertices[8];
 	FVector BVertices[8];
 	ABox.GetVertices(AVertices);
@@ -273,213 +554,170 @@ bool APVGBuilder::BoxCornerTraceCheck(FVector A, FVector B, FBox Base)
 		{
 			const FVector& BVert = BVertices[j];
 						
-			if(!EditorWorldContext.World()->LineTraceTestByChannel(AVert,BVert,ECollisionChannel::ECC_Visibility,QueryParams,ResponseParams))
+			if(!IsTraceBlocked(EditorWorldContext.World(),AVert,BVert,QueryParams,ResponseParams))
 			{
+				BuildStats->AddRays(i * 8 + j + 1);
 				return true;
 			}
 		}
 	}
+	BuildStats->AddRays(64);
 	return false;
 }
 
-void APVGBuilder::UpdateBoxScene()
+FBox APVGBuilder::GetBuildCellBox(int32 Index) const
 {
-	
-	const UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
-	const uint16 MaxX  = Asset->GetGridSizeX();
-	const uint16 MaxY = Asset->GetGridSizeY();
-	const FBox SourceBox = Asset->GetCellBox();
-	TSet<uint16> Processed;
-
-	BoxScene.Reset();
-	
-	int32 CurrentBox = 0;
-	TArray<FBox> Boxes;
-
-	constexpr bool MinimalMemoryOptimization = true;
-
-	// Build biggest boxes.
-	while ( CurrentBox <  ViewBlockers.Num())
-	{
-		bool bCanGrowX = true;
-		bool bCanGrowY = true;
-		bool bCanGrowZ = true;
-		
-		uint16 X = 0;
-		uint16 Y = 0;
-		uint16 Z = 0;
+	const FVector Extent = BuildCellExtents.Num() > 0 ? BuildCellExtents[Index] : APVGManager::GetManager()->GridDataAsset->GetCellExtents();
+	return FBox(LocationsToBuild[Index] - Extent,LocationsToBuild[Index] + Extent);
+}
 
-		const uint16 Origin = ViewBlockers[CurrentBox];
+void APVGBuilder::BuildAdaptiveCells(const FIntVector& GridSize)
+{
+	const FVector CellSize = APVGManager::GetManager()->CellSize.GetSize();
+	const FVector GridOrigin = GridLocations[0] - CellSize * 0.5f;
 
-		// Add origin.
-		TSet<uint16> Entries;
-		Entries.Add(Origin);
-		
-		while (bCanGrowX || bCanGrowY || bCanGrowZ)
-		{
-			if (bCanGrowX)
-			{
-				TSet<uint16> TempEntriesX;
-				
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,MaxX,MaxY);
-					const uint16 TestLocation = XYZToIndex(Loc + FIntVector(1,0,0), MaxX,MaxY);
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
 
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (ViewBlockers.Contains(TestLocation) && (MinimalMemoryOptimization || !Processed.Contains(TestLocation)))
-					{
-						TempEntriesX.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowX = false;
-						break;
-					}
-				}
-				
-				if (bCanGrowX)
-				{
-					X++;
-					Entries.Append(TempEntriesX);
-				}
-			}
-			
-			if (bCanGrowY)
-			{
-				TSet<uint16> TempEntriesY;
+	FPVGAdaptiveCells::Build(GEditor->GetEditorWorldContext().World(),GridSize,GridOrigin,CellSize,UPVGDeveloperSettings::GetAdaptiveCellMaxLevel(),
+		QueryParams,ResponseParams,LeafCodes,LeafLevels);
 
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,MaxX,MaxY);
-					const uint16 TestLocation = XYZToIndex(Loc + FIntVector(0,1,0), MaxX,MaxY);
+	LocationsToBuild.SetNum(LeafCodes.Num());
+	BuildCellExtents.SetNum(LeafCodes.Num());
+	for (int32 Leaf = 0; Leaf < LeafCodes.Num(); Leaf++)
+	{
+		FIntVector Min, Max;
+		FPVGAdaptiveCells::GetLeafRange(LeafCodes[Leaf],LeafLevels[Leaf],GridSize,Min,Max);
+		BuildCellExtents[Leaf] = FVector(Max - Min + FIntVector(1)) * CellSize * 0.5f;
+		LocationsToBuild[Leaf] = GridOrigin + FVector(Min) * CellSize + BuildCellExtents[Leaf];
+	}
+}
 
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (ViewBlockers.Contains(TestLocation) && (MinimalMemoryOptimization || !Processed.Contains(TestLocation)))
-					{
-						TempEntriesY.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowY = false;
-						break;
-					}
-				}
+void APVGBuilder::ClassifyCells(const FIntVector& GridSize)
+{
+	CellOccupancy.Empty();
+	if (!UPVGDeveloperSettings::UseSolidOccluders() && UPVGDeveloperSettings::GetReachability() != EPVGReachability::FloodFill)
+	{
+		return;
+	}
 
-				if (bCanGrowY)
-				{
-					Entries.Append(TempEntriesY);
-					Y++;
-				}
-			}
-			
-			if (bCanGrowZ)
-			{
-				TSet<uint16> TempEntriesZ;
+	const FVector CellSize = APVGManager::GetManager()->CellSize.GetSize();
+	const FVector GridOrigin = GridLocations[0] - CellSize * 0.5f;
 
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,MaxX, MaxY);
-					const uint16 TestLocation = XYZToIndex(Loc + FIntVector(0,0,1), MaxX, MaxY);
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
 
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (ViewBlockers.Contains(TestLocation) && (MinimalMemoryOptimization || !Processed.Contains(TestLocation)))
-					{
-						TempEntriesZ.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowZ = false;
-						break;
-					}
-				}
+	FPVGOccupancyVolume::ClassifyCells(GEditor->GetEditorWorldContext().World(),GridSize,GridOrigin,CellSize,QueryParams,ResponseParams,CellOccupancy);
+}
 
-				if (bCanGrowZ)
-				{
-					Entries.Append(TempEntriesZ);
-					Z++;
-				}
-			}
-		}
-		
-		Processed.Append(Entries);
+void APVGBuilder::BuildSolidOccluders(const FIntVector& GridSize)
+{
+	SolidOccluders.Empty();
+	if (!UPVGDeveloperSettings::UseSolidOccluders())
+	{
+		return;
+	}
 
-		{	// Build box.
-			FBox Base = Asset->GetCellBox();
-			Base = Base.MoveTo(LocationsToBuild[Origin]);
-			Base += Asset->GetCellBox().MoveTo(LocationsToBuild[Origin] + (FVector(X,Y,Z) * Asset->GetCellBox().GetSize()) );
-		
-			BoxScene.Add(Base);
-		}
-		// Skip cells we have processed already.
-		CurrentBox++;
-		while ( CurrentBox < ViewBlockers.Num() && Processed.Contains(ViewBlockers[CurrentBox]))
+	FPVGBitVolume Cells(GridSize);
+	for (int32 Cell = 0; Cell < CellOccupancy.Num(); Cell++)
+	{
+		if (CellOccupancy[Cell] == EPVGOccupancy::Solid)
 		{
-			CurrentBox++;
+			Cells.Set(Cell);
 		}
 	}
+
+	TArray<FPVGCellBox> Boxes;
+	FPVGBoxDecomposition::Decompose(Cells,UPVGDeveloperSettings::GetBoxPacking(),true,Boxes);
+
+	const FVector Extent = APVGManager::GetManager()->CellSize.GetExtent();
+	for (const FPVGCellBox& Box : Boxes)
+	{
+		SolidOccluders.Emplace(
+			GridLocations[XYZToIndex(Box.Min,GridSize.X,GridSize.Y)] - Extent,
+			GridLocations[XYZToIndex(Box.Max,GridSize.X,GridSize.Y)] + Extent);
+	}
+	
+	UE_LOG(LogTemp,Warning,TEXT("%d solid cells merged into %d occluder boxes."),Cells.CountSetBits(),SolidOccluders.Num());
 }
 
-// Called every frame
-void APVGBuilder::Tick(float DeltaTime)
+void APVGBuilder::BuildReachability(const FIntVector& GridSize)
 {
-	Super::Tick(DeltaTime);
-
- 	if (!bIsInitialized)
+	UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	FPVGPairMatrix& PairMatrix = Asset->PairMatrix;
+	
+	ReachableCells.Empty();
+	Asset->ReachableBuildCells.Empty();
+	
+	const EPVGReachability Mode = UPVGDeveloperSettings::GetReachability();
+	if (Mode == EPVGReachability::Disabled)
 	{
 		return;
 	}
 
-	if (CurrentCell >= LocationsToBuild.Num())
-	{
-		// We are done.
-		SetActorTickEnabled(false);
+	const FVector CellSize = APVGManager::GetManager()->CellSize.GetSize();
+	const FVector GridOrigin = GridLocations[0] - CellSize * 0.5f;
 
-		// Save package.
-		UPackage* Package = APVGManager::GetManager()->GridDataAsset->GetPackage();
-		const FString PackageName = Package->GetName();
-		const FString PackageFileName = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
 
-		FSavePackageArgs SaveArgs;
-	
-		// This is specified just for example
-		{
-			SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
-			SaveArgs.SaveFlags = SAVE_NoError;
-		}
-	
-		const bool bSucceeded = UPackage::SavePackage(Package, nullptr, *PackageFileName, SaveArgs);
+	TBitArray<> ReachableGridCells;
+	FPVGReachability::Build(GEditor->GetEditorWorldContext().World(),Mode,GridSize,GridOrigin,CellSize,UPVGDeveloperSettings::GetMaxCameraHeight(),
+		CellOccupancy,QueryParams,ResponseParams,ReachableGridCells);
 
-		if (!bSucceeded)
-		{
-			UE_LOG(LogTemp, Error, TEXT("Package '%s' wasn't saved!"), *PackageName)
-		}
+	// A leaf is a camera cell as soon as one of its grid cells is.
+	ReachableCells.Init(false,Asset->GetNumBuildCells());
+	for (TConstSetBitIterator<> It(ReachableGridCells); It; ++It)
+	{
+		ReachableCells[Asset->GetBuildCellIndex(It.GetIndex())] = true;
+	}
 
-		UE_LOG(LogTemp, Warning, TEXT("Package '%s' was successfully saved"), *PackageName)
-		UE_LOG(LogTemp,Warning,TEXT("Finished grid in %.f2 hour /(%.2f min)"),((FPlatformTime::Seconds() - BeginTime) / 60)/60, (FPlatformTime::Seconds() - BeginTime) / 60);
-		return;
+	// Pairs between two unreachable cells only end up in the data of unreachable cells, which isn't saved. They stay
+	// unresolved and the schedulers pass over them, see IsPairNeeded.
+	const int64 NumUnreachable = ReachableCells.Num() - ReachableCells.CountSetBits();
+	Asset->SetReachableBuildCells(ReachableCells);
+	
+	UE_LOG(LogTemp,Warning,TEXT("Solving visibility from %d of %d cells, %lld of %lld pairs skipped."),
+		ReachableCells.Num() - int32(NumUnreachable),ReachableCells.Num(),NumUnreachable * (NumUnreachable - 1) / 2,PairMatrix.GetNumPairs());
+}
+
+void APVGBuilder::UpdateBoxScene()
+{
+	const UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	const FIntVector GridSize(Asset->GetGridSizeX(),Asset->GetGridSizeY(),Asset->GetGridSizeZ());
+	
+	FPVGBitVolume Cells(GridSize);
+	for (const int32 Blocker : ViewBlockers)
+	{
+		Cells.Set(Blocker);
 	}
 
-	if (!MoveToLocation(CurrentCell))
+	// Build biggest boxes, overlap keeps them as big as possible.
+	TArray<FPVGCellBox> Boxes;
+	FPVGBoxDecomposition::Decompose(Cells,UPVGDeveloperSettings::GetBoxPacking(),true,Boxes);
+
+	BoxScene.Reset(Boxes.Num() + SolidOccluders.Num());
+	for (const FPVGCellBox& Box : Boxes)
 	{
-		// we are going to start tracing next frame.
-		bTraceCheckStage = true;
-		return;
+		FBox Base = Asset->GetCellBox().MoveTo(LocationsToBuild[XYZToIndex(Box.Min,GridSize.X,GridSize.Y)]);
+		Base += Asset->GetCellBox().MoveTo(LocationsToBuild[XYZToIndex(Box.Max,GridSize.X,GridSize.Y)]);
+		BoxScene.Add(Base);
 	}
+	BoxScene.Append(SolidOccluders);
+}
 
-	// Recaptured every frame to ensure we never get them in the test scene.
+void APVGBuilder::GetTraceParams(FCollisionQueryParams& OutQueryParams, FCollisionResponseParams& OutResponseParams) const
+{
+	OutQueryParams = TraceQueryParams;
+	OutResponseParams = TraceResponseParams;
+}
+
+void APVGBuilder::RefreshTraceParams()
+{
+	// Recaptured after every streaming update to ensure we never get them in the test scene.
 	TArray<AActor*> FoliageActors;
 	for (TActorIterator<AActor> It(GetWorld(), AInstancedFoliageActor::StaticClass()); It; ++It)
 	{
@@ -488,51 +726,1029 @@ void APVGBuilder::Tick(float DeltaTime)
 			FoliageActors.Add(FIA);
 		}
 	}
-
 	
 	// Setup default params.
-	FCollisionQueryParams QueryParams;
-	QueryParams.bTraceComplex = true;
-	QueryParams.AddIgnoredActors(FoliageActors);
+	TraceQueryParams = FCollisionQueryParams();
+	TraceQueryParams.bTraceComplex = true;
+	TraceQueryParams.AddIgnoredActors(FoliageActors);
 	
-	FCollisionResponseParams ResponseParams;
-	ResponseParams.CollisionResponse.SetAllChannels(ECollisionResponse::ECR_Block);
+	TraceResponseParams = FCollisionResponseParams();
+	TraceResponseParams.CollisionResponse.SetAllChannels(ECollisionResponse::ECR_Block);
 	
 	// Ignore all removables in the world.
-	ResponseParams.CollisionResponse.SetResponse(ECC_Destructible,ECR_Ignore);
-	ResponseParams.CollisionResponse.SetResponse(ECC_WorldDynamic,ECR_Ignore);
+	TraceResponseParams.CollisionResponse.SetResponse(ECC_Destructible,ECR_Ignore);
+	TraceResponseParams.CollisionResponse.SetResponse(ECC_WorldDynamic,ECR_Ignore);
+}
 
-	FWorldContext& EditorWorldContext = GEditor->GetEditorWorldContext();
-	UWorld* World = EditorWorldContext.World();
+bool APVGBuilder::IsTraceBlocked(UWorld* World, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams) const
+{
+	if (OccupancyVolume.IsValid())
+	{
+		// Only a clear ray is trusted, anything touching collision gets traced for real.
+		if (OccupancyVolume->TraceRay(Start,End) == EPVGRayResult::Clear)
+		{
+			return false;
+		}
+	}
+	if (CollisionBVH.IsValid())
+	{
+		const EPVGRayResult Result = CollisionBVH->TraceRay(Start,End);
+		if (Result != EPVGRayResult::Unknown)
+		{
+			return Result == EPVGRayResult::Blocked;
+		}
+	}
+	return World->LineTraceTestByChannel(Start,End,ECollisionChannel::ECC_Visibility,QueryParams,ResponseParams);
+}
+
+void APVGBuilder::BuildOccupancyVolume(const FBox& Bounds)
+{
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
+
+	OccupancyVolume = MakeShared<FPVGOccupancyVolume>();
+	OccupancyVolume->Build(GEditor->GetEditorWorldContext().World(),Bounds,UPVGDeveloperSettings::GetOccupancyVoxelSize(),QueryParams,ResponseParams);
+}
+
+void APVGBuilder::BuildCollisionSnapshot(const FBox& Bounds)
+{
+	TSharedPtr<FPVGCollisionBVH> Snapshot = MakeShared<FPVGCollisionBVH>();
+	Snapshot->Build(GEditor->GetEditorWorldContext().World(),Bounds,TraceResponseParams);
+	CollisionBVH = Snapshot;
+}
+
+bool APVGBuilder::ShotgunTrace(int32 Source, int32 Target, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, bool bParallel) const
+{
+	UWorld* World = GEditor->GetEditorWorldContext().World();
+	
+	const FBox SourceBox = GetBuildCellBox(Source);
+	const FBox TargetBox = GetBuildCellBox(Target);
+
+	// Seeded per pair so every process (and shard) fires the exact same rays.
+	const uint32 Seed = HashCombine(GetTypeHash(UPVGDeveloperSettings::GetShotgunSeed()),GetTypeHash(FPVGPairMatrix::GetPairIndex(Source,Target)));
+	const FPVGRaySampler Sampler(SourceBox,TargetBox,Seed);
+
+	const int32 RequiredRays = FPVGRaySampler::GetRequiredRays(
+		UPVGDeveloperSettings::GetShotgunConfidence(),
+		UPVGDeveloperSettings::GetShotgunMinVisibleFraction(),
+		UPVGDeveloperSettings::GetShotgunMaxRays());
+	
+	constexpr int32 NumTasks = 24;
+	std::atomic<bool> bDidHit = false;
+
+	// Start small, most visible pairs are found in the first batch. Only pairs without any ray through escalate.
+	int32 NumFired = 0;
+	int32 BatchSize = UPVGDeveloperSettings::GetShotgunInitialRays();
+	while (NumFired < RequiredRays)
+	{
+		const int32 BatchBegin = NumFired;
+		const int32 BatchEnd = FMath::Min(NumFired + BatchSize,RequiredRays);
+		const int32 NumRaysPerTask = FMath::DivideAndRoundUp(BatchEnd - BatchBegin,NumTasks);
+		
+		ParallelFor(NumTasks,[&](int32 Task )
+		{
+			const int32 Begin = BatchBegin + Task * NumRaysPerTask;
+			const int32 End = FMath::Min(Begin + NumRaysPerTask,BatchEnd);
+			
+			// Rays go through the occupancy volume 8 at a time, only the ones it can't answer reach the collision snapshot and
+			// then the physics scene.
+			constexpr int32 PacketSize = 8;
+			for (int32 iray = Begin; iray < End && !bDidHit; iray += PacketSize)
+			{
+				const int32 NumRays = FMath::Min(PacketSize,End - iray);
+				FVector Starts[PacketSize];
+				FVector Ends[PacketSize];
+				EPVGRayResult Results[PacketSize];
+
+				for (int32 i = 0; i < PacketSize; i++)
+				{
+					Sampler.GetRay(iray + FMath::Min(i,NumRays - 1),Starts[i],Ends[i]);
+					Results[i] = EPVGRayResult::Unknown;
+				}
+				
+				if (OccupancyVolume.IsValid())
+				{
+					OccupancyVolume->TraceRays8(Starts,Ends,Results);
+				}
+
+				for (int32 i = 0; i < NumRays; i++)
+				{
+					if (Results[i] == EPVGRayResult::Clear)
+					{
+						bDidHit = true;
+						break;
+					}
+				}
+
+				for (int32 i = 0; i < NumRays && !bDidHit; i++)
+				{
+					// Same order as IsTraceBlocked, the collision snapshot before the physics scene.
+					if (Results[i] == EPVGRayResult::Unknown && CollisionBVH.IsValid())
+					{
+						Results[i] = CollisionBVH->TraceRay(Starts[i],Ends[i]);
+					}
+					
+					// We are checking here if one of the rays does hit the target, since it shouldn't hit!
+					if (Results[i] == EPVGRayResult::Clear ||
+						(Results[i] == EPVGRayResult::Unknown && !World->LineTraceTestByChannel(Starts[i],Ends[i],ECollisionChannel::ECC_Visibility,QueryParams,ResponseParams)))
+					{
+						bDidHit = true;
+					}
+				}
+			}
+		},bParallel ? EParallelForFlags::None : EParallelForFlags::ForceSingleThread);
+
+		// Rays of the last batch are counted in full, tasks stop early once one of them got through.
+		BuildStats->AddRays(BatchEnd - BatchBegin);
+		if (bDidHit)
+		{
+			return true;
+		}
+		
+		NumFired = BatchEnd;
+		BatchSize *= 4;
+	}
+
+	return false;
+}
+
+void APVGBuilder::StartPairPool()
+{
+	const FPVGPairMatrix& PairMatrix = APVGManager::GetManager()->GridDataAsset->PairMatrix;
+	
+	PairsPerJob = UPVGDeveloperSettings::GetPairsPerJob();
+	NumPairJobs = FMath::DivideAndRoundUp<int64>(PairMatrix.GetNumPairs(), PairsPerJob);
+
+	// Shards take every NumShards-th job, so each shard gets an even mix of near and far pairs.
+	if (BuildOptions.IsSharded())
+	{
+		NumPairJobs = NumPairJobs > BuildOptions.ShardIndex ? FMath::DivideAndRoundUp<int64>(NumPairJobs - BuildOptions.ShardIndex, BuildOptions.NumShards) : 0;
+	}
+	NextPairJob = 0;
+	NumPairJobsDone = 0;
+	bCancelPairPool = false;
+
+	// Foliage list is gathered once, the pool runs without game thread involvement.
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
+	
+	PairPoolTask = UE::Tasks::Launch(UE_SOURCE_LOCATION,[this, QueryParams, ResponseParams]()
+	{
+		// One long running worker per core, each keeps claiming jobs so no core idles waiting on a slow cell.
+		const int32 NumWorkers = FMath::Max(1,FTaskGraphInterface::Get().GetNumWorkerThreads());
+		ParallelFor(NumWorkers,[&](int32 Worker)
+		{
+			int64 Job;
+			while (!bCancelPairPool && (Job = NextPairJob++) < NumPairJobs)
+			{
+				ResolvePairJob(BuildOptions.IsSharded() ? Job * BuildOptions.NumShards + BuildOptions.ShardIndex : Job,QueryParams,ResponseParams);
+				++NumPairJobsDone;
+			}
+		});
+	});
+	
+	LastProgressLogTime = FPlatformTime::Seconds();
+}
+
+void APVGBuilder::ResolvePairJob(int64 Job, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams)
+{
+	UPVGPrecomputedGridDataAsset* GridDataAsset = APVGManager::GetManager()->GridDataAsset;
+	const FPVGPairMatrix& PairMatrix = GridDataAsset->PairMatrix;
+	UWorld* World = GEditor->GetEditorWorldContext().World();
+
+	const int64 Begin = Job * PairsPerJob;
+	const int64 End = FMath::Min(Begin + PairsPerJob, PairMatrix.GetNumPairs());
+
+	int32 A, B;
+	FPVGPairMatrix::GetPairFromIndex(Begin,A,B);
+
+	int64 NumKnown = 0;
+	for (int64 Pair = Begin; Pair < End; Pair++)
+	{
+		if (!PairMatrix.IsResolved(A,B) && IsPairNeeded(A,B))
+		{
+			ResolvePair(A,B,World,QueryParams,ResponseParams);
+		}
+		else
+		{
+			NumKnown++;
+		}
+
+		// Step to the next pair.
+		if (++A == B)
+		{
+			A = 0;
+			B++;
+		}
+	}
+	BuildStats->AddResolved(EPVGBuildStage::Known,NumKnown);
+}
+
+void APVGBuilder::ResolvePair(int32 A, int32 B, UWorld* World, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams)
+{
+	TRACE_CPUPROFILER_EVENT_SCOPE(PVG_ResolvePair);
+	
+	// Each stage either settles the pair or hands it to the next one.
+	EPVGBuildStage Stage = EPVGBuildStage::DirectTrace;
+	bool bVisible;
+	{
+		FPVGStageTimer Timer(*BuildStats,EPVGBuildStage::DirectTrace);
+		bVisible = !IsTraceBlocked(World,LocationsToBuild[A],LocationsToBuild[B],QueryParams,ResponseParams);
+		BuildStats->AddRays(1);
+	}
+	if (!bVisible)
+	{
+		FPVGStageTimer Timer(*BuildStats,EPVGBuildStage::CornerTrace);
+		Stage = EPVGBuildStage::CornerTrace;
+		bVisible = BoxCornerTraceCheck(GetBuildCellBox(A),GetBuildCellBox(B));
+	}
+	
+	// Solid cells hide the pair on their own, no need for the shotgun. The camera can be anywhere in the source cell, so the
+	// target has to be hidden from every corner of it, not just from its center.
+	if (!bVisible && SolidOccluders.Num() > 0)
+	{
+		FPVGStageTimer Timer(*BuildStats,EPVGBuildStage::SolidOccluders);
+		FVector SourceCorners[8];
+		GetBuildCellBox(A).GetVertices(SourceCorners);
+		
+		const FBox TargetBox = GetBuildCellBox(B);
+		bool bHidden = true;
+		for (int32 i = 0; i < 8 && bHidden; i++)
+		{
+			bHidden = BoxOcclusion(SourceCorners[i],TargetBox,SolidOccluders,false);
+		}
+		if (bHidden)
+		{
+			Stage = EPVGBuildStage::SolidOccluders;
+		}
+	}
+	if (!bVisible && Stage != EPVGBuildStage::SolidOccluders)
+	{
+		FPVGStageTimer Timer(*BuildStats,EPVGBuildStage::Shotgun);
+		Stage = EPVGBuildStage::Shotgun;
+		bVisible = ShotgunTrace(A,B,QueryParams,ResponseParams,false);
+	}
+
+	BuildStats->AddResolved(Stage);
+	APVGManager::GetManager()->GridDataAsset->SetDataCell(A,B,bVisible);
+}
+
+void APVGBuilder::SetupStreamedBuild()
+{
+	const FVector CellSize = APVGManager::GetManager()->CellSize.GetSize();
+	const FVector GridOrigin = GridLocations[0] - CellSize * 0.5f;
+
+	TArray<TPair<uint64,int32>> Order;
+	Order.Reserve(LocationsToBuild.Num());
+	for (int32 Cell = 0; Cell < LocationsToBuild.Num(); Cell++)
+	{
+		if (IsReachable(Cell))
+		{
+			const FVector Local = (LocationsToBuild[Cell] - GridOrigin) / CellSize;
+			Order.Emplace(CellToMortonCode(FIntVector(FMath::FloorToInt(Local.X),FMath::FloorToInt(Local.Y),FMath::FloorToInt(Local.Z))),Cell);
+		}
+	}
+	Order.Sort([](const TPair<uint64,int32>& A, const TPair<uint64,int32>& B) { return A.Key < B.Key; });
+
+	StreamedSources.Reset(Order.Num());
+	for (const TPair<uint64,int32>& Entry : Order)
+	{
+		StreamedSources.Add(Entry.Value);
+	}
+	NextStreamedSource = 0;
+
+	UE_LOG(LogTemp,Warning,TEXT("Streamed build of %d source cells in batches of %d, loading %.0f around each batch."),
+		StreamedSources.Num(),UPVGDeveloperSettings::GetStreamingBatchSize(),UPVGDeveloperSettings::GetStreamingViewDistance());
+}
+
+void APVGBuilder::ResolveStreamedBatch()
+{
+	const double StartTime = FPlatformTime::Seconds();
+	
+	UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	const FPVGPairMatrix& PairMatrix = Asset->PairMatrix;
+	const float ViewDistance = UPVGDeveloperSettings::GetStreamingViewDistance();
+	const int32 BatchSize = UPVGDeveloperSettings::GetStreamingBatchSize();
+
+	// Consecutive cells on the curve stay close together, so the batch bounds stay compact. Done cells are skipped, e.g. after a resume.
+	TArray<int32> Batch;
+	TArray<int32> Targets;
+	FBox BatchBounds(ForceInit);
+	while (Batch.Num() < BatchSize && NextStreamedSource < StreamedSources.Num())
+	{
+		const int32 Source = StreamedSources[NextStreamedSource++];
+		GetStreamedTargets(Source,ViewDistance,Targets);
+		if (Targets.ContainsByPredicate([&](int32 Target) { return !PairMatrix.IsResolved(Source,Target); }))
+		{
+			Batch.Add(Source);
+			BatchBounds += GetBuildCellBox(Source);
+		}
+	}
+
+	if (Batch.Num() == 0)
+	{
+		return;
+	}
+
+	// Load the new region before releasing the previous one, so actors both regions share stay loaded.
+	UWorld* World = GEditor->GetEditorWorldContext().World();
+	const FBox LoadBounds = BatchBounds.ExpandBy(ViewDistance);
+	TSharedPtr<FLoaderAdapterShape> Loader = MakeShared<FLoaderAdapterShape>(World,LoadBounds,TEXT("PVG Streamed Batch"));
+	Loader->Load();
+	const bool bReleasesRegion = StreamedLoader.IsValid();
+	StreamedLoader = Loader;
+	World->FlushLevelStreaming();
+	RefreshTraceParams();
+
+	// Actors only the previous region needed are unloaded now, their objects stay around until the next collection.
+	// Collecting can't happen in the middle of the world tick, so it is requested for right after it.
+	if (bReleasesRegion)
+	{
+		bWantsGarbageCollection = true;
+		GEngine->ForceGarbageCollection(true);
+	}
+	const double LoadTime = FPlatformTime::Seconds() - StartTime;
+
+	if (UPVGDeveloperSettings::UseOccupancyVolume())
+	{
+		BuildOccupancyVolume(LoadBounds);
+	}
+	if (UPVGDeveloperSettings::UseCollisionSnapshot())
+	{
+		BuildCollisionSnapshot(LoadBounds);
+	}
+
+	// Only pairs within the view distance of the batch are stored, everything farther is left for distance culling to handle.
+	TSet<int32> BatchSet(Batch);
+	TArray<TPair<int32,int32>> Pairs;
+	int64 NumFar = 0;
+	for (const int32 Source : Batch)
+	{
+		GetStreamedTargets(Source,ViewDistance,Targets);
+		int32 NumNearAbove = 0;
+		for (const int32 Target : Targets)
+		{
+			NumNearAbove += Target > Source ? 1 : 0;
+			
+			// Pairs inside the batch only once.
+			if (PairMatrix.IsResolved(Source,Target) || (Target < Source && BatchSet.Contains(Target)))
+			{
+				continue;
+			}
+			Pairs.Emplace(Source,Target);
+		}
+
+		// Every source is batched once, counting the far targets above it counts each far pair once.
+		NumFar += LocationsToBuild.Num() - 1 - Source - NumNearAbove;
+	}
+	BuildStats->AddResolved(EPVGBuildStage::Distance,NumFar);
+
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
+
+	ParallelFor(Pairs.Num(),[&](int32 i)
+	{
+		ResolvePair(Pairs[i].Key,Pairs[i].Value,World,QueryParams,ResponseParams);
+	},EParallelForFlags::Unbalanced);
+	BuildStats->EndStep(NextStreamedSource);
+
+	UE_LOG(LogTemp,Warning,TEXT("Streamed batch %d / %d: %d sources, %d pairs traced, %lld beyond view distance. Loaded in %.2f sec, resolved in %.2f sec, pair state %.1f MB."),
+		NextStreamedSource,StreamedSources.Num(),Batch.Num(),Pairs.Num(),NumFar,LoadTime,FPlatformTime::Seconds() - StartTime - LoadTime,
+		PairMatrix.GetAllocatedSize() / (1024.f * 1024.f));
+}
+
+void APVGBuilder::GetStreamedTargets(int32 Source, float ViewDistance, TArray<int32>& OutTargets) const
+{
+	// Streamed builds always use the plain grid, build cells are grid cells.
+	const UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	const FIntVector GridSize(Asset->GetGridSizeX(),Asset->GetGridSizeY(),Asset->GetGridSizeZ());
+	const FVector CellSize = Asset->GetCellBox().GetSize();
+	const FVector GridOrigin = GridLocations[0] - Asset->GetCellExtents();
+	
+	const FBox SourceBox = GetBuildCellBox(Source);
+	const FBox Range = SourceBox.ExpandBy(ViewDistance);
+	FIntVector Min, Max;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		Min[Axis] = FMath::Max(0,FMath::FloorToInt((Range.Min[Axis] - GridOrigin[Axis]) / CellSize[Axis]));
+		Max[Axis] = FMath::Min(GridSize[Axis] - 1,FMath::FloorToInt((Range.Max[Axis] - GridOrigin[Axis]) / CellSize[Axis]));
+	}
+
+	OutTargets.Reset();
+	for (int32 z = Min.Z; z <= Max.Z; z++)
+	{
+		for (int32 y = Min.Y; y <= Max.Y; y++)
+		{
+			for (int32 x = Min.X; x <= Max.X; x++)
+			{
+				const int32 Target = XYZToIndex(x,y,z,GridSize.X,GridSize.Y);
+				if (Target != Source && SourceBox.ComputeSquaredDistanceToBox(GetBuildCellBox(Target)) <= FMath::Square(ViewDistance))
+				{
+					OutTargets.Add(Target);
+				}
+			}
+		}
+	}
+}
+
+void APVGBuilder::FinishBuild()
+{
+	// We are done.
+	SetActorTickEnabled(false);
+
+	// Whatever happened since the last step, e.g. the tail of the pair pool.
+	BuildStats->EndStep(CurrentCell);
+	BuildStats->LogSummary();
+	BuildStats->WriteReport(APVGManager::GetManager()->GridDataAsset->GetName() + (BuildOptions.IsSharded() ? FString::Printf(TEXT("_%dof%d"),BuildOptions.ShardIndex,BuildOptions.NumShards) : FString()),
+		StaticEnum<EPVGBuildMode>()->GetNameStringByValue((int64)BuildMode));
+
+	if (BuildOptions.IsSharded())
+	{
+		if (WriteShardResult())
+		{
+			IFileManager::Get().Delete(*GetCheckpointFilename(),false,false,true);
+		}
+		return;
+	}
+
+	// Save package.
+	UPackage* Package = APVGManager::GetManager()->GridDataAsset->GetPackage();
+	const FString PackageName = Package->GetName();
+	const FString PackageFileName = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+
+	FSavePackageArgs SaveArgs;
+	
+	// This is specified just for example
+	{
+		SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+		SaveArgs.SaveFlags = SAVE_NoError;
+	}
+	
+	const bool bSucceeded = UPackage::SavePackage(Package, nullptr, *PackageFileName, SaveArgs);
+
+	if (!bSucceeded)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Package '%s' wasn't saved!"), *PackageName)
+	}
+	else
+	{
+		// Keep the checkpoint around if saving failed.
+		IFileManager::Get().Delete(*GetCheckpointFilename(),false,false,true);
+	}
+
+	UE_LOG(LogTemp, Warning, TEXT("Package '%s' was successfully saved"), *PackageName)
+	UE_LOG(LogTemp,Warning,TEXT("Finished grid in %.2f hours (%.2f min)"),((FPlatformTime::Seconds() - BeginTime) / 60)/60, (FPlatformTime::Seconds() - BeginTime) / 60);
+}
+
+void APVGBuilder::GetBuildFileHeader(FPVGBuildFileHeader& OutHeader) const
+{
+	const UPVGPrecomputedGridDataAsset* GridDataAsset = APVGManager::GetManager()->GridDataAsset;
+	
+	OutHeader.GridSignature = GridDataAsset->GetGridSignature();
+	OutHeader.GridSize = FIntVector(GridDataAsset->GetGridSizeX(),GridDataAsset->GetGridSizeY(),GridDataAsset->GetGridSizeZ());
+	OutHeader.CellExtents = GridDataAsset->GetCellExtents();
+	OutHeader.GridBounds = GridDataAsset->GetGridBounds();
+	OutHeader.AssetPath = GridDataAsset->GetPathName();
+	OutHeader.WorldPackage = GetWorld()->GetOutermost()->GetName();
+	OutHeader.ShardIndex = BuildOptions.ShardIndex;
+	OutHeader.NumShards = BuildOptions.NumShards;
+	OutHeader.CurrentCell = CurrentCell;
+}
+
+FString APVGBuilder::GetCheckpointFilename() const
+{
+	return FPVGBuildFile::GetCheckpointFilename(APVGManager::GetManager()->GridDataAsset->GetName(),BuildOptions.ShardIndex,BuildOptions.NumShards);
+}
+
+void APVGBuilder::WriteCheckpoint()
+{
+	const double Start = FPlatformTime::Seconds();
+	
+	FPVGBuildFileHeader Header;
+	GetBuildFileHeader(Header);
+
+	// The pool keeps running while we write, every pair is a single atomic bit so the snapshot stays consistent.
+	if (FPVGBuildFile::Write(GetCheckpointFilename(),Header,APVGManager::GetManager()->GridDataAsset->PairMatrix))
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Checkpoint at cell %d written in %.2f sec."),CurrentCell,FPlatformTime::Seconds() - Start);
+	}
+
+	LastCheckpointTime = FPlatformTime::Seconds();
+}
+
+bool APVGBuilder::ReadCheckpoint()
+{
+	const FString Filename = GetCheckpointFilename();
+	if (!IFileManager::Get().FileExists(*Filename))
+	{
+		return false;
+	}
+	
+	FPVGBuildFileHeader Expected;
+	GetBuildFileHeader(Expected);
+
+	FPVGBuildFileHeader Header;
+	FPVGPairMatrix PairMatrix;
+	if (!FPVGBuildFile::Read(Filename,Header,PairMatrix))
+	{
+		return false;
+	}
+	
+	if (Header.GridSignature != Expected.GridSignature || PairMatrix.GetNumCells() != LocationsToBuild.Num())
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Checkpoint '%s' belongs to a different grid."),*Filename);
+		return false;
+	}
+
+	APVGManager::GetManager()->GridDataAsset->PairMatrix = MoveTemp(PairMatrix);
+	CurrentCell = Header.CurrentCell;
+	
+	UE_LOG(LogTemp,Warning,TEXT("Resuming from checkpoint '%s' at cell %d."),*Filename,CurrentCell);
+	return true;
+}
+
+void APVGBuilder::ComputeCellGeometryHashes(TArray<uint32>& OutHashes) const
+{
+	const UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	const int32 MaxX = Asset->GetGridSizeX();
+	const int32 MaxY = Asset->GetGridSizeY();
+	const int32 MaxZ = Asset->GetGridSizeZ();
+	const FVector CellSize = Asset->GetCellBox().GetSize();
+	const FVector GridOrigin = GridLocations[0] - Asset->GetCellExtents();
+
+	OutHashes.Init(0,GridLocations.Num());
+
+	// Cell in the upper, primitive hash in the lower half. Sorted before combining, actors don't iterate in a fixed order.
+	TArray<uint64> CellEntries;
+
+	auto HashTransform = [](const FTransform& Transform)
+	{
+		uint32 Hash = GetTypeHash(Transform.GetLocation());
+		Hash = HashCombine(Hash,GetTypeHash(Transform.GetRotation().Euler()));
+		return HashCombine(Hash,GetTypeHash(Transform.GetScale3D()));
+	};
+	
+	auto AddToCells = [&](const FBox& Bounds, uint32 Hash)
+	{
+		// Slightly grown, geometry touching a cell face can still block traces through it.
+		const FVector LocalMin = (Bounds.Min - GridOrigin) / CellSize - FVector(0.01);
+		const FVector LocalMax = (Bounds.Max - GridOrigin) / CellSize + FVector(0.01);
+		
+		const int32 MinX = FMath::Max(0,FMath::FloorToInt(LocalMin.X));
+		const int32 MinY = FMath::Max(0,FMath::FloorToInt(LocalMin.Y));
+		const int32 MinZ = FMath::Max(0,FMath::FloorToInt(LocalMin.Z));
+		const int32 EndX = FMath::Min(MaxX - 1,FMath::FloorToInt(LocalMax.X));
+		const int32 EndY = FMath::Min(MaxY - 1,FMath::FloorToInt(LocalMax.Y));
+		const int32 EndZ = FMath::Min(MaxZ - 1,FMath::FloorToInt(LocalMax.Z));
+		
+		for (int32 z = MinZ; z <= EndZ; z++)
+		{
+			for (int32 y = MinY; y <= EndY; y++)
+			{
+				for (int32 x = MinX; x <= EndX; x++)
+				{
+					CellEntries.Add(uint64(XYZToIndex(x,y,z,MaxX,MaxY)) << 32 | Hash);
+				}
+			}
+		}
+	};
+
+	for (TActorIterator<AActor> It(GetWorld()); It; ++It)
+	{
+		const AActor* Actor = *It;
+		if (!Actor || Actor->IsA<AInstancedFoliageActor>() || Actor->IsA<APVGBuilder>() || Actor->IsA<APVGManager>())
+		{
+			continue;
+		}
+
+		for (const UPrimitiveComponent* Component : TInlineComponentArray<UPrimitiveComponent*>(Actor))
+		{
+			// Same filter as the builder traces.
+			const ECollisionChannel ObjectType = Component->GetCollisionObjectType();
+			if (!Component->IsRegistered() || !Component->IsQueryCollisionEnabled() ||
+				ObjectType == ECC_WorldDynamic || ObjectType == ECC_Destructible ||
+				Component->GetCollisionResponseToChannel(ECC_Visibility) != ECR_Block)
+			{
+				continue;
+			}
+
+			uint32 ComponentHash = GetTypeHash(Component->GetPathName());
+			if (const UStaticMeshComponent* MeshComponent = Cast<UStaticMeshComponent>(Component))
+			{
+				ComponentHash = HashCombine(ComponentHash,GetTypeHash(GetPathNameSafe(MeshComponent->GetStaticMesh())));
+			}
+
+			// Per instance, so moving one instance doesn't dirty the whole component.
+			if (const UInstancedStaticMeshComponent* InstancedComponent = Cast<UInstancedStaticMeshComponent>(Component))
+			{
+				if (InstancedComponent->GetStaticMesh())
+				{
+					const FBox MeshBounds = InstancedComponent->GetStaticMesh()->GetBounds().GetBox();
+					for (int32 Instance = 0; Instance < InstancedComponent->GetInstanceCount(); Instance++)
+					{
+						FTransform InstanceTransform;
+						InstancedComponent->GetInstanceTransform(Instance,InstanceTransform,true);
+						AddToCells(MeshBounds.TransformBy(InstanceTransform),HashCombine(ComponentHash,HashTransform(InstanceTransform)));
+					}
+				}
+				continue;
+			}
+
+			const FBox Bounds = Component->Bounds.GetBox();
+			uint32 Hash = HashCombine(ComponentHash,HashTransform(Component->GetComponentTransform()));
+			Hash = HashCombine(Hash,HashCombine(GetTypeHash(Bounds.Min),GetTypeHash(Bounds.Max)));
+			AddToCells(Bounds,Hash);
+		}
+	}
+
+	CellEntries.Sort();
+	for (const uint64 Entry : CellEntries)
+	{
+		uint32& Hash = OutHashes[int32(Entry >> 32)];
+		Hash = HashCombine(Hash,uint32(Entry));
+	}
+
+	// Leaves combine the hashes of their grid cells, in grid cell order so the result is deterministic.
+	if (Asset->GetNumBuildCells() != OutHashes.Num())
+	{
+		TArray<uint32> BuildCellHashes;
+		BuildCellHashes.Init(0,Asset->GetNumBuildCells());
+		for (int32 Cell = 0; Cell < OutHashes.Num(); Cell++)
+		{
+			uint32& Hash = BuildCellHashes[Asset->GetBuildCellIndex(Cell)];
+			Hash = HashCombine(Hash,OutHashes[Cell]);
+		}
+		OutHashes = MoveTemp(BuildCellHashes);
+	}
+}
+
+bool APVGBuilder::PrepareIncrementalBuild(uint32 PreviousSignature, const TArray<uint32>& PreviousHashes, const TArray<uint32>& CellHashes)
+{
+	UPVGPrecomputedGridDataAsset* Asset = APVGManager::GetManager()->GridDataAsset;
+	FPVGPairMatrix& PairMatrix = Asset->PairMatrix;
+	const int32 NumCells = LocationsToBuild.Num();
+
+	// The packed data survives the grid reset, it only gets replaced on save.
+	if (PreviousSignature != Asset->GetGridSignature() || PreviousHashes.Num() != NumCells)
+	{
+		return false;
+	}
+
+	// Streamed sectors get decoded back first, the seeding below reads the packed data from many threads.
+	Asset->LoadAllSectors();
+	if (Asset->GetNumSavedBuildCells() != NumCells)
+	{
+		return false;
+	}
+
+	// Seed with the previous result, everything that wasn't occluded was visible.
+	PairMatrix.SetAllVisible();
+	ParallelFor(NumCells,[&](int32 Cell)
+	{
+		for (const int32 OtherCell : Asset->GetBuildCellData(Cell))
+		{
+			const int32 Other = Asset->GetBuildCellIndex(OtherCell);
+			if (Other != Cell)
+			{
+				PairMatrix.Unresolve(Cell,Other);
+				PairMatrix.SetOccluded(Cell,Other);
+			}
+		}
+	});
+
+	// Gather changed cells.
+	TArray<FBox> DirtyBoxes;
+	for (int32 Cell = 0; Cell < NumCells; Cell++)
+	{
+		if (PreviousHashes[Cell] != CellHashes[Cell])
+		{
+			DirtyBoxes.Add(GetBuildCellBox(Cell));
+		}
+	}
+
+	// Grid space lookup of the build cells, a leaf covers all grid cells inside of it.
+	const FIntVector GridSize(Asset->GetGridSizeX(),Asset->GetGridSizeY(),Asset->GetGridSizeZ());
+	const FVector CellSize = Asset->GetCellBox().GetSize();
+	const FVector GridOrigin = GridLocations[0] - Asset->GetCellExtents();
+	const FBox GridBox(GridOrigin,GridOrigin + FVector(GridSize) * CellSize);
+	
+	FVector MaxExtent = FVector::ZeroVector;
+	for (int32 Cell = 0; Cell < NumCells; Cell++)
+	{
+		MaxExtent = MaxExtent.ComponentMax(GetBuildCellBox(Cell).GetExtent());
+	}
+
+	// Everything a segment starting at Location can reach after crossing Box, bounded by the grid.
+	auto GetShadowBox = [&](const FVector& Location, const FBox& Box)
+	{
+		if (Box.IsInside(Location))
+		{
+			return GridBox;
+		}
+
+		// Project the corners onto the grid face behind the box along the axis with the largest gap, every segment
+		// through the box crosses that face once it leaves the grid.
+		int32 Axis = 0;
+		double MaxGap = -UE_DOUBLE_BIG_NUMBER;
+		for (int32 i = 0; i < 3; i++)
+		{
+			const double Gap = FMath::Max(Box.Min[i] - Location[i],Location[i] - Box.Max[i]);
+			if (Gap > MaxGap)
+			{
+				MaxGap = Gap;
+				Axis = i;
+			}
+		}
+
+		// On the boundary the corners of that face are level with Location and don't project, grow to the whole grid.
+		if (MaxGap < KINDA_SMALL_NUMBER)
+		{
+			return GridBox;
+		}
+		const double Plane = Location[Axis] < Box.Min[Axis] ? GridBox.Max[Axis] : GridBox.Min[Axis];
+
+		FBox Shadow = Box;
+		for (int32 Corner = 0; Corner < 8; Corner++)
+		{
+			const FVector Point((Corner & 1) ? Box.Max.X : Box.Min.X,(Corner & 2) ? Box.Max.Y : Box.Min.Y,(Corner & 4) ? Box.Max.Z : Box.Min.Z);
+			const double Time = (Plane - Location[Axis]) / (Point[Axis] - Location[Axis]);
+			if (Time > 1.0)
+			{
+				Shadow += Location + (Point - Location) * Time;
+			}
+		}
+		return Shadow.Overlap(GridBox);
+	};
+
+	// A pair needs to be resolved again when the volume swept between both cells touches a changed cell, only the cells in
+	// the shadow of a changed cell can form such a pair.
+	std::atomic<int64> NumDirtyPairs = 0;
+	ParallelFor(NumCells,[&](int32 A)
+	{
+		const FVector& LocationA = LocationsToBuild[A];
+		const FBox BoxA = GetBuildCellBox(A);
+		TSet<int32> DirtyTargets;
+		
+		for (const FBox& DirtyBox : DirtyBoxes)
+		{
+			const FBox Shadow = GetShadowBox(LocationA,DirtyBox.ExpandBy(MaxExtent));
+			if (!Shadow.IsValid)
+			{
+				continue;
+			}
+			
+			FIntVector Min, Max;
+			for (int32 Axis = 0; Axis < 3; Axis++)
+			{
+				Min[Axis] = FMath::Max(0,FMath::FloorToInt((Shadow.Min[Axis] - GridOrigin[Axis]) / CellSize[Axis]));
+				Max[Axis] = FMath::Min(GridSize[Axis] - 1,FMath::FloorToInt((Shadow.Max[Axis] - GridOrigin[Axis]) / CellSize[Axis]));
+			}
+			for (int32 z = Min.Z; z <= Max.Z; z++)
+			{
+				for (int32 y = Min.Y; y <= Max.Y; y++)
+				{
+					for (int32 x = Min.X; x <= Max.X; x++)
+					{
+						const int32 B = Asset->GetBuildCellIndex(XYZToIndex(x,y,z,GridSize.X,GridSize.Y));
+						if (B <= A || !IsPairNeeded(A,B) || DirtyTargets.Contains(B))
+						{
+							continue;
+						}
+
+						const FVector& LocationB = LocationsToBuild[B];
+						const FBox BoxB = GetBuildCellBox(B);
+						
+						// Leaves of different size sweep the bigger one, that still covers the volume between both.
+						const FVector Extent = BoxA.GetExtent().ComponentMax(BoxB.GetExtent());
+						const FBox SweptBox = DirtyBox.ExpandBy(Extent);
+						
+						FVector Hit, Normal;
+						float Time;
+						if (SweptBox.IsInside(LocationA) || SweptBox.IsInside(LocationB) ||
+							FMath::LineExtentBoxIntersection(DirtyBox,LocationA,LocationB,Extent,Hit,Normal,Time))
+						{
+							DirtyTargets.Add(B);
+						}
+					}
+				}
+			}
+		}
+
+		for (const int32 B : DirtyTargets)
+		{
+			PairMatrix.Unresolve(A,B);
+		}
+		NumDirtyPairs += DirtyTargets.Num();
+	},EParallelForFlags::Unbalanced);
+
+	UE_LOG(LogTemp,Warning,TEXT("Incremental build: %d changed cells, %lld of %lld pairs to resolve."),DirtyBoxes.Num(),NumDirtyPairs.load(),PairMatrix.GetNumPairs());
+	return true;
+}
+
+bool APVGBuilder::WriteShardResult()
+{
+	UPVGPrecomputedGridDataAsset* GridDataAsset = APVGManager::GetManager()->GridDataAsset;
+
+	FPVGBuildFileHeader Header;
+	GetBuildFileHeader(Header);
+
+	const FString Filename = FPVGBuildFile::GetShardFilename(GridDataAsset->GetName(),BuildOptions.ShardIndex,BuildOptions.NumShards);
+	if (!FPVGBuildFile::Write(Filename,Header,GridDataAsset->PairMatrix))
+	{
+		UE_LOG(LogTemp,Error,TEXT("Failed to write shard %d/%d to '%s'"),BuildOptions.ShardIndex,BuildOptions.NumShards,*Filename);
+		return false;
+	}
+	
+	UE_LOG(LogTemp,Warning,TEXT("Shard %d/%d written to '%s' in %.2f min"),BuildOptions.ShardIndex,BuildOptions.NumShards,*Filename,(FPlatformTime::Seconds() - BeginTime) / 60);
+	return true;
+}
+
+// Called every frame
+void APVGBuilder::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+ 	if (!bIsInitialized)
+	{
+		return;
+	}
+
+	if (BuildMode == EPVGBuildMode::PairPool)
+	{
+		if (!PairPoolTask.IsValid())
+		{
+			StartPairPool();
+			return;
+		}
+		
+		if (!PairPoolTask.IsCompleted())
+		{
+			if (FPlatformTime::Seconds() - LastProgressLogTime > 10.0)
+			{
+				LastProgressLogTime = FPlatformTime::Seconds();
+				UE_LOG(LogTemp,Warning,TEXT("Pair pool: %lld / %lld jobs done."),NumPairJobsDone.load(),NumPairJobs);
+				BuildStats->EndStep((int32)NumPairJobsDone.load());
+			}
+
+			const float CheckpointInterval = UPVGDeveloperSettings::GetCheckpointInterval();
+			if (CheckpointInterval > 0 && FPlatformTime::Seconds() - LastCheckpointTime > CheckpointInterval)
+			{
+				WriteCheckpoint();
+			}
+			return;
+		}
+
+		FinishBuild();
+		return;
+	}
+
+	if (BuildMode == EPVGBuildMode::Streamed)
+	{
+		if (NextStreamedSource < StreamedSources.Num())
+		{
+			ResolveStreamedBatch();
+
+			// Batches are fully resolved in between ticks, safe point to flush.
+			const float CheckpointInterval = UPVGDeveloperSettings::GetCheckpointInterval();
+			if (CheckpointInterval > 0 && FPlatformTime::Seconds() - LastCheckpointTime > CheckpointInterval)
+			{
+				WriteCheckpoint();
+			}
+			return;
+		}
+
+		StreamedLoader.Reset();
+		FinishBuild();
+		return;
+	}
+
+	// Skip cells that have nothing left to resolve, e.g. during incremental builds. Unreachable cells are only targets,
+	// their pairs with reachable cells get resolved from the reachable side.
+	while (CurrentCell < LocationsToBuild.Num() &&
+		(!IsReachable(CurrentCell) || APVGManager::GetManager()->GridDataAsset->PairMatrix.CountUnresolved(CurrentCell) == 0))
+	{
+		CurrentCell++;
+	}
+
+	if (CurrentCell >= LocationsToBuild.Num())
+	{
+		FinishBuild();
+		return;
+	}
+
+	if (!MoveToLocation(CurrentCell))
+	{
+		// we are going to start tracing next frame.
+		bTraceCheckStage = true;
+		return;
+	}
+
+	FCollisionQueryParams QueryParams;
+	FCollisionResponseParams ResponseParams;
+	GetTraceParams(QueryParams,ResponseParams);
+
+	FWorldContext& EditorWorldContext = GEditor->GetEditorWorldContext();
+	UWorld* World = EditorWorldContext.World();
 	
 	if (bTraceCheckStage)
 	{
-		// DEBUG STATS:
-		double StartTime = FPlatformTime::Seconds();
-		double TimeSimpleTest = 0;
-		int32 NumOccludedBoxScene = 0;
-		double TimeOccludedBoxScene = 0;
-		int32 ShotgunTest = 0;
-		double TimeShotgunTest = 0;
 		bool bIsBoxSceneDirty = true;
 		
-		
-		TArray<FRawRegionVisibilityData16>& GridData = APVGManager::GetManager()->GridDataAsset->GridData;
 		UPVGPrecomputedGridDataAsset* GridDataAsset = APVGManager::GetManager()->GridDataAsset;
+		const FPVGPairMatrix& PairMatrix = GridDataAsset->PairMatrix;
 		const int32 MaxX = GridDataAsset->GetGridSizeX();
 		const int32 MaxY = GridDataAsset->GetGridSizeY();
 		const int32 MaxZ = GridDataAsset->GetGridSizeZ();
 		
 		const FIntVector Origin = IndexTo3D(CurrentCell,MaxX,MaxY);
 
-		TSet<uint16> HandledPoints;
+		TSet<int32> HandledPoints;
+
+		// Unresolved targets of the rings so far. They go through the box scene and the shotgun as one flat job list and
+		// get committed in a single pass afterwards, instead of paying two fan outs per pair.
+		TArray<int32> PendingTargets;
+
+		// Known hidden cells of the rings in the batch. The box scene has no depth test, a blocker behind a target would
+		// hide it, so they only join it once the batch is resolved and every later target is farther out.
+		TArray<int32> PendingBlockers;
+		const int32 ShellBatchPairs = UPVGDeveloperSettings::GetShellBatchPairs();
+		
+		auto ResolvePendingTargets = [&]()
+		{
+			const FVector CameraLocation = LocationsToBuild[CurrentCell];
+			TArray<bool> BoxOccluded;
+			BoxOccluded.SetNumZeroed(PendingTargets.Num());
+#if BOX_SCENE
+			{	// Box test
+				TRACE_CPUPROFILER_EVENT_SCOPE(PVG_ShellBoxScene);
+				double Start = FPlatformTime::Seconds();
+
+				if (bIsBoxSceneDirty)
+				{
+					UpdateBoxScene();
+					bIsBoxSceneDirty = false;
+				}
+
+				// Cheap and similar in cost, workers claim a few targets at a time.
+				ParallelFor(TEXT("PVG.ShellBoxScene"),PendingTargets.Num(),8,[&](int32 i)
+				{
+					BoxOccluded[i] = BoxOcclusion(CameraLocation,GetBuildCellBox(PendingTargets[i]),BoxScene,false);
+				});
+				BuildStats->AddTime(EPVGBuildStage::BoxScene,FPlatformTime::Seconds() - Start);
+			}
+#endif
+			TArray<int32> ShotgunTargets;
+			for (int32 i = 0; i < PendingTargets.Num(); i++)
+			{
+				if (BoxOccluded[i])
+				{
+					BuildStats->AddResolved(EPVGBuildStage::BoxScene);
+					GridDataAsset->SetDataCell(CurrentCell,PendingTargets[i],false);
+				}
+				else
+				{
+					ShotgunTargets.Add(PendingTargets[i]);
+				}
+			}
+
+			// Shotgun
+			{
+				TRACE_CPUPROFILER_EVENT_SCOPE(PVG_ShellShotgun);
+				double Start = FPlatformTime::Seconds();
+
+				// Hidden pairs fire many times the rays of visible ones, single targets per claim keep the load balanced.
+				TArray<bool> Visible;
+				Visible.SetNumZeroed(ShotgunTargets.Num());
+				ParallelFor(TEXT("PVG.ShellShotgun"),ShotgunTargets.Num(),1,[&](int32 i)
+				{
+					Visible[i] = ShotgunTrace(CurrentCell,ShotgunTargets[i],QueryParams,ResponseParams,false);
+				},EParallelForFlags::Unbalanced);
+
+				for (int32 i = 0; i < ShotgunTargets.Num(); i++)
+				{
+					GridDataAsset->SetDataCell(CurrentCell,ShotgunTargets[i],Visible[i]);
+					if (!Visible[i])
+					{
+						ViewBlockers.Add(ShotgunTargets[i]);
+						bIsBoxSceneDirty = true;
+					}
+				}
+				BuildStats->AddResolved(EPVGBuildStage::Shotgun,ShotgunTargets.Num());
+				BuildStats->AddTime(EPVGBuildStage::Shotgun,FPlatformTime::Seconds() - Start);
+			}
+
+			PendingTargets.Reset();
+		};
 
 		int32 Iteration = 1;
 		while (true)
 		{
 			bool bShouldBreak = false;
 			
-			TSet<uint16> PointsToProcess;
+			TSet<int32> PointsToProcess;
 			
 			// Calculate corner points.
 			FIntVector MinLocation = Origin - FIntVector(Iteration,Iteration,Iteration);
@@ -583,16 +1799,35 @@ void APVGBuilder::Tick(float DeltaTime)
 				}
 			}
 		
+#if BOX_SCENE
+			// Whole blocks hidden behind the inner rings are resolved before any of their cells get traced.
+			const int32 SuperCellSize = UPVGDeveloperSettings::GetSuperCellSize();
+			if (SuperCellSize > 1 && (ViewBlockers.Num() > 0 || SolidOccluders.Num() > 0))
+			{
+				double Start = FPlatformTime::Seconds();
+				
+				if (bIsBoxSceneDirty)
+				{
+					UpdateBoxScene();
+					bIsBoxSceneDirty = false;
+				}
+				TRACE_CPUPROFILER_EVENT_SCOPE(PVG_ShellSuperCells);
+				const int32 NumResolved = ResolveSuperCells(Iteration,SuperCellSize);
+				BuildStats->AddResolved(EPVGBuildStage::SuperCells,NumResolved);
+				BuildStats->AddTime(EPVGBuildStage::SuperCells,FPlatformTime::Seconds() - Start);
+			}
+#endif
+			
 			Iteration++;
 
 			constexpr int32 NumTasks = 24;
 			int32 NumPerTask = FMath::DivideAndRoundUp( PointsToProcess.Num(), NumTasks);
 			auto PointsToProcessArray = PointsToProcess.Array();
-			TArray<uint16> ViewBlockerArr[NumTasks];
-			TArray<uint16> CanSee[NumTasks];
-			TArray<uint16> Unresolved[NumTasks];
+			TArray<int32> ViewBlockerArr[NumTasks];
+			TArray<int32> Unresolved[NumTasks];
 
 			{
+				TRACE_CPUPROFILER_EVENT_SCOPE(PVG_ShellSimpleTests);
 				double Start = FPlatformTime::Seconds();
 				
 				ParallelFor(NumTasks,[&](int32 TaskID)
@@ -608,27 +1843,30 @@ void APVGBuilder::Tick(float DeltaTime)
 							continue;
 						}
 					
-						const bool bIsKnownVisible =	GridData[Point].VisibleRegions.Contains(CurrentCell);
-						const bool bIsKnownInvisible =	GridData[Point].InvisibleRegions.Contains(CurrentCell);
-						if (bIsKnownVisible)
+						if (PairMatrix.IsVisible(Point,CurrentCell))
 						{
+							BuildStats->AddResolved(EPVGBuildStage::Known);
 							continue;
 						}
-						if (bIsKnownInvisible)
+						if (PairMatrix.IsOccluded(Point,CurrentCell))
 						{
+							BuildStats->AddResolved(EPVGBuildStage::Known);
 							ViewBlockerArr[TaskID].Add(Point);
 							continue;
 						}
-						const bool CanNotReachPoint = !World->LineTraceTestByChannel(LocationsToBuild[Point],LocationsToBuild[CurrentCell],ECollisionChannel::ECC_Visibility,QueryParams,ResponseParams);
+						const bool CanNotReachPoint = !IsTraceBlocked(World,LocationsToBuild[Point],LocationsToBuild[CurrentCell],QueryParams,ResponseParams);
+						BuildStats->AddRays(1);
 						if (CanNotReachPoint)
 						{
-							CanSee[TaskID].Add(Point);
+							BuildStats->AddResolved(EPVGBuildStage::DirectTrace);
+							GridDataAsset->SetDataCell(CurrentCell,Point,true);
 							continue;
 						}
 					
-						if (BoxCornerTraceCheck(LocationsToBuild[Point],LocationsToBuild[CurrentCell],APVGManager::GetManager()->CellSize))
+						if (BoxCornerTraceCheck(GetBuildCellBox(Point),GetBuildCellBox(CurrentCell)))
 						{
-							CanSee[TaskID].Add(Point);
+							BuildStats->AddResolved(EPVGBuildStage::CornerTrace);
+							GridDataAsset->SetDataCell(CurrentCell,Point,true);
 							continue;
 						}
 
@@ -637,94 +1875,27 @@ void APVGBuilder::Tick(float DeltaTime)
 					}
 				});
 				
-				TimeSimpleTest += FPlatformTime::Seconds() - Start;
+				// Direct and corner traces run interleaved here, their time is booked on the direct trace stage.
+				BuildStats->AddTime(EPVGBuildStage::DirectTrace,FPlatformTime::Seconds() - Start);
 			}
 
 			// Resolve parallel work
 			for (int32 i = 0; i < NumTasks; i++)
 			{
-				for (int32 j = 0; j < CanSee[i].Num(); j++)
-				{
-					GridDataAsset->SetDataCell(CurrentCell,CanSee[i][j],true);
-				}
+				PendingBlockers.Append(ViewBlockerArr[i]);
+				PendingTargets.Append(Unresolved[i]);
+			}
 
-				ViewBlockers.Append(ViewBlockerArr[i]);
+			// Rings with few unresolved pairs wait for the next ones, so the expensive stages always get enough work to spread.
+			if (PendingTargets.Num() >= ShellBatchPairs || bShouldBreak)
+			{
+				ResolvePendingTargets();
 			}
-			
-			// Process unprocessed points.
-			for	(int32 i = 0; i < NumTasks; i++)
+			if (PendingTargets.Num() == 0 && PendingBlockers.Num() > 0)
 			{
-				for (int32 j = 0; j < Unresolved[i].Num(); j++)
-				{
-					const auto Point = Unresolved[i][j];
-#if BOX_SCENE
-					{	// Box test
-						double Start = FPlatformTime::Seconds();
-
-						if (bIsBoxSceneDirty)
-						{
-							UpdateBoxScene();
-							bIsBoxSceneDirty = false;
-						}
-					
-						if (BoxOcclusion(CurrentCell,Point,APVGManager::GetManager()->CellSize))
-						{
-							NumOccludedBoxScene++;
-							GridDataAsset->SetDataCell(CurrentCell,Point,false);
-							
-							TimeOccludedBoxScene += FPlatformTime::Seconds() - Start;
-							continue;
-						}
-						TimeOccludedBoxScene += FPlatformTime::Seconds() - Start;
-					}
-#endif
-					// Shogun
-					{
-						ShotgunTest++;
-						double Start = FPlatformTime::Seconds();
-						FBox Current = APVGManager::GetManager()->GridDataAsset->GetCellBox().MoveTo(LocationsToBuild[CurrentCell]);
-						FBox Target = APVGManager::GetManager()->GridDataAsset->GetCellBox().MoveTo(LocationsToBuild[Point]);
-
-						const int32 NumRays = 5000;
-						const int32 NumRaysPerTask = FMath::DivideAndRoundUp(NumRays,NumTasks);
-						std::atomic<bool> bDidHit = false;
-
-						ParallelFor(NumTasks,[&](int32 Task )
-						{
-							for (int32 iray = 0; iray < NumRaysPerTask; iray++)
-							{
-								const FVector A = FMath::RandPointInBox(Current);
-								const FVector B = FMath::RandPointInBox(Target);
-
-								// We are checking here if one of the rays does hit the target, since it shouldn't hit!
-								const bool WasBlocked = World->LineTraceTestByChannel(A,B,ECollisionChannel::ECC_Visibility,QueryParams,ResponseParams);
-								if (!WasBlocked)
-								{
-									bDidHit = true;
-									break;
-								}
-
-								// Failed case.
-								if (bDidHit)
-								{
-									break;
-								}
-							}
-						});
-
-						if (bDidHit)
-						{
-							GridDataAsset->SetDataCell(CurrentCell,Point,true);
-						}
-						else
-						{
-							GridDataAsset->SetDataCell(CurrentCell,Point,false);
-							ViewBlockers.Add(Point);
-							bIsBoxSceneDirty = true;
-						}
-						TimeShotgunTest += FPlatformTime::Seconds() - Start;
-					}
-				}
+				ViewBlockers.Append(PendingBlockers);
+				PendingBlockers.Reset();
+				bIsBoxSceneDirty = true;
 			}
 			
 			if (bShouldBreak)
@@ -733,16 +1904,14 @@ void APVGBuilder::Tick(float DeltaTime)
 			}
 		}
 
-		UE_LOG(LogTemp,Warning,TEXT("Finished %d,Simple Tests %.3f.\tBox Scene Occluded: %d (%.3f sec) SceneSize %d\t Shotgun Trace: %d %.3f."),
-			CurrentCell,TimeSimpleTest,
-			NumOccludedBoxScene,TimeOccludedBoxScene,
-			ViewBlockers.Num(),
-			ShotgunTest,TimeShotgunTest);
-		
-		UE_LOG(LogTemp,Warning,TEXT("%d visible %d occluded. Computed %.3f"),
-			GridData[CurrentCell].VisibleRegions.Num(),
-			GridData[CurrentCell].InvisibleRegions.Num(),
-			FPlatformTime::Seconds() - StartTime);
+		// Per cell counters and timings go to the build report, the log only gets a progress line now and then.
+		BuildStats->EndStep(CurrentCell);
+		if (FPlatformTime::Seconds() - LastProgressLogTime > 10.0)
+		{
+			LastProgressLogTime = FPlatformTime::Seconds();
+			UE_LOG(LogTemp,Warning,TEXT("Shells: %d / %d cells done, pair state %.1f MB."),
+				CurrentCell + 1,LocationsToBuild.Num(),PairMatrix.GetAllocatedSize() / (1024.f * 1024.f));
+		}
 		
 		// check missing one.
 		bTraceCheckStage = true;
@@ -750,6 +1919,13 @@ void APVGBuilder::Tick(float DeltaTime)
 
 		ViewBlockers.Reset();
 		BoxScene.Reset();
+
+		// Cells are fully resolved in between ticks, safe point to flush.
+		const float CheckpointInterval = UPVGDeveloperSettings::GetCheckpointInterval();
+		if (CheckpointInterval > 0 && FPlatformTime::Seconds() - LastCheckpointTime > CheckpointInterval && CurrentCell < LocationsToBuild.Num())
+		{
+			WriteCheckpoint();
+		}
  	}
 }
 
@@ -760,6 +1936,7 @@ bool APVGBuilder::MoveToLocation(int32 Index)
 		// Update location.
 		SetActorLocation(LocationsToBuild[Index]);
 		GetWorld()->FlushLevelStreaming();
+		RefreshTraceParams();
 		
 		return false;
 	}
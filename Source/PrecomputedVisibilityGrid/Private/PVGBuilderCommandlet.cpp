@@ -8,6 +8,7 @@
 #include "WorldPartition/WorldPartition.h"
 #include "WorldPartition/LoaderAdapter/LoaderAdapterShape.h"
 #include "PVGBuilder.h"
+#include "PVGDeveloperSettings.h"
 #include "PVGManager.h"
 #include "WorldPartition/WorldPartitionHelpers.h"
 
@@ -25,33 +26,43 @@ int32 UPVGBuilderCommandlet::Main(const FString& Params)
 		return 1;
 	}
 
+	// -Shard=Index/NumShards, resolve a part of the grid and write it to a partial file.
+	FPVGBuildOptions Options;
+	FString ShardString;
+	if (FParse::Value(*Params, TEXT("Shard="), ShardString))
+	{
+		FString IndexString, NumString;
+		if (!ShardString.Split(TEXT("/"), &IndexString, &NumString) || !IndexString.IsNumeric() || !NumString.IsNumeric())
+		{
+			UE_LOG(LogTemp, Error, TEXT("Invalid shard '%s', expected -Shard=Index/NumShards"), *ShardString);
+			return 1;
+		}
+
+		Options.ShardIndex = FCString::Atoi(*IndexString);
+		Options.NumShards = FCString::Atoi(*NumString);
+		
+		if (Options.NumShards < 1 || Options.ShardIndex < 0 || Options.ShardIndex >= Options.NumShards)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Invalid shard '%s', expected -Shard=Index/NumShards"), *ShardString);
+			return 1;
+		}
+	}
+
+	// -Resume, continue from the last checkpoint written by a crashed or killed build.
+	Options.bResume = Switches.Contains(TEXT("Resume"));
+
+	// -Incremental, only resolve the pairs around geometry that changed since the last build.
+	Options.bIncremental = Switches.Contains(TEXT("Incremental"));
+
 	// TODO
 	//if (Switches.Contains(TEXT("Verbose")))
 	//{
 	//	LogWorldPartitionBuilderCommandlet.SetVerbosity(ELogVerbosity::Verbose);
 	//}
 
-	// This will convert incomplete package name to a fully qualified path
-	FString WorldFilename;
-	if (!FPackageName::SearchForPackageOnDisk(Tokens[0], &Tokens[0], &WorldFilename))
-	{
-		UE_LOG(LogTemp, Error, TEXT("Unknown world '%s'"), *Tokens[0]);
-		return 1;
-	}
-
-	// Load the world package
-	UPackage* WorldPackage = LoadWorldPackageForEditor(Tokens[0]);
-	if (!WorldPackage)
-	{
-		UE_LOG(LogTemp, Error, TEXT("Couldn't load package %s."), *Tokens[0]);
-		return 1;
-	}
-
-	// Find the world in the given package
-	UWorld* World = UWorld::FindWorldInPackage(WorldPackage);
+	UWorld* World = UPVGPrecomputedGridBuilder::LoadWorld(Tokens[0]);
 	if (!World)
 	{
-		UE_LOG(LogTemp, Error, TEXT("No world in specified package %s."), *Tokens[0]);
 		return 1;
 	}
 	
@@ -66,7 +77,7 @@ int32 UPVGBuilderCommandlet::Main(const FString& Params)
 	bool bResult;
 	{
 		FGCObjectScopeGuard BuilderGuard(Builder);
-		bResult = Builder->RunBuilder(World);
+		bResult = Builder->RunBuilder(World, Options);
 	}
 
 	return bResult ? 0 : 1;
@@ -75,7 +86,34 @@ int32 UPVGBuilderCommandlet::Main(const FString& Params)
 UPVGPrecomputedGridBuilder::UPVGPrecomputedGridBuilder(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
 {}
 
-bool UPVGPrecomputedGridBuilder::RunBuilder(UWorld* World)
+UWorld* UPVGPrecomputedGridBuilder::LoadWorld(const FString& WorldName)
+{
+	// This will convert incomplete package name to a fully qualified path
+	FString PackageName, WorldFilename;
+	if (!FPackageName::SearchForPackageOnDisk(WorldName, &PackageName, &WorldFilename))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Unknown world '%s'"), *WorldName);
+		return nullptr;
+	}
+
+	// Load the world package
+	UPackage* WorldPackage = LoadWorldPackageForEditor(PackageName);
+	if (!WorldPackage)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Couldn't load package %s."), *PackageName);
+		return nullptr;
+	}
+
+	// Find the world in the given package
+	UWorld* World = UWorld::FindWorldInPackage(WorldPackage);
+	if (!World)
+	{
+		UE_LOG(LogTemp, Error, TEXT("No world in specified package %s."), *PackageName);
+	}
+	return World;
+}
+
+bool UPVGPrecomputedGridBuilder::RunBuilder(UWorld* World, const FPVGBuildOptions& Options)
 {
 	bool bResult = true;
 	
@@ -117,7 +155,7 @@ bool UPVGPrecomputedGridBuilder::RunBuilder(UWorld* World)
 			CommandletHelpers::TickEngine(World);
 
 			// your work here
-			bResult = Run(World);
+			bResult = Run(World, Options);
 
 			// Tick the engine.
 			CommandletHelpers::TickEngine(World);
@@ -128,17 +166,22 @@ bool UPVGPrecomputedGridBuilder::RunBuilder(UWorld* World)
 		}
 	}
 
-	return true;
+	return bResult;
 }
 
-bool UPVGPrecomputedGridBuilder::Run(UWorld* World)
+bool UPVGPrecomputedGridBuilder::Run(UWorld* World, const FPVGBuildOptions& Options)
 {
 	UWorldPartition* WorldPartition = World->GetWorldPartition();
 	check(WorldPartition)
 			
-	FBox Bound = FBox(FVector(-HALF_WORLD_MAX, -HALF_WORLD_MAX, -HALF_WORLD_MAX), FVector(HALF_WORLD_MAX, HALF_WORLD_MAX, HALF_WORLD_MAX));
-	TUniquePtr<FLoaderAdapterShape> LoaderAdapterShape = MakeUnique<FLoaderAdapterShape>(World, Bound, TEXT("Loaded Region"));
-	LoaderAdapterShape->Load();
+	// Streamed builds load the world around each batch themselves, only the always loaded actors are there up front.
+	TUniquePtr<FLoaderAdapterShape> LoaderAdapterShape;
+	if (UPVGDeveloperSettings::GetBuildMode() != EPVGBuildMode::Streamed || Options.IsSharded())
+	{
+		FBox Bound = FBox(FVector(-HALF_WORLD_MAX, -HALF_WORLD_MAX, -HALF_WORLD_MAX), FVector(HALF_WORLD_MAX, HALF_WORLD_MAX, HALF_WORLD_MAX));
+		LoaderAdapterShape = MakeUnique<FLoaderAdapterShape>(World, Bound, TEXT("Loaded Region"));
+		LoaderAdapterShape->Load();
+	}
 
 	// Make sure we run begin play otherwise the phys scene etc wont be there.
 	World->BeginPlay();
@@ -161,17 +204,26 @@ bool UPVGPrecomputedGridBuilder::Run(UWorld* World)
 	if (!Manager)
 	{
 		// TODO To handle.
+		UE_LOG(LogTemp, Error, TEXT("No PVGManager loaded, streamed builds need it to be always loaded."));
+		return false;
 	}
 
 	Manager->SetActorTickEnabled(false);
-	APVGBuilder* BuilderActor = Manager->StartBuild();
+	APVGBuilder* BuilderActor = Manager->StartBuildWithOptions(Options);
 
 	// "tick" the builder
 	while (BuilderActor->IsActorTickEnabled())
 	{
 		World->Tick(ELevelTick::LEVELTICK_All,FApp::GetDeltaTime());
 		CommandletHelpers::TickEngine(World);
+
+		// Streamed batches unload the previous region, drop its actors before the next batch loads more.
+		if (BuilderActor->ConsumeGarbageCollectionRequest())
+		{
+			CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+		}
 	}
-		
+
+	BuiltAsset = Manager->GridDataAsset;
 	return true;	
 }
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 #include "Commandlets/Commandlet.h"
+#include "PVGBuilder.h"
 #include "PVGBuilderCommandlet.generated.h"
 
 UCLASS()
@@ -14,6 +15,13 @@ class UPVGPrecomputedGridBuilder : public UObject
 {
 	GENERATED_UCLASS_BODY()
 
-	bool RunBuilder(UWorld* World);
-	bool Run(UWorld* World);//, FPackageSourceControlHelper& PackageHelper);
+	/* Find and load the world package of a full or partial package name, logs why it failed when it returns null. */
+	static UWorld* LoadWorld(const FString& WorldName);
+
+	bool RunBuilder(UWorld* World, const FPVGBuildOptions& Options);
+	bool Run(UWorld* World, const FPVGBuildOptions& Options);//, FPackageSourceControlHelper& PackageHelper);
+
+	/* Grid data of the last successful build. */
+	UPROPERTY()
+	TObjectPtr<UPVGPrecomputedGridDataAsset> BuiltAsset;
 };
\ No newline at end of file
@@ -0,0 +1,469 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGCollisionBVH.h"
+
+#include "EngineUtils.h"
+#include "InstancedFoliageActor.h"
+#include "PVGBuilder.h"
+#include "PVGManager.h"
+#include "Components/InstancedStaticMeshComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Interfaces/Interface_CollisionDataProvider.h"
+#include "PhysicsEngine/BodySetup.h"
+
+namespace PVGCollisionBVH
+{
+	constexpr int32 MaxLeafTriangles = 8;
+	constexpr int32 MaxLeafInstances = 2;
+
+	// Corner indices of FBox::GetVertices per face.
+	constexpr uint8 QuadFaces[6][4] {{0,1,6,2},{3,5,7,4},{0,1,5,3},{2,6,7,4},{0,2,4,3},{1,6,7,5}};
+}
+
+void FPVGCollisionBVH::Build(UWorld* World, const FBox& Bounds, const FCollisionResponseParams& ResponseParams)
+{
+	const double StartTime = FPlatformTime::Seconds();
+
+	Empty();
+
+	/* Collision of a mesh in its local space, captured once for all its components and instances. */
+	struct FMeshEntry
+	{
+		int32 Tree = INDEX_NONE;
+		FBox3f LocalBounds = FBox3f(ForceInit);
+		bool bHasCurvedShapes = false;
+	};
+	TMap<UStaticMesh*,FMeshEntry> MeshEntries;
+	TArray<FTriangle> Triangles;
+	int32 NumComponents = 0;
+	int64 NumTriangles = 0;
+
+	auto AddTriangle = [&Triangles](const FVector& A, const FVector& B, const FVector& C)
+	{
+		Triangles.Add({FVector3f(A),FVector3f(B),FVector3f(C)});
+	};
+
+	auto AddSimpleCollision = [&](const FKAggregateGeom& AggGeom)
+	{
+		for (const FKBoxElem& Box : AggGeom.BoxElems)
+		{
+			const FTransform BoxTransform = Box.GetTransform();
+			const FVector Extent(Box.X * 0.5f,Box.Y * 0.5f,Box.Z * 0.5f);
+
+			FVector Corners[8];
+			FBox(-Extent,Extent).GetVertices(Corners);
+			for (const uint8* Face : PVGCollisionBVH::QuadFaces)
+			{
+				AddTriangle(BoxTransform.TransformPosition(Corners[Face[0]]),BoxTransform.TransformPosition(Corners[Face[1]]),BoxTransform.TransformPosition(Corners[Face[2]]));
+				AddTriangle(BoxTransform.TransformPosition(Corners[Face[0]]),BoxTransform.TransformPosition(Corners[Face[2]]),BoxTransform.TransformPosition(Corners[Face[3]]));
+			}
+		}
+
+		for (const FKConvexElem& Convex : AggGeom.ConvexElems)
+		{
+			const FTransform ConvexTransform = Convex.GetTransform();
+			for (int32 i = 0; i + 2 < Convex.IndexData.Num(); i += 3)
+			{
+				AddTriangle(
+					ConvexTransform.TransformPosition(Convex.VertexData[Convex.IndexData[i]]),
+					ConvexTransform.TransformPosition(Convex.VertexData[Convex.IndexData[i + 1]]),
+					ConvexTransform.TransformPosition(Convex.VertexData[Convex.IndexData[i + 2]]));
+			}
+		}
+	};
+
+	auto AddMesh = [&](UStaticMesh* Mesh, const UBodySetup* BodySetup) -> const FMeshEntry&
+	{
+		if (const FMeshEntry* Existing = MeshEntries.Find(Mesh))
+		{
+			return *Existing;
+		}
+
+		FMeshEntry& Entry = MeshEntries.Add(Mesh);
+		Triangles.Reset();
+
+		// Complex traces hit the collision mesh, unless the mesh uses its simple shapes for both.
+		if (BodySetup->GetCollisionTraceFlag() == CTF_UseSimpleAsComplex)
+		{
+			AddSimpleCollision(BodySetup->AggGeom);
+
+			// Curved shapes aren't worth tessellating, rays through them go to the physics scene.
+			const FKAggregateGeom& AggGeom = BodySetup->AggGeom;
+			Entry.bHasCurvedShapes = AggGeom.SphereElems.Num() > 0 || AggGeom.SphylElems.Num() > 0 || AggGeom.TaperedCapsuleElems.Num() > 0;
+		}
+		else
+		{
+			// Only the sections that have collision enabled, the same ones the physics scene cooks.
+			FTriMeshCollisionData TriMesh;
+			Mesh->GetPhysicsTriMeshData(&TriMesh,false);
+			for (const FTriIndices& Triangle : TriMesh.Indices)
+			{
+				Triangles.Add({TriMesh.Vertices[Triangle.v0],TriMesh.Vertices[Triangle.v1],TriMesh.Vertices[Triangle.v2]});
+			}
+		}
+
+		if (Triangles.Num() > 0)
+		{
+			for (const FTriangle& Triangle : Triangles)
+			{
+				Entry.LocalBounds += Triangle.V0;
+				Entry.LocalBounds += Triangle.V1;
+				Entry.LocalBounds += Triangle.V2;
+			}
+			Entry.Tree = Meshes.Num();
+			BuildMeshTree(Triangles,Meshes.AddDefaulted_GetRef());
+			NumTriangles += Triangles.Num();
+		}
+		return Entry;
+	};
+
+	TArray<FBox3f> InstanceBounds;
+	for (TActorIterator<AActor> It(World); It; ++It)
+	{
+		const AActor* Actor = *It;
+		if (!Actor || Actor->IsA<AInstancedFoliageActor>() || Actor->IsA<APVGBuilder>() || Actor->IsA<APVGManager>())
+		{
+			continue;
+		}
+
+		for (const UPrimitiveComponent* Component : TInlineComponentArray<UPrimitiveComponent*>(Actor))
+		{
+			// Same filter as the builder traces, baked in so queries don't need it.
+			const FBox ComponentBounds = Component->Bounds.GetBox();
+			if (!Component->IsRegistered() || !Component->IsQueryCollisionEnabled() ||
+				ResponseParams.CollisionResponse.GetResponse(Component->GetCollisionObjectType()) != ECR_Block ||
+				Component->GetCollisionResponseToChannel(ECC_Visibility) != ECR_Block ||
+				!ComponentBounds.Intersect(Bounds))
+			{
+				continue;
+			}
+			NumComponents++;
+
+			const UStaticMeshComponent* MeshComponent = Cast<UStaticMeshComponent>(Component);
+			UStaticMesh* Mesh = MeshComponent ? MeshComponent->GetStaticMesh() : nullptr;
+			const UBodySetup* BodySetup = Mesh ? Mesh->GetBodySetup() : nullptr;
+			if (!BodySetup)
+			{
+				UnsupportedBoxes.Add(ComponentBounds);
+				continue;
+			}
+
+			const FMeshEntry& Entry = AddMesh(Mesh,BodySetup);
+			if (Entry.bHasCurvedShapes || (Entry.Tree == INDEX_NONE && BodySetup->GetCollisionTraceFlag() != CTF_UseSimpleAsComplex))
+			{
+				UnsupportedBoxes.Add(ComponentBounds);
+			}
+			if (Entry.Tree == INDEX_NONE)
+			{
+				continue;
+			}
+
+			TArray<FTransform,TInlineAllocator<1>> Transforms;
+			if (const UInstancedStaticMeshComponent* InstancedComponent = Cast<UInstancedStaticMeshComponent>(Component))
+			{
+				for (int32 Instance = 0; Instance < InstancedComponent->GetInstanceCount(); Instance++)
+				{
+					InstancedComponent->GetInstanceTransform(Instance,Transforms.AddDefaulted_GetRef(),true);
+				}
+			}
+			else
+			{
+				Transforms.Add(Component->GetComponentTransform());
+			}
+
+			for (const FTransform& Transform : Transforms)
+			{
+				const FBox WorldBounds = FBox(Entry.LocalBounds).TransformBy(Transform);
+				if (WorldBounds.Intersect(Bounds))
+				{
+					Instances.Add({FMatrix44f(Transform.ToInverseMatrixWithScale()),Entry.Tree});
+					InstanceBounds.Add(FBox3f(WorldBounds));
+				}
+			}
+		}
+	}
+
+	if (Instances.Num() > 0)
+	{
+		TArray<int32> Indices;
+		Indices.SetNumUninitialized(Instances.Num());
+		for (int32 i = 0; i < Indices.Num(); i++)
+		{
+			Indices[i] = i;
+		}
+
+		// Leaves own a contiguous range of the instances, in tree order.
+		TArray<FInstance> Sorted;
+		Sorted.Reserve(Instances.Num());
+		auto EmitLeaf = [this,&Sorted](FNode& Node, const int32* LeafIndices, int32 Num)
+		{
+			Node.Index = Sorted.Num();
+			Node.Num = Num;
+			for (int32 i = 0; i < Num; i++)
+			{
+				Sorted.Add(Instances[LeafIndices[i]]);
+			}
+		};
+		InstanceNodes.Reserve(Instances.Num());
+		BuildNode(InstanceNodes,InstanceBounds,Indices,0,Instances.Num(),PVGCollisionBVH::MaxLeafInstances,EmitLeaf);
+		Instances = MoveTemp(Sorted);
+	}
+
+	UE_LOG(LogTemp,Warning,TEXT("Collision snapshot: %d components, %d meshes with %lld triangles, %d instances (%.1f MB), %d unsupported components, built in %.2f sec."),
+		NumComponents,Meshes.Num(),NumTriangles,Instances.Num(),GetAllocatedSize() / (1024.f * 1024.f),UnsupportedBoxes.Num(),FPlatformTime::Seconds() - StartTime);
+}
+
+void FPVGCollisionBVH::Empty()
+{
+	Meshes.Empty();
+	InstanceNodes.Empty();
+	Instances.Empty();
+	UnsupportedBoxes.Empty();
+}
+
+int64 FPVGCollisionBVH::GetAllocatedSize() const
+{
+	int64 Size = Meshes.GetAllocatedSize() + InstanceNodes.GetAllocatedSize() + Instances.GetAllocatedSize() + UnsupportedBoxes.GetAllocatedSize();
+	for (const FMeshTree& Mesh : Meshes)
+	{
+		Size += Mesh.Nodes.GetAllocatedSize() + Mesh.Packets.GetAllocatedSize();
+	}
+	return Size;
+}
+
+template<typename EmitLeafType>
+int32 FPVGCollisionBVH::BuildNode(TArray<FNode>& Nodes, const TArray<FBox3f>& Bounds, TArray<int32>& Indices, int32 Begin, int32 Num, int32 MaxLeafSize, EmitLeafType& EmitLeaf)
+{
+	const int32 NodeIndex = Nodes.AddDefaulted();
+
+	FBox3f NodeBounds(ForceInit);
+	FBox3f CentroidBounds(ForceInit);
+	for (int32 i = Begin; i < Begin + Num; i++)
+	{
+		NodeBounds += Bounds[Indices[i]];
+		CentroidBounds += Bounds[Indices[i]].GetCenter();
+	}
+	Nodes[NodeIndex].Min = NodeBounds.Min;
+	Nodes[NodeIndex].Max = NodeBounds.Max;
+
+	if (Num <= MaxLeafSize)
+	{
+		EmitLeaf(Nodes[NodeIndex],Indices.GetData() + Begin,Num);
+		return NodeIndex;
+	}
+
+	// Median split along the widest axis of the centroids, keeps the tree balanced so the traversal stack stays small.
+	const FVector3f Size = CentroidBounds.GetSize();
+	const int32 Axis = Size.X >= Size.Y && Size.X >= Size.Z ? 0 : (Size.Y >= Size.Z ? 1 : 2);
+	Sort(Indices.GetData() + Begin,Num,[&Bounds,Axis](int32 A, int32 B) { return Bounds[A].Min[Axis] + Bounds[A].Max[Axis] < Bounds[B].Min[Axis] + Bounds[B].Max[Axis]; });
+
+	const int32 Half = Num / 2;
+	BuildNode(Nodes,Bounds,Indices,Begin,Half,MaxLeafSize,EmitLeaf);
+	const int32 Right = BuildNode(Nodes,Bounds,Indices,Begin + Half,Num - Half,MaxLeafSize,EmitLeaf);
+
+	Nodes[NodeIndex].Index = Right;
+	Nodes[NodeIndex].Num = 0;
+	return NodeIndex;
+}
+
+void FPVGCollisionBVH::BuildMeshTree(const TArray<FTriangle>& Triangles, FMeshTree& OutTree)
+{
+	TArray<FBox3f> Bounds;
+	TArray<int32> Indices;
+	Bounds.SetNumUninitialized(Triangles.Num());
+	Indices.SetNumUninitialized(Triangles.Num());
+	for (int32 i = 0; i < Triangles.Num(); i++)
+	{
+		Bounds[i] = FBox3f(ForceInit);
+		Bounds[i] += Triangles[i].V0;
+		Bounds[i] += Triangles[i].V1;
+		Bounds[i] += Triangles[i].V2;
+		Indices[i] = i;
+	}
+
+	auto EmitLeaf = [&Triangles,&OutTree](FNode& Node, const int32* LeafIndices, int32 Num)
+	{
+		Node.Index = OutTree.Packets.Num();
+		Node.Num = FMath::DivideAndRoundUp(Num,4);
+
+		for (int32 First = 0; First < Num; First += 4)
+		{
+			FTrianglePacket& Packet = OutTree.Packets.AddZeroed_GetRef();
+			for (int32 Lane = 0; Lane < 4 && First + Lane < Num; Lane++)
+			{
+				const FTriangle& Triangle = Triangles[LeafIndices[First + Lane]];
+				const FVector3f E1 = Triangle.V1 - Triangle.V0;
+				const FVector3f E2 = Triangle.V2 - Triangle.V0;
+				for (int32 Axis = 0; Axis < 3; Axis++)
+				{
+					Packet.V0[Axis][Lane] = Triangle.V0[Axis];
+					Packet.E1[Axis][Lane] = E1[Axis];
+					Packet.E2[Axis][Lane] = E2[Axis];
+				}
+			}
+		}
+	};
+
+	OutTree.Nodes.Reserve(Triangles.Num() / 2);
+	OutTree.Packets.Reserve(Triangles.Num() / 3);
+	BuildNode(OutTree.Nodes,Bounds,Indices,0,Triangles.Num(),PVGCollisionBVH::MaxLeafTriangles,EmitLeaf);
+}
+
+bool FPVGCollisionBVH::IntersectPacket(const FTrianglePacket& Packet, const VectorRegister4Float Origin[3], const VectorRegister4Float Direction[3])
+{
+	// Moller-Trumbore for 4 triangles at once, both sides count as a hit.
+	const VectorRegister4Float V0[3] = { VectorLoadAligned(Packet.V0[0]),VectorLoadAligned(Packet.V0[1]),VectorLoadAligned(Packet.V0[2]) };
+	const VectorRegister4Float E1[3] = { VectorLoadAligned(Packet.E1[0]),VectorLoadAligned(Packet.E1[1]),VectorLoadAligned(Packet.E1[2]) };
+	const VectorRegister4Float E2[3] = { VectorLoadAligned(Packet.E2[0]),VectorLoadAligned(Packet.E2[1]),VectorLoadAligned(Packet.E2[2]) };
+
+	auto Cross = [](const VectorRegister4Float A[3], const VectorRegister4Float B[3], VectorRegister4Float Out[3])
+	{
+		Out[0] = VectorSubtract(VectorMultiply(A[1],B[2]),VectorMultiply(A[2],B[1]));
+		Out[1] = VectorSubtract(VectorMultiply(A[2],B[0]),VectorMultiply(A[0],B[2]));
+		Out[2] = VectorSubtract(VectorMultiply(A[0],B[1]),VectorMultiply(A[1],B[0]));
+	};
+	auto Dot = [](const VectorRegister4Float A[3], const VectorRegister4Float B[3])
+	{
+		return VectorMultiplyAdd(A[2],B[2],VectorMultiplyAdd(A[1],B[1],VectorMultiply(A[0],B[0])));
+	};
+
+	VectorRegister4Float P[3];
+	Cross(Direction,E2,P);
+	const VectorRegister4Float Det = Dot(E1,P);
+
+	// Degenerate lanes divide by zero, the determinant test masks them out.
+	const VectorRegister4Float InvDet = VectorDivide(VectorOneFloat(),Det);
+
+	const VectorRegister4Float T[3] = { VectorSubtract(Origin[0],V0[0]),VectorSubtract(Origin[1],V0[1]),VectorSubtract(Origin[2],V0[2]) };
+	const VectorRegister4Float U = VectorMultiply(Dot(T,P),InvDet);
+
+	VectorRegister4Float Q[3];
+	Cross(T,E1,Q);
+	const VectorRegister4Float V = VectorMultiply(Dot(Direction,Q),InvDet);
+	const VectorRegister4Float Time = VectorMultiply(Dot(E2,Q),InvDet);
+
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const VectorRegister4Float One = VectorOneFloat();
+	VectorRegister4Float Hit = VectorCompareGT(VectorAbs(Det),VectorSetFloat1(UE_SMALL_NUMBER));
+	Hit = VectorBitwiseAnd(Hit,VectorCompareGE(U,Zero));
+	Hit = VectorBitwiseAnd(Hit,VectorCompareGE(V,Zero));
+	Hit = VectorBitwiseAnd(Hit,VectorCompareLE(VectorAdd(U,V),One));
+	Hit = VectorBitwiseAnd(Hit,VectorCompareGE(Time,Zero));
+	Hit = VectorBitwiseAnd(Hit,VectorCompareLE(Time,One));
+	return VectorMaskBits(Hit) != 0;
+}
+
+template<typename LeafFuncType>
+bool FPVGCollisionBVH::TraverseNodes(const TArray<FNode>& Nodes, const FVector3f& Origin, const FVector3f& Direction, LeafFuncType LeafFunc)
+{
+	if (Nodes.Num() == 0)
+	{
+		return false;
+	}
+
+	// Keep the slab test finite, 0 * inf would turn into NaN.
+	FVector3f InvDirection;
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		const float D = Direction[Axis];
+		InvDirection[Axis] = 1.f / (FMath::Abs(D) > 1e-12f ? D : (D < 0 ? -1e-12f : 1e-12f));
+	}
+
+	// The W lanes clamp the segment to [0,1]: node min W is 0 and max W is 1, so they enter at 0 and exit at 1.
+	const VectorRegister4Float OriginV = MakeVectorRegisterFloat(Origin.X,Origin.Y,Origin.Z,0.f);
+	const VectorRegister4Float InvDirectionV = MakeVectorRegisterFloat(InvDirection.X,InvDirection.Y,InvDirection.Z,1.f);
+	const VectorRegister4Float XYZMask = GlobalVectorConstants::XYZMask();
+
+	int32 Stack[64];
+	int32 StackSize = 0;
+	Stack[StackSize++] = 0;
+
+	while (StackSize > 0)
+	{
+		const int32 NodeIndex = Stack[--StackSize];
+		const FNode& Node = Nodes[NodeIndex];
+
+		const VectorRegister4Float Min = VectorSelect(XYZMask,VectorLoad(&Node.Min.X),VectorZeroFloat());
+		const VectorRegister4Float Max = VectorSelect(XYZMask,VectorLoad(&Node.Max.X),VectorOneFloat());
+		const VectorRegister4Float T0 = VectorMultiply(VectorSubtract(Min,OriginV),InvDirectionV);
+		const VectorRegister4Float T1 = VectorMultiply(VectorSubtract(Max,OriginV),InvDirectionV);
+
+		VectorRegister4Float Enter = VectorMin(T0,T1);
+		VectorRegister4Float Exit = VectorMax(T0,T1);
+		Enter = VectorMax(Enter,VectorSwizzle(Enter,2,3,0,1));
+		Enter = VectorMax(Enter,VectorSwizzle(Enter,1,0,3,2));
+		Exit = VectorMin(Exit,VectorSwizzle(Exit,2,3,0,1));
+		Exit = VectorMin(Exit,VectorSwizzle(Exit,1,0,3,2));
+
+		if (!(VectorMaskBits(VectorCompareLE(Enter,Exit)) & 1))
+		{
+			continue;
+		}
+
+		if (Node.Num == 0)
+		{
+			Stack[StackSize++] = Node.Index;
+			Stack[StackSize++] = NodeIndex + 1;
+			continue;
+		}
+
+		if (LeafFunc(Node.Index,Node.Num))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+EPVGRayResult FPVGCollisionBVH::TraceRay(const FVector& Start, const FVector& End) const
+{
+	const FVector3f WorldStart(Start);
+	const FVector3f WorldEnd(End);
+	const bool bBlocked = TraverseNodes(InstanceNodes,WorldStart,WorldEnd - WorldStart,[&](int32 FirstInstance, int32 NumInstances)
+	{
+		for (int32 i = FirstInstance; i < FirstInstance + NumInstances; i++)
+		{
+			// Affine transforms keep the segment parameter, the [0,1] clamp stays valid in mesh space.
+			const FInstance& Instance = Instances[i];
+			const FVector3f Origin(Instance.WorldToLocal.TransformPosition(WorldStart));
+			const FVector3f Direction = FVector3f(Instance.WorldToLocal.TransformPosition(WorldEnd)) - Origin;
+
+			const VectorRegister4Float OriginSoA[3] = { VectorSetFloat1(Origin.X),VectorSetFloat1(Origin.Y),VectorSetFloat1(Origin.Z) };
+			const VectorRegister4Float DirectionSoA[3] = { VectorSetFloat1(Direction.X),VectorSetFloat1(Direction.Y),VectorSetFloat1(Direction.Z) };
+
+			const FMeshTree& Mesh = Meshes[Instance.Mesh];
+			const bool bHit = TraverseNodes(Mesh.Nodes,Origin,Direction,[&](int32 FirstPacket, int32 NumPackets)
+			{
+				for (int32 Packet = FirstPacket; Packet < FirstPacket + NumPackets; Packet++)
+				{
+					if (IntersectPacket(Mesh.Packets[Packet],OriginSoA,DirectionSoA))
+					{
+						return true;
+					}
+				}
+				return false;
+			});
+
+			if (bHit)
+			{
+				return true;
+			}
+		}
+		return false;
+	});
+
+	if (bBlocked)
+	{
+		return EPVGRayResult::Blocked;
+	}
+
+	for (const FBox& Box : UnsupportedBoxes)
+	{
+		if (FMath::LineBoxIntersection(Box,Start,End,End - Start))
+		{
+			return EPVGRayResult::Unknown;
+		}
+	}
+	return EPVGRayResult::Clear;
+}
@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PVGOccupancyVolume.h"
+
+/*
+ * Immutable snapshot of the static blocking collision the builder traces against, as a two level BVH. Every mesh gets one
+ * BVH over its triangles in its local space, a top level BVH over the placed instances moves rays into the mesh space,
+ * so instanced meshes and foliage only cost one transform per instance.
+ * Built once on the game thread, afterwards any thread can query it without locks or per query setup.
+ * Components whose collision can't be captured as triangles are kept as boxes, rays through those report Unknown.
+ */
+class FPVGCollisionBVH
+{
+public:
+	/* Capture the components overlapping Bounds that block the builder traces, filtered the same way as the trace params. */
+	void Build(UWorld* World, const FBox& Bounds, const FCollisionResponseParams& ResponseParams);
+
+	void Empty();
+
+	bool IsValid() const { return Instances.Num() > 0 || UnsupportedBoxes.Num() > 0; }
+
+	/* Any hit test of the segment, Blocked on the first triangle hit. */
+	EPVGRayResult TraceRay(const FVector& Start, const FVector& End) const;
+
+	int64 GetAllocatedSize() const;
+
+private:
+	/* Inner nodes keep their left child right after them and Index points to the right child.
+	 * Leaves point to their first packet or instance with Index and hold Num of them, inner nodes have Num 0. */
+	struct FNode
+	{
+		FVector3f Min;
+		int32 Index;
+		FVector3f Max;
+		int32 Num;
+	};
+
+	/* 4 triangles in SoA layout, unused slots are degenerate and never hit. */
+	struct alignas(16) FTrianglePacket
+	{
+		float V0[3][4];
+		float E1[3][4];
+		float E2[3][4];
+	};
+
+	struct FTriangle
+	{
+		FVector3f V0, V1, V2;
+	};
+
+	/* Triangles of one mesh in its local space, shared by all its instances. */
+	struct FMeshTree
+	{
+		TArray<FNode> Nodes;
+		TArray<FTrianglePacket> Packets;
+	};
+
+	/* One placed mesh, rays get moved into the mesh space instead of copying its triangles. */
+	struct FInstance
+	{
+		FMatrix44f WorldToLocal;
+		int32 Mesh;
+	};
+
+	/* Median split tree over Bounds, EmitLeaf(Node,LeafIndices,Num) fills in the leaves. */
+	template<typename EmitLeafType>
+	static int32 BuildNode(TArray<FNode>& Nodes, const TArray<FBox3f>& Bounds, TArray<int32>& Indices, int32 Begin, int32 Num, int32 MaxLeafSize, EmitLeafType& EmitLeaf);
+
+	/* Calls LeafFunc(Index,Num) for every leaf the segment crosses, stops once it returns true. */
+	template<typename LeafFuncType>
+	static bool TraverseNodes(const TArray<FNode>& Nodes, const FVector3f& Origin, const FVector3f& Direction, LeafFuncType LeafFunc);
+
+	static void BuildMeshTree(const TArray<FTriangle>& Triangles, FMeshTree& OutTree);
+
+	/* Returns true when any triangle of the packet crosses the segment. */
+	static bool IntersectPacket(const FTrianglePacket& Packet, const VectorRegister4Float Origin[3], const VectorRegister4Float Direction[3]);
+
+	TArray<FMeshTree> Meshes;
+
+	/* Top level, leaves point into Instances. */
+	TArray<FNode> InstanceNodes;
+	TArray<FInstance> Instances;
+
+	/* Blocking components without triangle collision, e.g. landscapes or spheres. */
+	TArray<FBox> UnsupportedBoxes;
+};
@@ -1,8 +1,11 @@
 #pragma once
 #include "Engine/DeveloperSettings.h"
+#include "PVGBoxDecomposition.h"
+#include "PVGBuilder.h"
+#include "PVGReachability.h"
 #include "PVGDeveloperSettings.generated.h"
 
-UCLASS(defaultconfig)
+UCLASS(config=Game, defaultconfig)
 class PRECOMPUTEDVISIBILITYGRID_API UPVGDeveloperSettings : public UDeveloperSettings
 {
 	GENERATED_BODY()
@@ -15,6 +18,47 @@ public:
 	static FIntVector GetBoxSize();
 	
 	static FBox GetBoxSizeAsFBox();
+
+	static EPVGBuildMode GetBuildMode() { return Get()->BuildMode; }
+
+	static int32 GetPairsPerJob() { return FMath::Max(1,Get()->PairsPerJob); }
+	static int32 GetShellBatchPairs() { return FMath::Max(1,Get()->ShellBatchPairs); }
+
+	static float GetCheckpointInterval() { return Get()->CheckpointInterval; }
+
+	static int32 GetShotgunSeed() { return Get()->ShotgunSeed; }
+	static int32 GetShotgunInitialRays() { return FMath::Max(1,Get()->ShotgunInitialRays); }
+	static int32 GetShotgunMaxRays() { return FMath::Max(1,Get()->ShotgunMaxRays); }
+	static float GetShotgunConfidence() { return Get()->ShotgunConfidence; }
+	static float GetShotgunMinVisibleFraction() { return Get()->ShotgunMinVisibleFraction; }
+
+	static bool UseSoftwareOcclusion() { return Get()->bUseSoftwareOcclusion; }
+
+	static EPVGBoxPacking GetBoxPacking() { return Get()->BoxPacking; }
+	static bool UseAdaptiveCellEncoding() { return Get()->bUseAdaptiveCellEncoding; }
+	static bool SaveTransitions() { return Get()->bSaveTransitions; }
+	static bool StreamSectors() { return Get()->bStreamSectors; }
+	static bool StorePairsOnce() { return Get()->bStorePairsOnce; }
+	static int64 GetSectorCacheBudget() { return int64(FMath::Max(0.f,Get()->SectorCacheBudget) * 1024 * 1024); }
+	static int32 GetSectorPrefetchCells() { return FMath::Max(0,Get()->SectorPrefetchCells); }
+
+	static int32 GetSuperCellSize() { return FMath::Max(1,Get()->SuperCellSize); }
+
+	static bool UseOccupancyVolume() { return Get()->bUseOccupancyVolume; }
+	static float GetOccupancyVoxelSize() { return FMath::Max(1.f,Get()->OccupancyVoxelSize); }
+
+	static bool UseCollisionSnapshot() { return Get()->bUseCollisionSnapshot; }
+
+	static bool UseAdaptiveCells() { return Get()->bUseAdaptiveCells; }
+	static int32 GetAdaptiveCellMaxLevel() { return FMath::Clamp(Get()->AdaptiveCellMaxLevel,0,10); }
+
+	static float GetStreamingViewDistance() { return FMath::Max(0.f,Get()->StreamingViewDistance); }
+	static int32 GetStreamingBatchSize() { return FMath::Max(1,Get()->StreamingBatchSize); }
+
+	static bool UseSolidOccluders() { return Get()->bUseSolidOccluders; }
+
+	static EPVGReachability GetReachability() { return Get()->Reachability; }
+	static float GetMaxCameraHeight() { return FMath::Max(0.f,Get()->MaxCameraHeight); }
 	
 protected:
 	UPROPERTY(EditDefaultsOnly, Category="Grid")
@@ -26,5 +70,131 @@ protected:
 
 	UPROPERTY(EditDefaultsOnly, Category="Culling")
 	bool bSupportDynamicBlockers = false;
-	
+
+	/* Order in which cells get packed into boxes, for the saved cell data and the occlusion scenes. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid")
+	EPVGBoxPacking BoxPacking = EPVGBoxPacking::FirstFit;
+
+	/* Save every cell as boxes, a bitset, runs or sorted deltas, whichever is smallest. Boxes only when disabled. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid")
+	bool bUseAdaptiveCellEncoding = true;
+
+	/* Save what changes between neighbouring cells, walking into the next cell then only applies the change instead of
+	 * decoding and comparing the whole hidden set. Costs 12 bytes per cell plus the changes. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid")
+	bool bSaveTransitions = true;
+
+	/* Save every occluded pair once in blocks of 4x4x4 cells instead of in the data of both cells, when that is smaller.
+	 * The blocks stay resident, so this takes the place of sector streaming and runtime compression. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid")
+	bool bStorePairsOnce = false;
+
+	/* Save the cell data of grids with more than one sector as a bulk data chunk per sector, loaded on demand around the
+	 * player instead of keeping the whole grid resident. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid|Streaming")
+	bool bStreamSectors = true;
+
+	/* Decoded sectors kept around, least recently used ones get dropped above it. The sectors around the player always
+	 * stay, even when they don't fit. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid|Streaming", meta=(ClampMin=0, Units="MB", EditCondition="bStreamSectors"))
+	float SectorCacheBudget = 8.f;
+
+	/* Neighbouring sectors get requested once the player is this close to their border. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Grid|Streaming", meta=(ClampMin=0, EditCondition="bStreamSectors"))
+	int32 SectorPrefetchCells = 4;
+
+	/* How the builder schedules its work, the pair pool requires the whole grid to be loaded. Every mode builds at most
+	 * 262144 build cells, the streamed one included, so 2-4 km maps at 5 m cells aren't supported. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder")
+	EPVGBuildMode BuildMode = EPVGBuildMode::CellShells;
+
+	/* Amount of cell pairs a worker claims at once in the pair pool mode. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder", meta=(ClampMin=1))
+	int32 PairsPerJob = 64;
+
+	/* Unresolved pairs the cell shell mode collects across rings before resolving them together. Bigger batches keep the
+	 * cores busy, smaller ones let pairs hidden on inner rings prune the box scene tests of outer rings sooner. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder", meta=(ClampMin=1))
+	int32 ShellBatchPairs = 256;
+
+	/* Farthest a cell can see in the streamed build mode, pairs farther apart stay visible. Bounds the loaded world around each batch. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Streaming", meta=(ClampMin=0, Units="cm"))
+	float StreamingViewDistance = 50000.f;
+
+	/* Source cells resolved per loaded region in the streamed build mode. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Streaming", meta=(ClampMin=1))
+	int32 StreamingBatchSize = 64;
+
+	/* Seconds between builder checkpoints, a crashed build can continue from the last one with -Resume. 0 disables checkpoints. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder", meta=(ClampMin=0, Units="s"))
+	float CheckpointInterval = 600.f;
+
+	/* Rasterize the blockers in front of a target into a small depth buffer, so several blockers can hide a target together.
+	 * Disabled falls back to testing the target against every blocker on its own. The buffer is coarse, blockers only hide
+	 * what they cover with whole pixels, so it pays off mostly for walls of many small blockers. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder")
+	bool bUseSoftwareOcclusion = false;
+
+	/* Edge length in cells of the blocks the cell shells test as a whole before testing their cells, 1 disables it. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder", meta=(ClampMin=1, ClampMax=8))
+	int32 SuperCellSize = 4;
+
+	/* Merge aligned blocks of cells without any blocking surface, or fully inside blocking geometry, into single build cells.
+	 * Open sky and solid ground then cost a handful of cells instead of thousands, at the price of coarser culling there. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Adaptive Cells")
+	bool bUseAdaptiveCells = false;
+
+	/* Largest merged block is 2^AdaptiveCellMaxLevel cells along each axis. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Adaptive Cells", meta=(ClampMin=0, ClampMax=10, EditCondition="bUseAdaptiveCells"))
+	int32 AdaptiveCellMaxLevel = 3;
+
+	/* Classify every cell before building, cells fully inside blocking collision occlude targets for every source cell without any trace. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder")
+	bool bUseSolidOccluders = false;
+
+	/* Only solve visibility from cells a player camera can reach, the other cells are still hidden from reachable ones. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Reachability")
+	EPVGReachability Reachability = EPVGReachability::Disabled;
+
+	/* Highest a camera gets above walkable ground. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Reachability", meta=(ClampMin=0, Units="cm"))
+	float MaxCameraHeight = 500.f;
+
+	/* Seed of the shotgun rays, builds with the same seed produce the same result. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Shotgun")
+	int32 ShotgunSeed = 0;
+
+	/* Rays of the first shotgun batch, every following batch is 4 times as big. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Shotgun", meta=(ClampMin=1))
+	int32 ShotgunInitialRays = 64;
+
+	/* Upper limit of rays per pair, has to stay above what confidence and visible fraction ask for or it silently lowers
+	 * the confidence. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Shotgun", meta=(ClampMin=1))
+	int32 ShotgunMaxRays = 8192;
+
+	/* Confidence that a pair with all rays blocked really has less than ShotgunMinVisibleFraction of its rays getting through.
+	 * A pair takes ln(1 - Confidence) / ln(1 - MinVisibleFraction) rays before it counts as occluded, about 6100 with the
+	 * defaults. Lowering either value builds faster but lets small gaps slip through as popping, 0.99 with 0.002 only
+	 * casts about 2300 rays. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Shotgun", meta=(ClampMin=0, ClampMax=0.999999))
+	float ShotgunConfidence = 0.9999f;
+
+	/* Smallest fraction of rays between two cells that we still want to detect as visible. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Shotgun", meta=(ClampMin=0.000001, ClampMax=1))
+	float ShotgunMinVisibleFraction = 0.0015f;
+
+	/* Voxelize the blocking collision once per build, traces that only pass empty voxels skip the physics scene. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Occupancy")
+	bool bUseOccupancyVolume = false;
+
+	/* Edge length of an occupancy voxel, smaller voxels resolve more rays but take longer to build. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Occupancy", meta=(ClampMin=1, Units="cm", EditCondition="bUseOccupancyVolume"))
+	float OccupancyVoxelSize = 100.f;
+
+	/* Copy the blocking static mesh collision into a BVH once per build, or per batch in streamed builds, and trace against
+	 * that instead of the physics scene. Only covers what is loaded when the snapshot is taken, shapes it can't copy like
+	 * landscapes still go to the physics scene. */
+	UPROPERTY(Config, EditDefaultsOnly, Category="Builder|Occupancy")
+	bool bUseCollisionSnapshot = false;
 };
@@ -6,8 +6,10 @@
 #include "Editor.h"
 #include "PrecomputedVisibilityGrid.h"
 #include "PrimitiveSceneInfo.h"
+#include "PVGBoxDecomposition.h"
 #include "PVGBuilder.h"
 #include "PVGCulling.h"
+#include "PVGDeveloperSettings.h"
 #include "PVGInterface.h"
 #include "PVGPrecomputedGridDataAsset.h"
 #include "Selection.h"
@@ -17,6 +19,13 @@
 
 APVGManager* APVGManager::Manager = nullptr;
 
+struct FPVGOcclusionSceneScratch
+{
+	FPVGBitVolume Cells;
+	FPVGBitVolume Covered;
+	TArray<FPVGCellBox> Boxes;
+};
+
 TAutoConsoleVariable<int32> CVarPVGManagerEnabled(
 	TEXT("r.PVG.Enable"),
 	0,
@@ -288,6 +297,14 @@ void APVGManager::DrawDebugHUDInfo()
 			ToPrint.Add(FString("Num Multi cell Actors in cell: ") + FString::FromInt(NumMultiActorsInCell));
 		}
 
+		if (GridDataAsset && GridDataAsset->HasStreamedSectors())
+		{
+			const FPVGSectorCacheStats& Stats = GridDataAsset->GetSectorCacheStats();
+			ToPrint.Add(FString::Printf(TEXT("Resident sectors: %.1f KB"),GridDataAsset->GetResidentSectorBytes() / 1024.f));
+			ToPrint.Add(FString::Printf(TEXT("Sector cache: %lld hits, %lld misses, %lld prefetch requests, %lld blocking loads, %lld evictions"),
+				Stats.Hits,Stats.Misses,Stats.PrefetchRequests,Stats.BlockingLoads,Stats.Evictions));
+		}
+
 		// Check if we have something selected
 #if WITH_EDITOR
 		if (GEditor )
@@ -411,7 +428,11 @@ void APVGManager::Tick(float DeltaTime)
 
 	const int32 PlayerGridIndex = GetPlayerGridIndex();
 
-	if (CurrentIndex != PlayerGridIndex)
+	// Streamed grids keep the sectors around the player loaded, a new cell is only entered once its data is resident so
+	// the game thread never waits on a load.
+	GridDataAsset->StreamSectorsAround(PlayerGridIndex);
+
+	if (CurrentIndex != PlayerGridIndex && GridDataAsset->IsCellDataResident(PlayerGridIndex))
 	{
 		CurrentIndex = PlayerGridIndex;
 		UpdateCellsVisibility(CurrentIndex);
@@ -431,10 +452,9 @@ void APVGManager::Tick(float DeltaTime)
 				// Draw current celt.
 				const FVector CurrentCellLocation = IndexToLocation(CurrentIndex);
 
-				TArray<uint16> CurrentCellData = GridDataAsset->GetCellData(CurrentIndex);
-				for (int32 i = 0; i < CurrentCellData.Num(); i++)
+				GridDataAsset->ForEachHiddenCell(CurrentIndex,[&](int32 HiddenCell)
 				{
-					FVector CellLocation = IndexToLocation(CurrentCellData[i]);
+					FVector CellLocation = IndexToLocation(HiddenCell);
 					FColor DebugColor = FColor::Red;
 					
 					if (GPVGIgnoreDistanceOnLowerCells > 0)
@@ -464,8 +484,7 @@ void APVGManager::Tick(float DeltaTime)
 					
 					DrawDebugBox(GetWorld(),CellLocation,CellSize.GetExtent(),DebugColor,false,-1,255);
 					DrawDebugPoint(GetWorld(),CellLocation,5.f,DebugColor,false,-1,255);
-
-				}
+				});
 
 				DrawDebugBox(GetWorld(),CurrentCellLocation,CellSize.GetExtent(),FColor::Green,false,-1,255);
 			}
@@ -489,15 +508,35 @@ void APVGManager::UpdateCellsVisibility(int32 PlayerCellLocation)
 		return;
 	}
 
-	const TArray<uint16> Region = GridDataAsset->GetCellData(PlayerCellLocation);
+	// Walking into a neighbour only applies what changed between the two cells.
+	const int32 PreviousRegionCell = RegionCell;
+	RegionCell = PlayerCellLocation;
+	if (PreviousRegionCell != INDEX_NONE && GridDataAsset->ForEachTransitionChange(PreviousRegionCell,PlayerCellLocation,[this](int32 Cell, bool bHide)
+		{
+			if (!bHide)
+			{
+				CellsToUnHide.Add(Cell);
+				HiddenCells.Remove(Cell);
+			}
+			else if (!HiddenCells.Contains(Cell))
+			{
+				CellsToHide.Add(Cell);
+			}
+		}))
+	{
+		return;
+	}
+
+	// Teleports and jumps over more than one cell decode the whole set once, into a bit buffer that lives as long as the
+	// manager so it doesn't allocate once it has grown. The bits answer membership and dedupe both lists.
+	GridDataAsset->GetCellDataBits(PlayerCellLocation,RegionBits);
 	
-	// Remove hidden cells.
-	for (int32 i = 0; i < HiddenCells.Num(); i++)
+	// Remove hidden cells, the hidden set holds every cell once.
+	for (const int32 ID : HiddenCells)
 	{
-		const uint16 ID = HiddenCells[i];
-		if(!Region.Contains(ID))
+		if(!RegionBits[ID])
 		{
-			CellsToUnHide.AddUnique(ID);
+			CellsToUnHide.Add(ID);
 		}
 	}
 
@@ -508,55 +547,18 @@ void APVGManager::UpdateCellsVisibility(int32 PlayerCellLocation)
 	{
 		HiddenCells.Remove(CellsToUnHide[i]);
 	}
-
-	HiddenCells.Shrink();
 	
-	// Find cells to hide.
-	for (int32 i = 0; i < Region.Num(); i++)
+	// Find cells to hide, every set bit is a distinct cell.
+	for (TConstSetBitIterator<> It(RegionBits); It; ++It)
 	{
-		const uint16 CellToHide = Region[i];
-		const FVector CurrentCell = IndexToLocation(CellToHide);
-
-		// distance check.
-		bool bShouldHide = true;
-
-#if 0
-		if (GPVGIgnoreDistanceOnLowerCells > 2)
+		const int32 CellToHide = It.GetIndex();
+		if (!HiddenCells.Contains(CellToHide))
 		{
-			if ( CurrentCell.Z < CurrentCellLocation.Z)
-			{
-				bShouldHide = true;
-			}
-		}
-		
-		if (!bShouldHide)
-		{
-			float Distance = FVector::Distance(CurrentCell,CurrentCellLocation);
-			if ( GPVGIgnoreDistanceOnLowerCells < 2 && GPVGIgnoreDistanceOnLowerCells != 0)
-			{
-				if (GPVGIgnoreDistanceOnLowerCells == 1 && Distance > GPVGMinDistanceForCulling * 0.5)
-				{
-					bShouldHide = true;
-				}
-				else if (GPVGIgnoreDistanceOnLowerCells == 2 && Distance > GPVGMinDistanceForCulling * 0.25)
-				{
-					bShouldHide = true;
-				}
-			}
-
-			// Didn't we figure it out yet and we are out of the min distance? hide it!
-			if (!bShouldHide && Distance > GPVGMinDistanceForCulling)
-			{
-				bShouldHide = true;
-			}
-		}
-#endif
-		
-		if (bShouldHide && !HiddenCells.Contains(CellToHide))
-		{
-			CellsToHide.AddUnique(CellToHide);
+			CellsToHide.Add(CellToHide);
 		}
 	}
+
+	CheckForDupes(CellsToHide);
 }
 
 void APVGManager::UpdateCells()
@@ -568,7 +570,7 @@ void APVGManager::UpdateCells()
 		UpdateCellVisibility(Entry,false);
 	}
 	
-	CellsToUnHide.Empty();
+	CellsToUnHide.Reset();
 	
 	// To Hide.
 	for (int32 i = 0; i < CellsToHide.Num(); i++)
@@ -579,157 +581,46 @@ void APVGManager::UpdateCells()
 		HiddenCells.Add(Entry);
 	}
 
-	CellsToHide.Empty();
+	CellsToHide.Reset();
 }
 
 void APVGManager::UpdateOcclusionScene()
 {
 	const UPVGPrecomputedGridDataAsset* Asset = GridDataAsset;
-	const uint16 MaxX  = Asset->GetGridSizeX();
-	const uint16 MaxY = Asset->GetGridSizeY();
-	const FBox SourceBox = Asset->GetCellBox();
-	TSet<uint16> Processed;
-
-	int32 CurrentBox = 0;
-	TArray<FBox> Boxes;
 	
-	constexpr bool MinimalMemoryOptimization = false;
-
-	// Build biggest boxes.
-	while ( CurrentBox <  HiddenCells.Num())
+	if (!OcclusionSceneScratch.IsValid())
 	{
-		bool bCanGrowX = true;
-		bool bCanGrowY = true;
-		bool bCanGrowZ = true;
-		
-		uint16 X = 0;
-		uint16 Y = 0;
-		uint16 Z = 0;
-
-		const uint16 Origin = HiddenCells[CurrentBox];
-
-		// Add origin.
-		TSet<uint16> Entries;
-		Entries.Add(Origin);
-		
-		while (bCanGrowX || bCanGrowY || bCanGrowZ)
-		{
-			if (bCanGrowX)
-			{
-				TSet<uint16> TempEntriesX;
-				
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,MaxX,MaxY) + FIntVector(1,0,0);
-					const uint16 TestLocation = XYZToIndex(Loc.X,Loc.Y,Loc.Z);
-
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (HiddenCells.Contains(TestLocation) && (MinimalMemoryOptimization || !Processed.Contains(TestLocation)))
-					{
-						TempEntriesX.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowX = false;
-						break;
-					}
-				}
-				
-				if (bCanGrowX)
-				{
-					X++;
-					Entries.Append(TempEntriesX);
-				}
-			}
-			
-			if (bCanGrowY)
-			{
-				TSet<uint16> TempEntriesY;
-
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,MaxX,MaxY) + FIntVector(0,1,0);
-					const uint16 TestLocation = XYZToIndex(Loc.X,Loc.Y,Loc.Z);
-
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (HiddenCells.Contains(TestLocation) && (MinimalMemoryOptimization || !Processed.Contains(TestLocation)))
-					{
-						TempEntriesY.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowY = false;
-						break;
-					}
-				}
-
-				if (bCanGrowY)
-				{
-					Entries.Append(TempEntriesY);
-					Y++;
-				}
-			}
-			
-			if (bCanGrowZ)
-			{
-				TSet<uint16> TempEntriesZ;
-
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,MaxX, MaxY) + FIntVector(0,0,1);
-					const uint16 TestLocation = XYZToIndex(Loc.X,Loc.Y,Loc.Z);
-
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (HiddenCells.Contains(TestLocation) && (MinimalMemoryOptimization || !Processed.Contains(TestLocation)))
-					{
-						TempEntriesZ.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowZ = false;
-						break;
-					}
-				}
+		OcclusionSceneScratch = MakeShared<FPVGOcclusionSceneScratch>();
+	}
+	
+	FPVGBitVolume& Cells = OcclusionSceneScratch->Cells;
+	const FIntVector GridSize(Asset->GetGridSizeX(),Asset->GetGridSizeY(),Asset->GetGridSizeZ());
+	if (Cells.GetSize() == GridSize)
+	{
+		Cells.Reset();
+	}
+	else
+	{
+		Cells.Init(GridSize);
+	}
+	
+	for (const int32 Cell : HiddenCells)
+	{
+		Cells.Set(Cell);
+	}
 
-				if (bCanGrowZ)
-				{
-					Entries.Append(TempEntriesZ);
-					Z++;
-				}
-			}
-		}
-		
-		Processed.Append(Entries);
+	// Build biggest boxes, without overlap.
+	TArray<FPVGCellBox>& Boxes = OcclusionSceneScratch->Boxes;
+	FPVGBoxDecomposition::Decompose(Cells,UPVGDeveloperSettings::GetBoxPacking(),false,OcclusionSceneScratch->Covered,Boxes);
 
-		{	// Build box.
-			FBox Base = Asset->GetCellBox();
-			
-			Base = Base.MoveTo(IndexToLocation(Origin));
-			Base += Asset->GetCellBox().MoveTo(IndexToLocation(Origin) + (FVector(X,Y,Z) * Asset->GetCellBox().GetSize()) );
-			Base = Base.ExpandBy(FVector(10.f)); // minor expand.
-			Boxes.Add(Base);
-		}
-		// Skip cells we have processed already.
-		CurrentBox++;
-		while ( CurrentBox < HiddenCells.Num() && Processed.Contains(HiddenCells[CurrentBox]))
-		{
-			CurrentBox++;
-		}
+	OcclusionScene.Reset(Boxes.Num());
+	for (const FPVGCellBox& Box : Boxes)
+	{
+		FBox Base = Asset->GetCellBox().MoveTo(IndexToLocation(Box.Min.X,Box.Min.Y,Box.Min.Z));
+		Base += Asset->GetCellBox().MoveTo(IndexToLocation(Box.Max.X,Box.Max.Y,Box.Max.Z));
+		Base = Base.ExpandBy(FVector(10.f)); // minor expand.
+		OcclusionScene.Add(Base);
 	}
-
-	OcclusionScene = Boxes;
 }
 
 void APVGManager::UpdateCellVisibility(int32 Cell, bool bHide)
@@ -804,10 +695,10 @@ int32 APVGManager::GetIndexFromLocation(const FVector& Location) const
 
 FVector APVGManager::IndexToLocation(int32 Index) const
 {
-	uint16 z = Index / (GridDataAsset->GetGridSizeX() * GridDataAsset->GetGridSizeY());
+	int32 z = Index / (GridDataAsset->GetGridSizeX() * GridDataAsset->GetGridSizeY());
 	Index -= (z * GridDataAsset->GetGridSizeX() * GridDataAsset->GetGridSizeY());
-	uint16 y = Index / GridDataAsset->GetGridSizeX();
-	uint16 x = Index % GridDataAsset->GetGridSizeX();
+	int32 y = Index / GridDataAsset->GetGridSizeX();
+	int32 x = Index % GridDataAsset->GetGridSizeX();
 
 	
 	FVector LocalLocation = FVector(x, y, z) * CellSize.GetSize() + (CellSize.GetSize() / 2);
@@ -828,6 +719,18 @@ int32 APVGManager::XYZToIndex(int32 x, int32 y, int32 z) const
 
 #if WITH_EDITOR
 APVGBuilder* APVGManager::StartBuild()
+{
+	return StartBuildWithOptions(FPVGBuildOptions());
+}
+
+APVGBuilder* APVGManager::StartIncrementalBuild()
+{
+	FPVGBuildOptions Options;
+	Options.bIncremental = true;
+	return StartBuildWithOptions(Options);
+}
+
+APVGBuilder* APVGManager::StartBuildWithOptions(const FPVGBuildOptions& Options)
 {
 	Manager = this;
 	
@@ -859,7 +762,7 @@ APVGBuilder* APVGManager::StartBuild()
 	UE_LOG(LogTemp,Warning,TEXT("GridBounds %s"),*GridBounds.ToString());
 
 	APVGBuilder* Builder = GetWorld()->SpawnActor<APVGBuilder>();
-	Builder->Initialize(Locations,FIntVector(SizeX,SizeY,SizeZ));
+	Builder->Initialize(Locations,FIntVector(SizeX,SizeY,SizeZ),Options);
 
 	return Builder;
 }
@@ -0,0 +1,212 @@
+#include "PVGMergeCommandlet.h"
+
+#include "PVGBuildFile.h"
+#include "PVGBuilderCommandlet.h"
+#include "PVGManager.h"
+#include "PVGPrecomputedGridDataAsset.h"
+#include "AssetRegistry/AssetRegistryModule.h"
+#include "EditorWorldUtils.h"
+#include "EngineUtils.h"
+#include "HAL/FileManager.h"
+#include "UObject/SavePackage.h"
+
+/* Point the manager of the map the shards were built from at the merged asset and save the manager's package. */
+static bool LinkToManager(const FString& WorldPackage, UPVGPrecomputedGridDataAsset* Asset)
+{
+	UWorld* World = UPVGPrecomputedGridBuilder::LoadWorld(WorldPackage);
+	if (!World)
+	{
+		return false;
+	}
+
+	// The manager is always loaded, initializing the world is enough to find it in partitioned worlds.
+	TUniquePtr<FScopedEditorWorld> EditorWorld;
+	if (!World->bIsWorldInitialized)
+	{
+		UWorld::InitializationValues IVS;
+		IVS.RequiresHitProxies(false);
+		IVS.ShouldSimulatePhysics(false);
+		IVS.EnableTraceCollision(false);
+		IVS.CreateNavigation(false);
+		IVS.CreateAISystem(false);
+		IVS.AllowAudioPlayback(false);
+		IVS.CreatePhysicsScene(false);
+		IVS.CreateWorldPartition(true);
+		EditorWorld = MakeUnique<FScopedEditorWorld>(World, IVS);
+	}
+
+	APVGManager* Manager = nullptr;
+	for (TActorIterator<APVGManager> It(World); It; ++It)
+	{
+		Manager = *It;
+		break;
+	}
+	
+	if (!Manager)
+	{
+		UE_LOG(LogTemp, Error, TEXT("No PVGManager in '%s' to assign the merged asset to."), *WorldPackage);
+		return false;
+	}
+
+	if (Manager->GridDataAsset == Asset)
+	{
+		return true;
+	}
+
+	Manager->Modify();
+	Manager->GridDataAsset = Asset;
+
+	// External actors save into their own package, the map otherwise.
+	UPackage* Package = Manager->GetPackage();
+	const FString PackageName = Package->GetName();
+	const FString PackageFileName = FPackageName::LongPackageNameToFilename(PackageName,
+		Package->ContainsMap() ? FPackageName::GetMapPackageExtension() : FPackageName::GetAssetPackageExtension());
+
+	FSavePackageArgs SaveArgs;
+	SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+	SaveArgs.SaveFlags = SAVE_NoError;
+	
+	if (!UPackage::SavePackage(Package, nullptr, *PackageFileName, SaveArgs))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Package '%s' of the manager wasn't saved!"), *PackageName);
+		return false;
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Assigned '%s' to '%s'"), *Asset->GetPathName(), *Manager->GetPathName());
+	return true;
+}
+
+UPVGMergeCommandlet::UPVGMergeCommandlet(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+{}
+
+int32 UPVGMergeCommandlet::Main(const FString& Params)
+{
+	TArray<FString> Tokens, Switches;
+	ParseCommandLine(*Params, Tokens, Switches);
+
+	FString AssetFilter;
+	FParse::Value(*Params, TEXT("Asset="), AssetFilter);
+
+	if (Tokens.Num() == 0)
+	{
+		Tokens.Add(FPVGBuildFile::GetDirectory());
+	}
+
+	// Gather partial files.
+	TArray<FString> Files;
+	for (const FString& Token : Tokens)
+	{
+		if (IFileManager::Get().DirectoryExists(*Token))
+		{
+			TArray<FString> Found;
+			IFileManager::Get().FindFiles(Found, *(Token / TEXT("*.pvgpart")), true, false);
+			for (const FString& File : Found)
+			{
+				Files.Add(Token / File);
+			}
+		}
+		else
+		{
+			Files.Add(Token);
+		}
+	}
+
+	FPVGBuildFileHeader MergedHeader;
+	FPVGPairMatrix MergedMatrix;
+	TBitArray<> FoundShards;
+	
+	for (const FString& File : Files)
+	{
+		FPVGBuildFileHeader Header;
+		FPVGPairMatrix Part;
+		if (!FPVGBuildFile::Read(File, Header, Part))
+		{
+			return 1;
+		}
+
+		if (!AssetFilter.IsEmpty() && !Header.AssetPath.StartsWith(AssetFilter))
+		{
+			continue;
+		}
+
+		// Shards never use adaptive cells, their matrix covers every grid cell.
+		const int64 NumGridCells = int64(Header.GridSize.X) * Header.GridSize.Y * Header.GridSize.Z;
+		if (Part.GetNumCells() != NumGridCells || (MergedMatrix.GetNumCells() != 0 && Part.GetNumCells() != MergedMatrix.GetNumCells()))
+		{
+			UE_LOG(LogTemp, Error, TEXT("'%s' holds %d cells, its grid has %lld."), *File, Part.GetNumCells(), NumGridCells);
+			return 1;
+		}
+
+		if (MergedMatrix.GetNumCells() == 0)
+		{
+			MergedHeader = Header;
+			MergedMatrix.Init(Part.GetNumCells());
+			FoundShards.Init(false, Header.NumShards);
+		}
+		else if (Header.GridSignature != MergedHeader.GridSignature || Header.NumShards != MergedHeader.NumShards || Header.AssetPath != MergedHeader.AssetPath)
+		{
+			UE_LOG(LogTemp, Error, TEXT("'%s' belongs to a different build (%s %d shards), use -Asset= to pick one."), *File, *Header.AssetPath, Header.NumShards);
+			return 1;
+		}
+
+		if (!FoundShards.IsValidIndex(Header.ShardIndex) || FoundShards[Header.ShardIndex])
+		{
+			UE_LOG(LogTemp, Error, TEXT("'%s' has invalid or duplicate shard %d."), *File, Header.ShardIndex);
+			return 1;
+		}
+		
+		FoundShards[Header.ShardIndex] = true;
+		MergedMatrix.Merge(Part);
+		UE_LOG(LogTemp, Display, TEXT("Merged shard %d/%d from '%s'"), Header.ShardIndex, Header.NumShards, *File);
+	}
+
+	if (MergedMatrix.GetNumCells() == 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("No partial files found."));
+		return 1;
+	}
+	
+	const int32 MissingShard = FoundShards.Find(false);
+	if (MissingShard != INDEX_NONE)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Shard %d/%d is missing."), MissingShard, MergedHeader.NumShards);
+		return 1;
+	}
+
+	// Load or create the asset.
+	UPVGPrecomputedGridDataAsset* Asset = LoadObject<UPVGPrecomputedGridDataAsset>(nullptr, *MergedHeader.AssetPath);
+	if (!Asset)
+	{
+		UPackage* Package = CreatePackage(*FPackageName::ObjectPathToPackageName(MergedHeader.AssetPath));
+		Asset = NewObject<UPVGPrecomputedGridDataAsset>(Package, UPVGPrecomputedGridDataAsset::StaticClass(), *FPackageName::ObjectPathToObjectName(MergedHeader.AssetPath), EObjectFlags::RF_Public | EObjectFlags::RF_Standalone);
+		FAssetRegistryModule::AssetCreated(Asset);
+	}
+
+	Asset->InitializeGrid(MergedHeader.GridSize, MergedHeader.CellExtents, MergedHeader.GridBounds);
+	if (Asset->GetGridSignature() != MergedHeader.GridSignature)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Grid signature mismatch for '%s'."), *MergedHeader.AssetPath);
+		return 1;
+	}
+	
+	Asset->GetPairMatrix().Merge(MergedMatrix);
+
+	// Save package, the cube compression runs in PreSave.
+	UPackage* Package = Asset->GetPackage();
+	const FString PackageName = Package->GetName();
+	const FString PackageFileName = FPackageName::LongPackageNameToFilename(PackageName, FPackageName::GetAssetPackageExtension());
+
+	FSavePackageArgs SaveArgs;
+	SaveArgs.TopLevelFlags = RF_Public | RF_Standalone;
+	SaveArgs.SaveFlags = SAVE_NoError;
+	
+	if (!UPackage::SavePackage(Package, nullptr, *PackageFileName, SaveArgs))
+	{
+		UE_LOG(LogTemp, Error, TEXT("Package '%s' wasn't saved!"), *PackageName);
+		return 1;
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Merged %d shards into '%s'"), MergedHeader.NumShards, *PackageName);
+	
+	return LinkToManager(MergedHeader.WorldPackage, Asset) ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "Commandlets/Commandlet.h"
+#include "PVGMergeCommandlet.generated.h"
+
+/*
+ * Combines the partial files written by "-run=PVGBuilder -Shard=i/N" into the grid data asset.
+ * Usage: -run=PVGMerge [Directory or files] [-Asset=/Game/PrecomputedCulling/PVGGrid_...]
+ */
+UCLASS()
+class UPVGMergeCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,270 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGOccupancyVolume.h"
+
+#include "PrecomputedVisibilityGrid.h"
+#include "Async/ParallelFor.h"
+#include "Engine/World.h"
+#include <atomic>
+
+void FPVGOccupancyVolume::Build(UWorld* World, const FBox& InBounds, float InVoxelSize, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	
+	VoxelSize = FMath::Max(InVoxelSize,1.f);
+	InvVoxelSize = 1.f / VoxelSize;
+	NumVoxels = FIntVector(
+		FMath::Max(1,FMath::CeilToInt(InBounds.GetSize().X * InvVoxelSize)),
+		FMath::Max(1,FMath::CeilToInt(InBounds.GetSize().Y * InvVoxelSize)),
+		FMath::Max(1,FMath::CeilToInt(InBounds.GetSize().Z * InvVoxelSize)));
+	Bounds = FBox(InBounds.Min,InBounds.Min + FVector(NumVoxels) * VoxelSize);
+
+	const int64 NumWords = FMath::DivideAndRoundUp<int64>(int64(NumVoxels.X) * NumVoxels.Y * NumVoxels.Z,64);
+	TouchedBits.Empty();
+	TouchedBits.SetNumZeroed(NumWords);
+
+	constexpr int32 BrickSize = 8;
+	const FIntVector NumBricks(
+		FMath::DivideAndRoundUp(NumVoxels.X,BrickSize),
+		FMath::DivideAndRoundUp(NumVoxels.Y,BrickSize),
+		FMath::DivideAndRoundUp(NumVoxels.Z,BrickSize));
+
+	const FVector Margin(FMath::Max(1.f,VoxelSize * 0.01f));
+	auto GetVoxelRangeBox = [&](const FIntVector& Min, const FIntVector& Max)
+	{
+		return FBox(Bounds.Min + FVector(Min) * VoxelSize,Bounds.Min + FVector(Max) * VoxelSize).ExpandBy(Margin);
+	};
+
+	auto SetBit = [](TArray64<uint64>& Bits, int64 Index)
+	{
+		// Bricks share words along X.
+		FPlatformAtomics::InterlockedOr((volatile int64*)(Bits.GetData() + (Index >> 6)),int64(uint64(1) << (Index & 63)));
+	};
+
+	std::atomic<int64> NumSolid = 0;
+	std::atomic<int64> NumTouched = 0;
+	
+	ParallelFor(NumBricks.X * NumBricks.Y * NumBricks.Z,[&](int32 Brick)
+	{
+		const FIntVector BrickMin = FIntVector(Brick % NumBricks.X,(Brick / NumBricks.X) % NumBricks.Y,Brick / (NumBricks.X * NumBricks.Y)) * BrickSize;
+		const FIntVector BrickMax(FMath::Min(BrickMin.X + BrickSize,NumVoxels.X),FMath::Min(BrickMin.Y + BrickSize,NumVoxels.Y),FMath::Min(BrickMin.Z + BrickSize,NumVoxels.Z));
+
+		const EPVGOccupancy BrickOccupancy = ClassifyBox(World,GetVoxelRangeBox(BrickMin,BrickMax),QueryParams,ResponseParams);
+		if (BrickOccupancy == EPVGOccupancy::Empty)
+		{
+			return;
+		}
+
+		int64 Solid = 0;
+		int64 Touched = 0;
+		for (int32 z = BrickMin.Z; z < BrickMax.Z; z++)
+		{
+			for (int32 y = BrickMin.Y; y < BrickMax.Y; y++)
+			{
+				for (int32 x = BrickMin.X; x < BrickMax.X; x++)
+				{
+					const FIntVector Voxel(x,y,z);
+					const EPVGOccupancy Occupancy = BrickOccupancy == EPVGOccupancy::Solid ? EPVGOccupancy::Solid :
+						ClassifyBox(World,GetVoxelRangeBox(Voxel,Voxel + FIntVector(1)),QueryParams,ResponseParams);
+
+					const int64 Index = GetVoxelIndex(x,y,z);
+					if (Occupancy != EPVGOccupancy::Empty)
+					{
+						SetBit(TouchedBits,Index);
+						Touched++;
+					}
+					if (Occupancy == EPVGOccupancy::Solid)
+					{
+						Solid++;
+					}
+				}
+			}
+		}
+		NumSolid += Solid;
+		NumTouched += Touched;
+	},EParallelForFlags::Unbalanced);
+
+	UE_LOG(LogTemp,Warning,TEXT("Occupancy volume %dx%dx%d (%.1f MB): %lld surface voxels, %lld solid, built in %.2f sec."),
+		NumVoxels.X,NumVoxels.Y,NumVoxels.Z,
+		GetAllocatedSize() / (1024.f * 1024.f),
+		NumTouched.load() - NumSolid.load(),NumSolid.load(),
+		FPlatformTime::Seconds() - StartTime);
+}
+
+void FPVGOccupancyVolume::Empty()
+{
+	NumVoxels = FIntVector::ZeroValue;
+	TouchedBits.Empty();
+}
+
+EPVGOccupancy FPVGOccupancyVolume::ClassifyBox(UWorld* World, const FBox& Box, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams)
+{
+	if (!World->OverlapBlockingTestByChannel(Box.GetCenter(),FQuat::Identity,ECC_Visibility,FCollisionShape::MakeBox(Box.GetExtent()),QueryParams,ResponseParams))
+	{
+		return EPVGOccupancy::Empty;
+	}
+
+	FVector Corners[8];
+	Box.GetVertices(Corners);
+
+	for (int32 i = 0; i < 8; i++)
+	{
+		if (!World->OverlapBlockingTestByChannel(Corners[i],FQuat::Identity,ECC_Visibility,FCollisionShape::MakeSphere(1.f),QueryParams,ResponseParams))
+		{
+			return EPVGOccupancy::Partial;
+		}
+	}
+
+	// Any surface between two corners means the box isn't fully inside, trace both ways to catch single sided geometry.
+	for (int32 i = 0; i < 8; i++)
+	{
+		for (int32 j = i + 1; j < 8; j++)
+		{
+			if (World->LineTraceTestByChannel(Corners[i],Corners[j],ECC_Visibility,QueryParams,ResponseParams) ||
+				World->LineTraceTestByChannel(Corners[j],Corners[i],ECC_Visibility,QueryParams,ResponseParams))
+			{
+				return EPVGOccupancy::Partial;
+			}
+		}
+	}
+
+	return EPVGOccupancy::Solid;
+}
+
+void FPVGOccupancyVolume::ClassifyCells(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize,
+	const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, TArray<EPVGOccupancy>& OutOccupancy)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	
+	OutOccupancy.SetNumUninitialized(GridSize.X * GridSize.Y * GridSize.Z);
+	ParallelFor(OutOccupancy.Num(),[&](int32 Cell)
+	{
+		const FVector Min = GridOrigin + FVector(IndexTo3D(Cell,GridSize.X,GridSize.Y)) * CellSize;
+		OutOccupancy[Cell] = ClassifyBox(World,FBox(Min,Min + CellSize),QueryParams,ResponseParams);
+	},EParallelForFlags::Unbalanced);
+
+	int32 NumSolid = 0;
+	int32 NumEmpty = 0;
+	for (const EPVGOccupancy Occupancy : OutOccupancy)
+	{
+		NumSolid += Occupancy == EPVGOccupancy::Solid;
+		NumEmpty += Occupancy == EPVGOccupancy::Empty;
+	}
+	
+	UE_LOG(LogTemp,Warning,TEXT("Classified %d cells: %d empty, %d partial, %d solid in %.2f sec."),
+		OutOccupancy.Num(),NumEmpty,OutOccupancy.Num() - NumEmpty - NumSolid,NumSolid,FPlatformTime::Seconds() - StartTime);
+}
+
+bool FPVGOccupancyVolume::SetupRay(const FVector& Start, const FVector& End, FDDARay& OutRay) const
+{
+	if (!Bounds.IsInsideOrOn(Start) || !Bounds.IsInsideOrOn(End))
+	{
+		return false;
+	}
+	
+	const FVector A = (Start - Bounds.Min) * InvVoxelSize;
+	const FVector Direction = (End - Start) * InvVoxelSize;
+
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		const int32 Voxel = FMath::Clamp(FMath::FloorToInt(A[Axis]),0,NumVoxels[Axis] - 1);
+		OutRay.Voxel[Axis] = Voxel;
+		
+		if (Direction[Axis] > UE_SMALL_NUMBER)
+		{
+			OutRay.Step[Axis] = 1;
+			OutRay.TDelta[Axis] = 1.f / Direction[Axis];
+			OutRay.TMax[Axis] = (Voxel + 1 - A[Axis]) * OutRay.TDelta[Axis];
+		}
+		else if (Direction[Axis] < -UE_SMALL_NUMBER)
+		{
+			OutRay.Step[Axis] = -1;
+			OutRay.TDelta[Axis] = -1.f / Direction[Axis];
+			OutRay.TMax[Axis] = (A[Axis] - Voxel) * OutRay.TDelta[Axis];
+		}
+		else
+		{
+			OutRay.Step[Axis] = 0;
+			OutRay.TDelta[Axis] = UE_BIG_NUMBER;
+			OutRay.TMax[Axis] = UE_BIG_NUMBER;
+		}
+	}
+
+	return true;
+}
+
+bool FPVGOccupancyVolume::StepRay(FDDARay& Ray, EPVGRayResult& OutResult) const
+{
+	// Any voxel with collision sends the ray to the physics scene, the overlaps only see simple collision.
+	if (TestBit(TouchedBits,GetVoxelIndex(Ray.Voxel.X,Ray.Voxel.Y,Ray.Voxel.Z)))
+	{
+		OutResult = EPVGRayResult::Unknown;
+		return true;
+	}
+
+	// Advance along the axis with the nearest voxel border.
+	const int32 Axis = Ray.TMax.X < Ray.TMax.Y ? (Ray.TMax.X < Ray.TMax.Z ? 0 : 2) : (Ray.TMax.Y < Ray.TMax.Z ? 1 : 2);
+	if (Ray.TMax[Axis] > 1.f)
+	{
+		// Reached the end point.
+		OutResult = EPVGRayResult::Clear;
+		return true;
+	}
+
+	Ray.Voxel[Axis] += Ray.Step[Axis];
+	Ray.TMax[Axis] += Ray.TDelta[Axis];
+
+	if (Ray.Voxel[Axis] < 0 || Ray.Voxel[Axis] >= NumVoxels[Axis])
+	{
+		OutResult = EPVGRayResult::Clear;
+		return true;
+	}
+	return false;
+}
+
+EPVGRayResult FPVGOccupancyVolume::TraceRay(const FVector& Start, const FVector& End) const
+{
+	FDDARay Ray;
+	if (!SetupRay(Start,End,Ray))
+	{
+		return EPVGRayResult::Unknown;
+	}
+
+	EPVGRayResult Result;
+	while (!StepRay(Ray,Result))
+	{
+	}
+	return Result;
+}
+
+void FPVGOccupancyVolume::TraceRays8(const FVector* Starts, const FVector* Ends, EPVGRayResult* OutResults) const
+{
+	constexpr int32 NumLanes = 8;
+	FDDARay Rays[NumLanes];
+	uint32 ActiveMask = 0;
+	
+	for (int32 Lane = 0; Lane < NumLanes; Lane++)
+	{
+		if (SetupRay(Starts[Lane],Ends[Lane],Rays[Lane]))
+		{
+			ActiveMask |= 1 << Lane;
+		}
+		else
+		{
+			OutResults[Lane] = EPVGRayResult::Unknown;
+		}
+	}
+
+	// Step all lanes in lock step, the voxel loads of the different rays are independent and can be in flight together.
+	while (ActiveMask)
+	{
+		for (int32 Lane = 0; Lane < NumLanes; Lane++)
+		{
+			if ((ActiveMask & (1 << Lane)) && StepRay(Rays[Lane],OutResults[Lane]))
+			{
+				ActiveMask &= ~(1 << Lane);
+			}
+		}
+	}
+}
@@ -0,0 +1,92 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+enum class EPVGOccupancy : uint8
+{
+	/* No blocking surface inside the box. */
+	Empty,
+	/* Blocking surface passes through the box. */
+	Partial,
+	/* Box is fully inside blocking geometry. */
+	Solid,
+};
+
+enum class EPVGRayResult : uint8
+{
+	/* Only passes voxels without any blocking surface, a trace can't hit anything. */
+	Clear,
+	/* Hits blocking geometry. Never reported by the occupancy volume, its solid voxels come from simple collision overlaps
+	 * that don't have to match the complex collision the builder traces against. */
+	Blocked,
+	/* Passes surface voxels, needs a real trace. */
+	Unknown,
+};
+
+/*
+ * Bit packed occupancy of the blocking collision, built once per build from physics queries.
+ * Builder rays march it with a 3D-DDA, only rays that pass surface or solid voxels need a physics trace.
+ */
+class FPVGOccupancyVolume
+{
+public:
+	/* Voxelize the blocking collision inside InBounds, classifies 8x8x8 bricks first and only descends into partial ones. */
+	void Build(UWorld* World, const FBox& InBounds, float InVoxelSize, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams);
+	
+	void Empty();
+
+	bool IsValid() const { return NumVoxels.X > 0; }
+
+	/* Classify a box against the blocking collision of the world.
+	 * Solid requires all corners to be inside collision and no surface between any two corners, geometry only
+	 * supporting complex collision never reports solid. */
+	static EPVGOccupancy ClassifyBox(UWorld* World, const FBox& Box, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams);
+
+	/* ClassifyBox for every cell of a grid, in cell index order. */
+	static void ClassifyCells(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize,
+		const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, TArray<EPVGOccupancy>& OutOccupancy);
+
+	/* Clear or Unknown, only rays that stay in empty voxels are answered. */
+	EPVGRayResult TraceRay(const FVector& Start, const FVector& End) const;
+
+	/* Same as TraceRay for 8 rays, the rays are stepped round robin so their voxel fetches overlap. */
+	void TraceRays8(const FVector* Starts, const FVector* Ends, EPVGRayResult* OutResults) const;
+
+	int64 GetAllocatedSize() const { return TouchedBits.GetAllocatedSize(); }
+
+private:
+	struct FDDARay
+	{
+		FIntVector Voxel;
+		FIntVector Step;
+		FVector TMax;
+		FVector TDelta;
+	};
+
+	/* Returns false when the segment leaves the volume. */
+	bool SetupRay(const FVector& Start, const FVector& End, FDDARay& OutRay) const;
+
+	/* Visit the current voxel and step to the next, returns true once the ray is resolved. */
+	bool StepRay(FDDARay& Ray, EPVGRayResult& OutResult) const;
+	
+	int64 GetVoxelIndex(int32 X, int32 Y, int32 Z) const
+	{
+		return (int64(Z) * NumVoxels.Y + Y) * NumVoxels.X + X;
+	}
+
+	static bool TestBit(const TArray64<uint64>& Bits, int64 Index)
+	{
+		return (Bits[Index >> 6] >> (Index & 63)) & 1;
+	}
+
+	FBox Bounds = FBox(ForceInit);
+	float VoxelSize = 0;
+	float InvVoxelSize = 0;
+	FIntVector NumVoxels = FIntVector::ZeroValue;
+
+	/* Voxels with any blocking surface or inside blocking geometry, grown slightly so surfaces on voxel borders mark both
+	 * neighbours. */
+	TArray64<uint64> TouchedBits;
+};
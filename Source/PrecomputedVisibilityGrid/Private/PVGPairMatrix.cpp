@@ -0,0 +1,222 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGPairMatrix.h"
+
+FPVGPairMatrix& FPVGPairMatrix::operator=(const FPVGPairMatrix& Other)
+{
+	if (this != &Other)
+	{
+		Empty();
+		NumCells = Other.NumCells;
+		bAllVisible = Other.bAllVisible;
+		Blocks.SetNumZeroed(Other.Blocks.Num());
+		for (int64 i = 0; i < Other.Blocks.Num(); i++)
+		{
+			if (Other.Blocks[i])
+			{
+				Blocks[i] = new FBlock(*Other.Blocks[i]);
+				NumAllocatedBlocks++;
+			}
+		}
+	}
+	return *this;
+}
+
+bool FPVGPairMatrix::Init(int32 InNumCells)
+{
+	Empty();
+	if (InNumCells < 0 || InNumCells > MaxCells)
+	{
+		UE_LOG(LogTemp,Error,TEXT("%d cells are more than the pair matrix supports (%d)."),InNumCells,MaxCells);
+		return false;
+	}
+	
+	NumCells = InNumCells;
+	const int32 NumRuns = FMath::DivideAndRoundUp(NumCells,BlockCells);
+	Blocks.SetNumZeroed(GetBlockIndex(0,NumRuns));
+	return true;
+}
+
+void FPVGPairMatrix::Empty()
+{
+	for (FBlock* Block : Blocks)
+	{
+		delete Block;
+	}
+	Blocks.Empty();
+	NumAllocatedBlocks = 0;
+	NumCells = 0;
+	bAllVisible = false;
+}
+
+FPVGPairMatrix::FBlock* FPVGPairMatrix::FindOrAddBlock(int32 RunA, int32 RunB)
+{
+	if (const FBlock* Block = FindBlock(RunA,RunB))
+	{
+		return const_cast<FBlock*>(Block);
+	}
+
+	// Unwritten pairs keep reading the same once the block exists.
+	FBlock* NewBlock = new FBlock;
+	for (int32 Word = 0; Word < BlockCells; Word++)
+	{
+		NewBlock->Words[Visible][Word] = bAllVisible ? GetValidMask(RunA,RunB,Word) : 0;
+		NewBlock->Words[Occluded][Word] = 0;
+	}
+
+	// Another worker may have added it meanwhile, theirs wins.
+	void** Slot = (void**)&Blocks[GetBlockIndex(RunA,RunB)];
+	if (FBlock* Existing = (FBlock*)FPlatformAtomics::InterlockedCompareExchangePointer(Slot,NewBlock,nullptr))
+	{
+		delete NewBlock;
+		return Existing;
+	}
+	NumAllocatedBlocks++;
+	return NewBlock;
+}
+
+void FPVGPairMatrix::Unresolve(int32 A, int32 B)
+{
+	checkSlow(A != B);
+	if (A > B)
+	{
+		Swap(A,B);
+	}
+
+	// Nothing to clear in a block that was never written, unless unwritten pairs read as visible.
+	if (!bAllVisible && !FindBlock(A >> BlockShift,B >> BlockShift))
+	{
+		return;
+	}
+
+	FBlock* Block = FindOrAddBlock(A >> BlockShift,B >> BlockShift);
+	const int64 Mask = ~int64(uint64(1) << (A & (BlockCells - 1)));
+	FPlatformAtomics::InterlockedAnd((volatile int64*)&Block->Words[Visible][B & (BlockCells - 1)], Mask);
+	FPlatformAtomics::InterlockedAnd((volatile int64*)&Block->Words[Occluded][B & (BlockCells - 1)], Mask);
+}
+
+void FPVGPairMatrix::SetAllVisible()
+{
+	for (FBlock*& Block : Blocks)
+	{
+		delete Block;
+		Block = nullptr;
+	}
+	NumAllocatedBlocks = 0;
+	bAllVisible = true;
+}
+
+int32 FPVGPairMatrix::CountVisible(int32 Cell) const
+{
+	int32 Count = 0;
+	ForEachVisible(Cell,[&Count](int32){ Count++; });
+	return Count;
+}
+
+int32 FPVGPairMatrix::CountOccluded(int32 Cell) const
+{
+	int32 Count = 0;
+	ForEachOccluded(Cell,[&Count](int32){ Count++; });
+	return Count;
+}
+
+void FPVGPairMatrix::Serialize(FArchive& Ar)
+{
+	int32 SerializedNumCells = NumCells;
+	Ar << SerializedNumCells;
+	Ar << bAllVisible;
+
+	// Checkpoints save while workers still add blocks, the count has to come from the same snapshot as the blocks.
+	TArray64<int64> Written;
+	if (!Ar.IsLoading())
+	{
+		for (int64 i = 0; i < Blocks.Num(); i++)
+		{
+			if (FPlatformAtomics::AtomicRead((volatile const int64*)&Blocks[i]))
+			{
+				Written.Add(i);
+			}
+		}
+	}
+	int64 NumWritten = Written.Num();
+	Ar << NumWritten;
+
+	if (Ar.IsLoading())
+	{
+		const bool bSerializedAllVisible = bAllVisible;
+		
+		// A broken or foreign file must not make us allocate a matrix it can't fill.
+		const int64 Remaining = Ar.TotalSize() - Ar.Tell();
+		const int64 BlockBytes = sizeof(int64) + sizeof(FBlock);
+		if (SerializedNumCells < 0 || SerializedNumCells > MaxCells || !Init(SerializedNumCells) ||
+			NumWritten < 0 || NumWritten > Blocks.Num() || (Ar.TotalSize() > 0 && NumWritten * BlockBytes > Remaining))
+		{
+			UE_LOG(LogTemp,Error,TEXT("Pair matrix of %d cells and %lld blocks doesn't match the %lld bytes of data left."),SerializedNumCells,NumWritten,Remaining);
+			Ar.SetError();
+			Empty();
+			return;
+		}
+		bAllVisible = bSerializedAllVisible;
+
+		for (int64 i = 0; i < NumWritten; i++)
+		{
+			int64 Index = 0;
+			Ar << Index;
+			if (Index < 0 || Index >= Blocks.Num() || Blocks[Index])
+			{
+				UE_LOG(LogTemp,Error,TEXT("Pair matrix block %lld is out of range or duplicate."),Index);
+				Ar.SetError();
+				Empty();
+				return;
+			}
+
+			Blocks[Index] = new FBlock;
+			NumAllocatedBlocks++;
+			Ar.Serialize(Blocks[Index]->Words,sizeof(FBlock));
+		}
+		return;
+	}
+
+	for (int64 Index : Written)
+	{
+		Ar << Index;
+		Ar.Serialize(Blocks[Index]->Words,sizeof(FBlock));
+	}
+}
+
+void FPVGPairMatrix::Merge(const FPVGPairMatrix& Other)
+{
+	check(NumCells == Other.NumCells);
+	ensureMsgf(!Other.bAllVisible,TEXT("Merging only adds written pairs, unwritten visible pairs of the other matrix get lost."));
+
+	for (int64 i = 0; i < Other.Blocks.Num(); i++)
+	{
+		const FBlock* OtherBlock = Other.Blocks[i];
+		if (!OtherBlock)
+		{
+			continue;
+		}
+
+		// Block index back to its runs, only the allocation needs them.
+		int32 RunB = int32((FMath::Sqrt(8.0 * double(i) + 1.0) - 1.0) * 0.5);
+		while (GetBlockIndex(0,RunB) > i)
+		{
+			RunB--;
+		}
+		while (GetBlockIndex(0,RunB + 1) <= i)
+		{
+			RunB++;
+		}
+		const int32 RunA = int32(i - GetBlockIndex(0,RunB));
+
+		FBlock* Block = FindOrAddBlock(RunA,RunB);
+		for (int32 Plane = 0; Plane < NumPlanes; Plane++)
+		{
+			for (int32 Word = 0; Word < BlockCells; Word++)
+			{
+				Block->Words[Plane][Word] |= OtherBlock->Words[Plane][Word];
+			}
+		}
+	}
+}
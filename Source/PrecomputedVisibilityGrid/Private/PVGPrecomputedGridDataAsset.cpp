@@ -3,12 +3,26 @@
 
 #include "PVGPrecomputedGridDataAsset.h"
 #include "PrecomputedVisibilityGrid.h"
+#include "PVGAdaptiveCells.h"
+#include "PVGBoxDecomposition.h"
+#include "PVGDeveloperSettings.h"
+#include "Algo/AllOf.h"
+#include "Algo/BinarySearch.h"
+#include "Algo/Count.h"
+#include "Algo/IsSorted.h"
+#include "Algo/Unique.h"
+#include "Async/ParallelFor.h"
+#include "Misc/Compression.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
 #include "UObject/ObjectSaveContext.h"
+#include <atomic>
 
-TArray<uint16> FPackedVisibilityData::Unpack(const FPackedVisibilityData& Entry, const UPVGPrecomputedGridDataAsset* Self)
+void FPackedVisibilityData::Unpack(const FPackedVisibilityData& Entry, const FIntVector& SectorOrigin, const UPVGPrecomputedGridDataAsset* Self, TArray<int32>& Out)
 {
-	TArray<uint16> OutArray;
-	const FIntVector OriginXYZ = IndexTo3D(Entry.Location, Self->GetGridSizeX(),Self->GetGridSizeY());
+	const FIntVector SectorSize = Self->GetSectorSize();
+	const FIntVector OriginXYZ = SectorOrigin + IndexTo3D(Entry.Location,SectorSize.X,SectorSize.Y);
+	const int32 NumBefore = Out.Num();
 	
 	for (int32 x = 0; x <= Entry.SizeX; x++)
 	{
@@ -17,259 +31,1697 @@ TArray<uint16> FPackedVisibilityData::Unpack(const FPackedVisibilityData& Entry,
 			for (int32 z = 0; z <= Entry.SizeZ; z++)
 			{
 				const FIntVector Location = OriginXYZ + FIntVector(x,y,z);
-				OutArray.Add(XYZToIndex(Location,Self->GetGridSizeX(),Self->GetGridSizeY()));
+				Out.Add(XYZToIndex(Location,Self->GetGridSizeX(),Self->GetGridSizeY()));
 			}
 		}
 	}
 	
-	check(OutArray.Num() == ((Entry.SizeX + 1) * (Entry.SizeY + 1) * (Entry.SizeZ + 1)))
-	return OutArray;
+	check(Out.Num() - NumBefore == ((Entry.SizeX + 1) * (Entry.SizeY + 1) * (Entry.SizeZ + 1)))
 }
 
-TArray<uint16> UPVGPrecomputedGridDataAsset::GetCellData(int32 CellId) const
+FArchive& operator<<(FArchive& Ar, FPackedCellData& Packed)
+{
+	uint8 Encoding = (uint8)Packed.Encoding;
+	Ar << Encoding;
+	Packed.Encoding = (EPVGCellEncoding)Encoding;
+
+	int32 NumBoxes = Packed.CellData.Num();
+	Ar << NumBoxes;
+	if (Ar.IsLoading())
+	{
+		// A corrupt count mustn't allocate more boxes than the rest of the chunk could hold.
+		const int64 BoxSize = 4 * sizeof(uint16);
+		if (NumBoxes < 0 || (Ar.TotalSize() >= 0 && NumBoxes * BoxSize > Ar.TotalSize() - Ar.Tell()))
+		{
+			Ar.SetError();
+			Packed.CellData.Empty();
+			Packed.EncodedData.Empty();
+			return Ar;
+		}
+		Packed.CellData.SetNum(NumBoxes);
+	}
+	for (FPackedVisibilityData& Entry : Packed.CellData)
+	{
+		Ar << Entry.Location << Entry.SizeX << Entry.SizeY << Entry.SizeZ;
+	}
+	
+	Ar << Packed.EncodedData;
+	return Ar;
+}
+
+FArchive& operator<<(FArchive& Ar, FPVGPairBlocks& Blocks)
+{
+	Ar << Blocks.BlockRows << Blocks.RowStart << Blocks.RowColumns << Blocks.RowWords;
+	Ar << Blocks.ColumnStart << Blocks.ColumnRows << Blocks.ColumnBlocks;
+	Ar << Blocks.Words;
+	return Ar;
+}
+
+bool FPVGPairBlocks::IsValid(int32 NumBlocks) const
+{
+	// Sectors without a block row of their own save nothing.
+	if (IsEmpty())
+	{
+		return BlockRows.Num() == 0;
+	}
+	
+	const int32 NumRows = RowStart.Num() - 1;
+	if ((BlockRows.Num() > 0 ? BlockRows.Num() != NumRows : NumRows != NumBlocks) || ColumnStart.Num() != RowStart.Num()
+		|| RowStart[0] != 0 || RowStart.Last() != RowColumns.Num() || RowWords.Num() != RowColumns.Num() || !Algo::IsSorted(RowStart)
+		|| ColumnStart[0] != 0 || ColumnStart.Last() != ColumnRows.Num() || ColumnBlocks.Num() != ColumnRows.Num() || !Algo::IsSorted(ColumnStart)
+		|| !Algo::IsSorted(BlockRows))
+	{
+		return false;
+	}
+
+	auto IsBlock = [NumBlocks](int32 Block) { return Block >= 0 && Block < NumBlocks; };
+	if (!Algo::AllOf(BlockRows,IsBlock) || !Algo::AllOf(RowColumns,IsBlock) || !Algo::AllOf(ColumnRows,IsBlock))
+	{
+		return false;
+	}
+	for (const int32 Entry : ColumnBlocks)
+	{
+		if (!RowWords.IsValidIndex(Entry))
+		{
+			return false;
+		}
+	}
+	for (const int32 Index : RowWords)
+	{
+		if (Index != INDEX_NONE && (!Words.IsValidIndex(Index) || Index + FMath::CountBits(Words[Index]) >= Words.Num()))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+TArray<int32> UPVGPrecomputedGridDataAsset::GetBuildCellData(int32 BuildCell) const
+{
+	TArray<int32> Data;
+	GetBuildCellData(BuildCell,Data);
+	return Data;
+}
+
+void UPVGPrecomputedGridDataAsset::GetBuildCellData(int32 BuildCell, TArray<int32>& Out) const
 {
 	QUICK_SCOPE_CYCLE_COUNTER(STAT_GetCellData)
-	TArray<uint16> Data;
-	for (int32 i = 0; i < GridCellData[CellId].CellData.Num(); i++)
+
+	CountSectorLookup(BuildCell);
+
+	// Size up front so the buffer grows at most once.
+	int32 NumCells = 0;
+	ForEachHiddenBox(BuildCell,[&NumCells](const FIntVector& Min, const FIntVector& Max)
+	{
+		NumCells += (Max.X - Min.X + 1) * (Max.Y - Min.Y + 1) * (Max.Z - Min.Z + 1);
+	});
+	
+	Out.Reset(NumCells);
+	ForEachHiddenBox(BuildCell,[this,&Out](const FIntVector& Min, const FIntVector& Max)
+	{
+		for (int32 x = Min.X; x <= Max.X; x++)
+		{
+			for (int32 y = Min.Y; y <= Max.Y; y++)
+			{
+				for (int32 z = Min.Z; z <= Max.Z; z++)
+				{
+					Out.Add(XYZToIndex(x,y,z,GridSizeX,GridSizeY));
+				}
+			}
+		}
+	});
+}
+
+void UPVGPrecomputedGridDataAsset::GetCellDataBits(int32 CellId, TBitArray<>& Out) const
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_GetCellDataBits)
+	
+	const int32 BuildCell = GetBuildCellIndex(CellId);
+	CountSectorLookup(BuildCell);
+	
+	if (Out.Num() != GetNumCells())
+	{
+		Out.Init(false,GetNumCells());
+	}
+	else
+	{
+		Out.SetRange(0,Out.Num(),false);
+	}
+	
+	ForEachHiddenBox(BuildCell,[this,&Out](const FIntVector& Min, const FIntVector& Max)
+	{
+		// Runs along X are contiguous bits.
+		for (int32 z = Min.Z; z <= Max.Z; z++)
+		{
+			for (int32 y = Min.Y; y <= Max.Y; y++)
+			{
+				Out.SetRange(XYZToIndex(Min.X,y,z,GridSizeX,GridSizeY),Max.X - Min.X + 1,true);
+			}
+		}
+	});
+}
+
+int32 UPVGPrecomputedGridDataAsset::GetBuildCellIndex(int32 Cell) const
+{
+	if (LeafCodes.Num() == 0)
+	{
+		return Cell;
+	}
+
+	// Leaves tile the octree in Morton order, the last leaf starting at or before the cell holds it.
+	const uint64 Code = CellToMortonCode(IndexTo3D(Cell,GridSizeX,GridSizeY));
+	return Algo::UpperBound(LeafCodes,Code) - 1;
+}
+
+void UPVGPrecomputedGridDataAsset::GetBuildCellRange(int32 BuildCell, FIntVector& OutMin, FIntVector& OutMax) const
+{
+	if (LeafCodes.Num() == 0)
+	{
+		OutMin = OutMax = IndexTo3D(BuildCell,GridSizeX,GridSizeY);
+		return;
+	}
+	FPVGAdaptiveCells::GetLeafRange(LeafCodes[BuildCell],LeafLevels[BuildCell],FIntVector(GridSizeX,GridSizeY,GridSizeZ),OutMin,OutMax);
+}
+
+FIntVector UPVGPrecomputedGridDataAsset::GetNumSectors3D() const
+{
+	const FIntVector Size = GetSectorSize();
+	return FIntVector(
+		FMath::DivideAndRoundUp(GridSizeX,FMath::Max(1,Size.X)),
+		FMath::DivideAndRoundUp(GridSizeY,FMath::Max(1,Size.Y)),
+		FMath::DivideAndRoundUp(GridSizeZ,FMath::Max(1,Size.Z)));
+}
+
+int32 UPVGPrecomputedGridDataAsset::GetSectorIndex(const FIntVector& Cell) const
+{
+	const FIntVector Size = GetSectorSize();
+	const FIntVector NumSectors = GetNumSectors3D();
+	return XYZToIndex(Cell.X / Size.X,Cell.Y / Size.Y,Cell.Z / Size.Z,NumSectors.X,NumSectors.Y);
+}
+
+FIntVector UPVGPrecomputedGridDataAsset::GetSectorOrigin(int32 Sector) const
+{
+	const FIntVector Size = GetSectorSize();
+	const FIntVector SectorXYZ = IndexTo3D(Sector,GetNumSectors3D().X,GetNumSectors3D().Y);
+	return FIntVector(SectorXYZ.X * Size.X,SectorXYZ.Y * Size.Y,SectorXYZ.Z * Size.Z);
+}
+
+FIntVector UPVGPrecomputedGridDataAsset::GetSectorExtent(int32 Sector) const
+{
+	const FIntVector Origin = GetSectorOrigin(Sector);
+	const FIntVector Size = GetSectorSize();
+	return FIntVector(FMath::Min(Size.X,GridSizeX - Origin.X),FMath::Min(Size.Y,GridSizeY - Origin.Y),FMath::Min(Size.Z,GridSizeZ - Origin.Z));
+}
+
+void UPVGPrecomputedGridDataAsset::GetPairSlot(int32 BuildCell, int32& OutBlock, int32& OutSlot) const
+{
+	if (LeafCodes.Num() > 0)
+	{
+		OutBlock = BuildCell >> 6;
+		OutSlot = BuildCell & 63;
+		return;
+	}
+	
+	const FIntVector Cell = IndexTo3D(BuildCell,GridSizeX,GridSizeY);
+	OutBlock = XYZToIndex(Cell.X >> 2,Cell.Y >> 2,Cell.Z >> 2,FMath::DivideAndRoundUp(GridSizeX,4),FMath::DivideAndRoundUp(GridSizeY,4));
+	OutSlot = (Cell.X & 3) | (Cell.Y & 3) << 2 | (Cell.Z & 3) << 4;
+}
+
+int32 UPVGPrecomputedGridDataAsset::GetSlotBuildCell(int32 Block, int32 Slot) const
+{
+	if (LeafCodes.Num() > 0)
+	{
+		const int32 BuildCell = Block * 64 + Slot;
+		return BuildCell < LeafCodes.Num() ? BuildCell : INDEX_NONE;
+	}
+
+	const FIntVector Cell = GetPairBrickOrigin(Block) + FIntVector(Slot & 3,(Slot >> 2) & 3,Slot >> 4);
+	return Cell.X < GridSizeX && Cell.Y < GridSizeY && Cell.Z < GridSizeZ ? XYZToIndex(Cell,GridSizeX,GridSizeY) : INDEX_NONE;
+}
+
+int32 UPVGPrecomputedGridDataAsset::GetNumPairBlocks() const
+{
+	if (LeafCodes.Num() > 0)
+	{
+		return FMath::DivideAndRoundUp(LeafCodes.Num(),64);
+	}
+	return FMath::DivideAndRoundUp(GridSizeX,4) * FMath::DivideAndRoundUp(GridSizeY,4) * FMath::DivideAndRoundUp(GridSizeZ,4);
+}
+
+uint64 UPVGPrecomputedGridDataAsset::GetValidPairSlots(int32 Block) const
+{
+	if (LeafCodes.Num() > 0)
+	{
+		const int32 Num = FMath::Min(64,LeafCodes.Num() - Block * 64);
+		return Num == 64 ? ~uint64(0) : (uint64(1) << Num) - 1;
+	}
+
+	// Only bricks on the far border of the grid are cut off.
+	const FIntVector Origin = GetPairBrickOrigin(Block);
+	if (Origin.X + 4 <= GridSizeX && Origin.Y + 4 <= GridSizeY && Origin.Z + 4 <= GridSizeZ)
+	{
+		return ~uint64(0);
+	}
+	
+	uint64 Slots = 0;
+	for (int32 Slot = 0; Slot < 64; Slot++)
+	{
+		if (GetSlotBuildCell(Block,Slot) != INDEX_NONE)
+		{
+			Slots |= uint64(1) << Slot;
+		}
+	}
+	return Slots;
+}
+
+FIntVector UPVGPrecomputedGridDataAsset::GetPairBrickOrigin(int32 Block) const
+{
+	return IndexTo3D(Block,FMath::DivideAndRoundUp(GridSizeX,4),FMath::DivideAndRoundUp(GridSizeY,4)) * 4;
+}
+
+int32 UPVGPrecomputedGridDataAsset::GetBuildCellSector(int32 BuildCell) const
+{
+	if (bPairBlocks)
+	{
+		int32 Block, Slot;
+		GetPairSlot(BuildCell,Block,Slot);
+		return GetPairBlockSector(Block);
+	}
+	
+	FIntVector Min, Max;
+	GetBuildCellRange(BuildCell,Min,Max);
+	return GetSectorIndex(Min);
+}
+
+int32 UPVGPrecomputedGridDataAsset::GetPairBlockSector(int32 Block) const
+{
+	if (LeafCodes.Num() > 0)
+	{
+		FIntVector Min, Max;
+		GetBuildCellRange(Block * 64,Min,Max);
+		return GetSectorIndex(Min);
+	}
+	return GetSectorIndex(GetPairBrickOrigin(Block));
+}
+
+UPVGPrecomputedGridDataAsset::FLoadedSector* UPVGPrecomputedGridDataAsset::FindLoadedSector(int32 Sector) const
+{
+	FLoadedSector* Loaded = LoadedSectors.Find(Sector);
+	if (!Loaded && FailedSectors.Contains(Sector))
+	{
+		// Couldn't be read, nothing is hidden from its cells.
+		return nullptr;
+	}
+	if (!Loaded)
+	{
+		// Not prefetched, e.g. editor tools or the regression commandlet going over every cell.
+		LoadSectorBlocking(Sector);
+		Loaded = LoadedSectors.Find(Sector);
+		if (!Loaded)
+		{
+			return nullptr;
+		}
+	}
+	
+	Loaded->LastUse = ++SectorUseCounter;
+	return Loaded;
+}
+
+void UPVGPrecomputedGridDataAsset::CountSectorLookup(int32 BuildCell) const
+{
+	if (!bStreamedSectors)
+	{
+		return;
+	}
+	
+	const int32 Sector = GetBuildCellSector(BuildCell);
+	if (LoadedSectors.Contains(Sector))
+	{
+		SectorCacheStats.Hits++;
+	}
+	else if (!FailedSectors.Contains(Sector))
+	{
+		SectorCacheStats.Misses++;
+	}
+}
+
+const FPackedCellData* UPVGPrecomputedGridDataAsset::FindCellData(int32 BuildCell) const
+{
+	if (!bStreamedSectors)
+	{
+		return GridCellData.IsValidIndex(BuildCell) ? &GridCellData[BuildCell] : nullptr;
+	}
+
+	const FLoadedSector* Loaded = FindLoadedSector(GetBuildCellSector(BuildCell));
+	if (!Loaded)
+	{
+		return nullptr;
+	}
+	const int32 Index = Algo::BinarySearch(Loaded->BuildCells,BuildCell);
+	return Index != INDEX_NONE ? &Loaded->Cells[Index] : nullptr;
+}
+
+const FPVGPairBlocks* UPVGPrecomputedGridDataAsset::FindPairBlocks(int32 Block) const
+{
+	if (!bStreamedSectors)
+	{
+		return &PairBlocks;
+	}
+	
+	const FLoadedSector* Loaded = FindLoadedSector(GetPairBlockSector(Block));
+	return Loaded ? &Loaded->PairBlocks : nullptr;
+}
+
+bool UPVGPrecomputedGridDataAsset::IsCellDataResident(int32 CellId) const
+{
+	if (!bStreamedSectors || CellId < 0 || CellId >= GetNumCells())
+	{
+		return true;
+	}
+	const int32 Sector = GetBuildCellSector(GetBuildCellIndex(CellId));
+	return LoadedSectors.Contains(Sector) || FailedSectors.Contains(Sector);
+}
+
+void UPVGPrecomputedGridDataAsset::StreamSectorsAround(int32 CellId)
+{
+	if (!bStreamedSectors)
+	{
+		return;
+	}
+	
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_StreamSectors)
+
+	// Finished reads go on to a worker to get decoded.
+	for (auto It = SectorRequests.CreateIterator(); It; ++It)
+	{
+		IBulkDataIORequest& Request = *It.Value();
+		if (!Request.PollCompletion())
+		{
+			continue;
+		}
+		const int32 Sector = It.Key();
+		uint8* Data = Request.GetReadResults();
+		const int64 Size = Request.GetSize();
+		It.RemoveCurrent();
+		if (Data)
+		{
+			SectorDecodes.Add(Sector,LaunchSectorDecode(Data,Size));
+		}
+		else
+		{
+			// Requesting it again would fail the same way every frame, one blocking read either gets it or marks it failed.
+			UE_LOG(LogTemp,Warning,TEXT("Streaming sector %d failed, reading it blocking."),Sector);
+			LoadSectorBlocking(Sector);
+		}
+	}
+
+	// Finished decodes only stay when they are still wanted or fit the budget.
+	for (auto It = SectorDecodes.CreateIterator(); It; ++It)
+	{
+		if (It.Value().IsCompleted())
+		{
+			AddLoadedSector(It.Key(),MoveTemp(It.Value().GetResult()));
+			It.RemoveCurrent();
+		}
+	}
+
+	// Everything touched from here on is wanted and survives the trim.
+	const uint64 PinnedUse = SectorUseCounter + 1;
+	
+	if (CellId >= 0 && CellId < GetNumCells())
+	{
+		TArray<int32,TInlineAllocator<27>> Wanted;
+		Wanted.Add(GetBuildCellSector(GetBuildCellIndex(CellId)));
+
+		// Per axis the sector of the cell and the neighbours whose border is within the prefetch distance.
+		const FIntVector Cell = IndexTo3D(CellId,GridSizeX,GridSizeY);
+		const FIntVector Size = GetSectorSize();
+		const FIntVector NumSectors = GetNumSectors3D();
+		const FIntVector SectorXYZ(Cell.X / Size.X,Cell.Y / Size.Y,Cell.Z / Size.Z);
+		const int32 Prefetch = UPVGDeveloperSettings::GetSectorPrefetchCells();
+		
+		int32 Steps[3][3];
+		int32 NumSteps[3];
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			const int32 Local = Cell[Axis] - SectorXYZ[Axis] * Size[Axis];
+			NumSteps[Axis] = 0;
+			Steps[Axis][NumSteps[Axis]++] = 0;
+			if (Local < Prefetch && SectorXYZ[Axis] > 0)
+			{
+				Steps[Axis][NumSteps[Axis]++] = -1;
+			}
+			if (Local >= Size[Axis] - Prefetch && SectorXYZ[Axis] + 1 < NumSectors[Axis])
+			{
+				Steps[Axis][NumSteps[Axis]++] = 1;
+			}
+		}
+		
+		for (int32 x = 0; x < NumSteps[0]; x++)
+		{
+			for (int32 y = 0; y < NumSteps[1]; y++)
+			{
+				for (int32 z = 0; z < NumSteps[2]; z++)
+				{
+					Wanted.AddUnique(XYZToIndex(SectorXYZ + FIntVector(Steps[0][x],Steps[1][y],Steps[2][z]),NumSectors.X,NumSectors.Y));
+				}
+			}
+		}
+
+		for (const int32 Sector : Wanted)
+		{
+			if (FLoadedSector* Loaded = LoadedSectors.Find(Sector))
+			{
+				Loaded->LastUse = ++SectorUseCounter;
+				continue;
+			}
+			if (SectorRequests.Contains(Sector) || SectorDecodes.Contains(Sector) || FailedSectors.Contains(Sector) || !SectorChunks.IsValidIndex(Sector))
+			{
+				continue;
+			}
+
+			SectorCacheStats.PrefetchRequests++;
+			FByteBulkData& Chunk = SectorChunks[Sector];
+			if (Chunk.IsBulkDataLoaded())
+			{
+				// Resident compressed chunks, or streamed ones still in memory right after saving in the editor. Only the
+				// decode goes to a worker, from a copy so the chunk isn't locked meanwhile.
+				const int64 ChunkSize = Chunk.GetBulkDataSize();
+				uint8* Data = (uint8*)FMemory::Malloc(ChunkSize);
+				FMemory::Memcpy(Data,Chunk.LockReadOnly(),ChunkSize);
+				Chunk.Unlock();
+				SectorDecodes.Add(Sector,LaunchSectorDecode(Data,ChunkSize));
+				continue;
+			}
+			
+			IBulkDataIORequest* Request = Chunk.CanLoadFromDisk() ? Chunk.CreateStreamingRequest(AIOP_Normal,nullptr,nullptr) : nullptr;
+			if (Request)
+			{
+				SectorRequests.Add(Sector,TUniquePtr<IBulkDataIORequest>(Request));
+			}
+			else
+			{
+				LoadSectorBlocking(Sector);
+			}
+		}
+	}
+
+	TrimSectorCache(PinnedUse);
+}
+
+namespace PVGSectorChunks
+{
+	/* Far above any real sector, a sector has less than MAX_uint16 build cells. */
+	constexpr int32 MaxUncompressedSize = 256 * 1024 * 1024;
+}
+
+void UPVGPrecomputedGridDataAsset::DecodeSectorChunk(FName Format, int32 NumPairBlocks, TArrayView<const uint8> Chunk, FLoadedSector& Out)
+{
+	Out.BuildCells.Reset();
+	Out.Cells.Reset();
+	Out.PairBlocks = FPVGPairBlocks();
+
+	TArray<uint8> Uncompressed;
+	if (!Format.IsNone())
+	{
+		int32 UncompressedSize = 0;
+		FMemoryReaderView SizeReader(Chunk);
+		SizeReader << UncompressedSize;
+		Chunk = Chunk.RightChop(sizeof(int32));
+
+		// The size comes from disk, don't let a broken chunk pick the allocation.
+		if (SizeReader.IsError() || UncompressedSize < 0 || UncompressedSize > PVGSectorChunks::MaxUncompressedSize)
+		{
+			UE_LOG(LogTemp,Error,TEXT("Sector chunk claims %d bytes uncompressed, skipping it."),UncompressedSize);
+			return;
+		}
+
+		// Chunks that didn't get smaller are stored as is.
+		if (Chunk.Num() != UncompressedSize)
+		{
+			Uncompressed.SetNumUninitialized(UncompressedSize);
+			if (!FCompression::UncompressMemory(Format,Uncompressed.GetData(),UncompressedSize,Chunk.GetData(),Chunk.Num()))
+			{
+				UE_LOG(LogTemp,Error,TEXT("Failed to decompress a sector chunk with %s."),*Format.ToString());
+				return;
+			}
+			Chunk = Uncompressed;
+		}
+	}
+	
+	FMemoryReaderView Reader(Chunk);
+	int32 Num = 0;
+	Reader << Num;
+
+	// Every cell takes at least its index.
+	if (Reader.IsError() || Num < 0 || Num > Chunk.Num() / int32(sizeof(int32)))
+	{
+		UE_LOG(LogTemp,Error,TEXT("Sector chunk claims %d cells, skipping it."),Num);
+		return;
+	}
+	
+	Out.BuildCells.SetNumUninitialized(Num);
+	Out.Cells.SetNum(Num);
+	for (int32 i = 0; i < Num; i++)
+	{
+		Reader << Out.BuildCells[i];
+		Reader << Out.Cells[i];
+	}
+
+	// Offsets are trusted on lookup, a broken table only costs the transitions of this sector.
+	Reader << Out.TransitionOffsets;
+	Reader << Out.TransitionData;
+	if (Reader.IsError() || (Out.TransitionOffsets.Num() > 0 && (Out.TransitionOffsets[0] != 0 || Out.TransitionOffsets.Last() != (uint32)Out.TransitionData.Num()
+		|| !Algo::IsSorted(Out.TransitionOffsets))))
+	{
+		Out.TransitionOffsets.Empty();
+		Out.TransitionData.Empty();
+	}
+
+	// Only in chunks of grids saved with pair blocks, they are looked up without further checks.
+	if (!Reader.IsError() && !Reader.AtEnd())
+	{
+		Reader << Out.PairBlocks;
+		if (Reader.IsError() || !Out.PairBlocks.IsValid(NumPairBlocks))
+		{
+			UE_LOG(LogTemp,Error,TEXT("Sector chunk has broken pair blocks, skipping them."));
+			Out.PairBlocks = FPVGPairBlocks();
+		}
+	}
+}
+
+void UPVGPrecomputedGridDataAsset::ReadSectorChunk(int32 Sector, FLoadedSector& Out) const
+{
+	Out.BuildCells.Reset();
+	Out.Cells.Reset();
+	Out.PairBlocks = FPVGPairBlocks();
+	if (!SectorChunks.IsValidIndex(Sector))
+	{
+		return;
+	}
+
+	FByteBulkData& Chunk = const_cast<FByteBulkData&>(SectorChunks[Sector]);
+	const int64 Size = Chunk.GetBulkDataSize();
+	if (Chunk.IsBulkDataLoaded())
+	{
+		DecodeSectorChunk(ChunkCompressionFormat,GetNumPairBlocks(),TArrayView<const uint8>((const uint8*)Chunk.LockReadOnly(),(int32)Size),Out);
+		Chunk.Unlock();
+		return;
+	}
+
+	// Not kept loaded after the copy, the cache holds the decoded sector instead.
+	void* Data = nullptr;
+	Chunk.GetCopy(&Data,true);
+	if (!Data)
+	{
+		// Not retried, its cells hide nothing until the asset gets loaded again.
+		UE_LOG(LogTemp,Error,TEXT("Failed to read sector %d of %s, its cells won't cull anything."),Sector,*GetName());
+		FailedSectors.Add(Sector);
+		return;
+	}
+	DecodeSectorChunk(ChunkCompressionFormat,GetNumPairBlocks(),TArrayView<const uint8>((const uint8*)Data,(int32)Size),Out);
+	FMemory::Free(Data);
+}
+
+UE::Tasks::TTask<UPVGPrecomputedGridDataAsset::FLoadedSector> UPVGPrecomputedGridDataAsset::LaunchSectorDecode(uint8* Data, int64 Size) const
+{
+	return UE::Tasks::Launch(UE_SOURCE_LOCATION,[Format = ChunkCompressionFormat, NumPairBlocks = GetNumPairBlocks(), Data, Size]()
+	{
+		FLoadedSector Loaded;
+		DecodeSectorChunk(Format,NumPairBlocks,TArrayView<const uint8>(Data,(int32)Size),Loaded);
+		FMemory::Free(Data);
+		return Loaded;
+	});
+}
+
+void UPVGPrecomputedGridDataAsset::AddLoadedSector(int32 Sector, FLoadedSector&& InLoaded) const
+{
+	FLoadedSector& Loaded = LoadedSectors.FindOrAdd(Sector);
+	LoadedSectorBytes -= Loaded.AllocatedSize;
+	Loaded = MoveTemp(InLoaded);
+
+	Loaded.AllocatedSize = Loaded.BuildCells.GetAllocatedSize() + Loaded.Cells.GetAllocatedSize() + Loaded.TransitionOffsets.GetAllocatedSize()
+		+ Loaded.TransitionData.GetAllocatedSize() + Loaded.PairBlocks.GetAllocatedSize();
+	for (const FPackedCellData& Packed : Loaded.Cells)
+	{
+		Loaded.AllocatedSize += Packed.CellData.GetAllocatedSize() + Packed.EncodedData.GetAllocatedSize();
+	}
+	LoadedSectorBytes += Loaded.AllocatedSize;
+	Loaded.LastUse = ++SectorUseCounter;
+}
+
+void UPVGPrecomputedGridDataAsset::LoadSectorBlocking(int32 Sector) const
+{
+	QUICK_SCOPE_CYCLE_COUNTER(STAT_LoadSectorBlocking)
+
+	SectorCacheStats.BlockingLoads++;
+	
+	// A decode in flight is closer to done than a new read.
+	FLoadedSector Loaded;
+	if (UE::Tasks::TTask<FLoadedSector>* Decode = SectorDecodes.Find(Sector))
+	{
+		Decode->Wait();
+		Loaded = MoveTemp(Decode->GetResult());
+		SectorDecodes.Remove(Sector);
+	}
+	else
+	{
+		ReadSectorChunk(Sector,Loaded);
+		if (FailedSectors.Contains(Sector))
+		{
+			return;
+		}
+	}
+	
+	AddLoadedSector(Sector,MoveTemp(Loaded));
+	TrimSectorCache(SectorUseCounter);
+}
+
+void UPVGPrecomputedGridDataAsset::TrimSectorCache(uint64 PinnedUse) const
+{
+	const int64 Budget = UPVGDeveloperSettings::GetSectorCacheBudget();
+	while (LoadedSectorBytes > Budget)
+	{
+		// Only a handful of sectors fit the budget, a scan is cheaper than keeping a list in order.
+		int32 Oldest = INDEX_NONE;
+		uint64 OldestUse = PinnedUse;
+		for (const TPair<int32,FLoadedSector>& Pair : LoadedSectors)
+		{
+			if (Pair.Value.LastUse < OldestUse)
+			{
+				Oldest = Pair.Key;
+				OldestUse = Pair.Value.LastUse;
+			}
+		}
+		if (Oldest == INDEX_NONE)
+		{
+			break;
+		}
+		
+		LoadedSectorBytes -= LoadedSectors[Oldest].AllocatedSize;
+		LoadedSectors.Remove(Oldest);
+		SectorCacheStats.Evictions++;
+	}
+}
+
+void UPVGPrecomputedGridDataAsset::ResetSectorCache()
+{
+	for (TPair<int32,TUniquePtr<IBulkDataIORequest>>& Pair : SectorRequests)
+	{
+		Pair.Value->Cancel();
+		Pair.Value->WaitCompletion();
+		FMemory::Free(Pair.Value->GetReadResults());
+	}
+	SectorRequests.Empty();
+	
+	for (TPair<int32,UE::Tasks::TTask<FLoadedSector>>& Pair : SectorDecodes)
+	{
+		Pair.Value.Wait();
+	}
+	SectorDecodes.Empty();
+	
+	LoadedSectors.Empty();
+	LoadedSectorBytes = 0;
+	FailedSectors.Empty();
+}
+
+void UPVGPrecomputedGridDataAsset::Serialize(FArchive& Ar)
+{
+	Super::Serialize(Ar);
+
+	// bStreamedSectors comes with the properties, so both sides agree on whether the chunks follow.
+	if (!bStreamedSectors || Ar.IsObjectReferenceCollector() || Ar.IsTransacting())
+	{
+		return;
+	}
+	
+	int32 NumChunks = SectorChunks.Num();
+	Ar << NumChunks;
+	if (Ar.IsLoading())
+	{
+		ResetSectorCache();
+		SectorChunks.Empty(NumChunks);
+		for (int32 Sector = 0; Sector < NumChunks; Sector++)
+		{
+			SectorChunks.Add(new FByteBulkData());
+		}
+	}
+	
+	for (int32 Sector = 0; Sector < NumChunks; Sector++)
+	{
+		SectorChunks[Sector].Serialize(Ar,this);
+	}
+}
+
+void UPVGPrecomputedGridDataAsset::BeginDestroy()
+{
+	ResetSectorCache();
+	Super::BeginDestroy();
+}
+
+uint32 UPVGPrecomputedGridDataAsset::GetGridSignature() const
+{
+	uint32 Hash = GetTypeHash(FIntVector(GridSizeX,GridSizeY,GridSizeZ));
+	Hash = HashCombine(Hash,GetTypeHash(CellExtents));
+	Hash = HashCombine(Hash,GetTypeHash(GridBounds.Min));
+	Hash = HashCombine(Hash,GetTypeHash(GridBounds.Max));
+	if (LeafCodes.Num() > 0)
+	{
+		Hash = HashCombine(Hash,FCrc::MemCrc32(LeafCodes.GetData(),LeafCodes.Num() * sizeof(uint64)));
+		Hash = HashCombine(Hash,FCrc::MemCrc32(LeafLevels.GetData(),LeafLevels.Num()));
+	}
+	return Hash;
+}
+
+#if WITH_EDITORONLY_DATA
+
+void UPVGPrecomputedGridDataAsset::PreSave(FObjectPreSaveContext SaveContext)
+{
+	Super::PreSave(SaveContext);
+
+	if (PairMatrix.GetNumCells() > 0)
+	{
+		// Flatten the pair state into the per build cell regions, hidden leaves expand to all their grid cells.
+		GridData.SetNum(PairMatrix.GetNumCells());
+
+		ParallelFor(GridData.Num(),[&](int32 Cell)
+		{
+			TArray<int32>& InvisibleRegions = GridData[Cell].InvisibleRegions;
+			InvisibleRegions.Reset();
+			if (!IsBuildCellReachable(Cell))
+			{
+				return;
+			}
+			
+			PairMatrix.ForEachOccluded(Cell,[this,&InvisibleRegions](int32 Other)
+			{
+				if (LeafCodes.Num() == 0)
+				{
+					InvisibleRegions.Add(Other);
+					return;
+				}
+				
+				FIntVector Min, Max;
+				GetBuildCellRange(Other,Min,Max);
+				for (int32 z = Min.Z; z <= Max.Z; z++)
+				{
+					for (int32 y = Min.Y; y <= Max.Y; y++)
+					{
+						for (int32 x = Min.X; x <= Max.X; x++)
+						{
+							InvisibleRegions.Add(XYZToIndex(x,y,z,GridSizeX,GridSizeY));
+						}
+					}
+				}
+			});
+		});
+	}
+
+	if (GridData.Num() > 0)
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Compressing"));
+		// Cube compression.
+		GridCellData.SetNumZeroed(GridData.Num());
+
+		constexpr int32 NumTasks = 32;
+		const int32 NumPerTask = FMath::DivideAndRoundUp(GridData.Num(), NumTasks);
+	
+		ParallelFor(NumTasks,[&](int32 TaskID)
+		{
+			const int32 Start = TaskID * NumPerTask;
+			const int32 End = FMath::Min(Start + NumPerTask,GridData.Num());
+
+			for (int32 i = Start; i < End; i++)
+			{
+				CubeCompress(GridData[i],GridCellData[i].CellData);
+				if (UPVGDeveloperSettings::UseAdaptiveCellEncoding())
+				{
+					PickCellEncoding(GridData[i],GridCellData[i]);
+				}
+			}
+		});
+
+		int32 NumPerEncoding[4] = {};
+		for (const FPackedCellData& Packed : GridCellData)
+		{
+			NumPerEncoding[(int32)Packed.Encoding]++;
+		}
+		UE_LOG(LogTemp,Warning,TEXT("Cell encodings: %d boxes, %d bitsets, %d run lengths, %d deltas."),
+			NumPerEncoding[0],NumPerEncoding[1],NumPerEncoding[2],NumPerEncoding[3]);
+
+		TransitionData.Empty();
+		TransitionOffsets.Empty();
+		if (UPVGDeveloperSettings::SaveTransitions())
+		{
+			BuildTransitions();
+		}
+
+		// A single sector would always be resident anyway, compressed chunks still pay off when they stay resident.
+		ResetSectorCache();
+		SectorChunks.Empty();
+		bStreamedSectors = false;
+		PairBlocks = FPVGPairBlocks();
+		const bool bStreamed = UPVGDeveloperSettings::StreamSectors() && GetNumSectors() > 1;
+		const bool bChunked = bStreamed || bAllowRuntimeCompression;
+
+		// Pair blocks replace the cell rows when they are smaller, in chunks they go with the sector of their block row.
+		TArray<FPVGPairBlocks> SavedPairBlocks;
+		bPairBlocks = UPVGDeveloperSettings::StorePairsOnce() && BuildPairBlocks(bChunked,SavedPairBlocks);
+		if (bPairBlocks)
+		{
+			GridCellData.Empty();
+		}
+		
+		if (bChunked)
+		{
+			BuildSectorChunks(bStreamed,MoveTemp(SavedPairBlocks));
+		}
+		else if (bPairBlocks)
+		{
+			PairBlocks = MoveTemp(SavedPairBlocks[0]);
+		}
+	}
+}
+#endif	
+
+bool UPVGPrecomputedGridDataAsset::GetTransitionStep(int32 FromCell, int32 ToCell, int32& OutBase, int32& OutAxis) const
+{
+	const int32 NumCells = GetNumCells();
+	if (FromCell < 0 || ToCell < 0 || FromCell >= NumCells || ToCell >= NumCells)
+	{
+		return false;
+	}
+
+	const int32 Base = FMath::Min(FromCell,ToCell);
+	const int32 Step = FMath::Abs(ToCell - FromCell);
+	const FIntVector XYZ = IndexTo3D(Base,GridSizeX,GridSizeY);
+	
+	// The step has to stay on the same row or plane to be a face neighbour.
+	if (Step == 1 && XYZ.X + 1 < GridSizeX)
+	{
+		OutAxis = 0;
+	}
+	else if (Step == GridSizeX && XYZ.Y + 1 < GridSizeY)
+	{
+		OutAxis = 1;
+	}
+	else if (Step == GridSizeX * GridSizeY)
+	{
+		OutAxis = 2;
+	}
+	else
+	{
+		return false;
+	}
+	
+	OutBase = Base;
+	return true;
+}
+
+bool UPVGPrecomputedGridDataAsset::FindTransition(int32 FromCell, int32 ToCell, const uint8*& OutData, const uint8*& OutEnd) const
+{
+	int32 Base, Axis;
+	if (!GetTransitionStep(FromCell,ToCell,Base,Axis))
+	{
+		return false;
+	}
+
+	if (TransitionOffsets.Num() == GetNumCells() * 3 + 1)
+	{
+		const int32 Entry = Base * 3 + Axis;
+		OutData = TransitionData.GetData() + TransitionOffsets[Entry];
+		OutEnd = TransitionData.GetData() + TransitionOffsets[Entry + 1];
+		return true;
+	}
+
+	if (!bStreamedSectors)
+	{
+		return false;
+	}
+
+	// Only from a cached sector, stepping into one that isn't decodes the whole set of the new cell instead.
+	const FIntVector Cell = IndexTo3D(Base,GridSizeX,GridSizeY);
+	const int32 Sector = GetSectorIndex(Cell);
+	const FIntVector Extent = GetSectorExtent(Sector);
+	FLoadedSector* Loaded = LoadedSectors.Find(Sector);
+	if (!Loaded || Loaded->TransitionOffsets.Num() != Extent.X * Extent.Y * Extent.Z * 3 + 1)
+	{
+		return false;
+	}
+
+	Loaded->LastUse = ++SectorUseCounter;
+	const int32 Entry = XYZToIndex(Cell - GetSectorOrigin(Sector),Extent.X,Extent.Y) * 3 + Axis;
+	OutData = Loaded->TransitionData.GetData() + Loaded->TransitionOffsets[Entry];
+	OutEnd = Loaded->TransitionData.GetData() + Loaded->TransitionOffsets[Entry + 1];
+	return true;
+}
+
+#if WITH_EDITOR
+void UPVGPrecomputedGridDataAsset::BuildTransitions()
+{
+	const double StartTime = FPlatformTime::Seconds();
+	
+	// Sorted hidden cells of every build cell.
+	TArray<TArray<int32>> Hidden;
+	Hidden.SetNum(GridData.Num());
+	ParallelFor(GridData.Num(),[&](int32 BuildCell)
+	{
+		Hidden[BuildCell] = GridData[BuildCell].InvisibleRegions;
+		Hidden[BuildCell].Sort();
+		Hidden[BuildCell].SetNum(Algo::Unique(Hidden[BuildCell]));
+	});
+
+	const int32 NumCells = GetNumCells();
+	const FIntVector GridSize(GridSizeX,GridSizeY,GridSizeZ);
+	const int32 Steps[3] = { 1, GridSizeX, GridSizeX * GridSizeY };
+	
+	TArray<TArray<uint8>> Entries;
+	Entries.SetNum(NumCells * 3);
+	ParallelFor(NumCells,[&](int32 Cell)
+	{
+		const FIntVector XYZ = IndexTo3D(Cell,GridSizeX,GridSizeY);
+		const int32 From = GetBuildCellIndex(Cell);
+		for (int32 Axis = 0; Axis < 3; Axis++)
+		{
+			// Neighbours inside the same leaf see the same cells, their entry stays empty.
+			const int32 To = XYZ[Axis] + 1 < GridSize[Axis] ? GetBuildCellIndex(Cell + Steps[Axis]) : From;
+			if (To == From)
+			{
+				continue;
+			}
+
+			const TArray<int32>& Old = Hidden[From];
+			const TArray<int32>& New = Hidden[To];
+			TArray<int32> NewlyHidden;
+			TArray<int32> NewlyVisible;
+			int32 i = 0, j = 0;
+			while (i < Old.Num() || j < New.Num())
+			{
+				if (j == New.Num() || (i < Old.Num() && Old[i] < New[j]))
+				{
+					NewlyVisible.Add(Old[i++]);
+				}
+				else if (i == Old.Num() || New[j] < Old[i])
+				{
+					NewlyHidden.Add(New[j++]);
+				}
+				else
+				{
+					i++;
+					j++;
+				}
+			}
+
+			if (NewlyHidden.Num() == 0 && NewlyVisible.Num() == 0)
+			{
+				continue;
+			}
+
+			TArray<uint8>& Entry = Entries[Cell * 3 + Axis];
+			FPackedCellData::WriteVarint(Entry,NewlyHidden.Num());
+			for (const TArray<int32>* List : { &NewlyHidden, &NewlyVisible })
+			{
+				int32 Previous = -1;
+				for (const int32 Changed : *List)
+				{
+					FPackedCellData::WriteVarint(Entry,Changed - Previous - 1);
+					Previous = Changed;
+				}
+			}
+		}
+	});
+
+	TransitionOffsets.SetNumUninitialized(Entries.Num() + 1);
+	uint32 Offset = 0;
+	for (int32 Entry = 0; Entry < Entries.Num(); Entry++)
+	{
+		TransitionOffsets[Entry] = Offset;
+		Offset += Entries[Entry].Num();
+	}
+	TransitionOffsets.Last() = Offset;
+
+	TransitionData.Reset(Offset);
+	for (const TArray<uint8>& Entry : Entries)
+	{
+		TransitionData.Append(Entry);
+	}
+
+	UE_LOG(LogTemp,Warning,TEXT("Transitions: %.1f KB of changes, %.1f KB of offsets, built in %.2f sec."),
+		TransitionData.Num() / 1024.f,TransitionOffsets.Num() * sizeof(uint32) / 1024.f,FPlatformTime::Seconds() - StartTime);
+}
+
+namespace PVGPairBlocks
+{
+	/* Stored block of a block row while building, word R holds the occluded slots of the block column seen from slot R. */
+	struct FBlock
+	{
+		int32 Column;
+		bool bFull;
+		uint64 Words[64];
+	};
+
+	/* Block (I,J) as stored with row J, every slot's column turns into its word. */
+	void Transpose(const FBlock& In, int32 Row, FBlock& Out)
+	{
+		Out.Column = Row;
+		Out.bFull = In.bFull;
+		FMemory::Memzero(Out.Words);
+		for (int32 Slot = 0; Slot < 64; Slot++)
+		{
+			for (uint64 Bits = In.Words[Slot]; Bits; Bits &= Bits - 1)
+			{
+				Out.Words[FMath::CountTrailingZeros64(Bits)] |= uint64(1) << Slot;
+			}
+		}
+	}
+
+	void AddBlock(const FBlock& Block, FPVGPairBlocks& Out)
 	{
-		Data.Append(FPackedVisibilityData::Unpack(GridCellData[CellId].CellData[i],this));
+		Out.RowColumns.Add(Block.Column);
+		if (Block.bFull)
+		{
+			Out.RowWords.Add(INDEX_NONE);
+			return;
+		}
+
+		// Mask of the non-zero words, then only those.
+		const int32 MaskIndex = Out.Words.Add(0);
+		Out.RowWords.Add(MaskIndex);
+		for (int32 Slot = 0; Slot < 64; Slot++)
+		{
+			if (Block.Words[Slot])
+			{
+				Out.Words[MaskIndex] |= uint64(1) << Slot;
+				Out.Words.Add(Block.Words[Slot]);
+			}
+		}
 	}
-	
-	return Data;
-}
-#if WITH_EDITORONLY_DATA
 
-void UPVGPrecomputedGridDataAsset::PreSave(FObjectPreSaveContext SaveContext)
-{
-	Super::PreSave(SaveContext);
+	/* Stored blocks above the diagonal of every block column, as block row and index in it. */
+	void GatherColumns(const TArray<TArray<FBlock>>& BlockRows, TArray<TArray<TPair<int32,int32>>>& OutColumns)
+	{
+		OutColumns.Reset();
+		OutColumns.SetNum(BlockRows.Num());
+		for (int32 Block = 0; Block < BlockRows.Num(); Block++)
+		{
+			for (int32 i = 0; i < BlockRows[Block].Num(); i++)
+			{
+				if (BlockRows[Block][i].Column > Block)
+				{
+					OutColumns[BlockRows[Block][i].Column].Emplace(Block,i);
+				}
+			}
+		}
+	}
 
-	if (GridData.Num() > 0)
+	/* Index and words of the block rows in Rows, of all of them when it is empty. BlockRows holds the blocks on and right
+	 * of the diagonal, blocks left of it whose block row isn't held get stored transposed with the row. */
+	void Assemble(const TArray<TArray<FBlock>>& BlockRows, const TArray<TArray<TPair<int32,int32>>>& Columns, const TArray<int32>& Rows, FPVGPairBlocks& Out)
 	{
-		UE_LOG(LogTemp,Warning,TEXT("Compressing"));
-		// Cube compression.
-		GridCellData.SetNumZeroed(GridData.Num());
+		auto FindRow = [&Rows](int32 Block) { return Rows.Num() > 0 ? Algo::BinarySearch(Rows,Block) : Block; };
+		const int32 NumRows = Rows.Num() > 0 ? Rows.Num() : BlockRows.Num();
+		Out.BlockRows = Rows;
+		Out.RowStart.Reserve(NumRows + 1);
 
-		constexpr int32 NumTasks = 32;
-		const int32 NumPerTask = FMath::DivideAndRoundUp(GridData.Num(), NumTasks);
-	
-		ParallelFor(NumTasks,[&](int32 TaskID)
+		TArray<TArray<TPair<int32,int32>>> HeldColumns;
+		HeldColumns.SetNum(NumRows);
+		FBlock Transposed;
+		for (int32 Row = 0; Row < NumRows; Row++)
 		{
-			const int32 Start = TaskID * NumPerTask;
-			const int32 End = FMath::Min(Start + NumPerTask,GridData.Num());
+			const int32 Block = Rows.Num() > 0 ? Rows[Row] : Row;
+			Out.RowStart.Add(Out.RowColumns.Num());
+			for (const TPair<int32,int32>& Entry : Columns[Block])
+			{
+				if (FindRow(Entry.Key) == INDEX_NONE)
+				{
+					Transpose(BlockRows[Entry.Key][Entry.Value],Entry.Key,Transposed);
+					AddBlock(Transposed,Out);
+				}
+			}
+			for (const FBlock& Stored : BlockRows[Block])
+			{
+				const int32 ColumnRow = Stored.Column > Block ? FindRow(Stored.Column) : INDEX_NONE;
+				if (ColumnRow != INDEX_NONE)
+				{
+					HeldColumns[ColumnRow].Emplace(Block,Out.RowColumns.Num());
+				}
+				AddBlock(Stored,Out);
+			}
+		}
+		Out.RowStart.Add(Out.RowColumns.Num());
 
-			for (int32 i = Start; i < End; i++)
+		Out.ColumnStart.Reserve(NumRows + 1);
+		for (const TArray<TPair<int32,int32>>& Column : HeldColumns)
+		{
+			Out.ColumnStart.Add(Out.ColumnRows.Num());
+			for (const TPair<int32,int32>& Entry : Column)
 			{
-				CubeCompress(GridData[i],GridCellData[i].CellData);
+				Out.ColumnRows.Add(Entry.Key);
+				Out.ColumnBlocks.Add(Entry.Value);
 			}
-		});
+		}
+		Out.ColumnStart.Add(Out.ColumnRows.Num());
 	}
 }
-#endif	
 
-void UPVGPrecomputedGridDataAsset::CubeCompress(const FRawRegionVisibilityData16& InData, TArray<FPackedVisibilityData>& Out)
+bool UPVGPrecomputedGridDataAsset::BuildPairBlocks(bool bPerSector, TArray<FPVGPairBlocks>& OutBlocks)
 {
-	double StartTime = FPlatformTime::Seconds();
-	TArray<FPackedVisibilityData> BoxedEntries;
-	
-	// Entries to ignore.
-	TArray<uint16> SingleEntries;
+	using namespace PVGPairBlocks;
 	
-	int32 CurrentCell = 0;
-	int32 NumEntriesBatched = 1; /* self is 1*/
-	TSet<uint16> Processed;
+	const double StartTime = FPlatformTime::Seconds();
+	const int32 NumBuildCells = GridData.Num();
+	OutBlocks.Reset();
 
-	constexpr bool MinimalMemoryOptimization = true;
-	
-	while ( CurrentCell <  InData.InvisibleRegions.Num())
+	// Hidden build cells of every build cell, leaves were saved expanded to their grid cells.
+	TArray<TArray<int32>> Rows;
+	Rows.SetNum(NumBuildCells);
+	ParallelFor(NumBuildCells,[&](int32 BuildCell)
 	{
-		bool bCanGrowX = true;
-		bool bCanGrowY = true;
-		bool bCanGrowZ = true;
-		
-		uint16 Origin = InData.InvisibleRegions[CurrentCell];
-		
-		uint16 X = 0;
-		uint16 Y = 0;
-		uint16 Z = 0;
-
-		// Add origin.
-		TSet<uint16> Entries;
-		
-		Entries.Add(Origin);
+		TArray<int32>& Row = Rows[BuildCell];
+		for (const int32 Cell : GridData[BuildCell].InvisibleRegions)
+		{
+			Row.Add(GetBuildCellIndex(Cell));
+		}
+		Row.Sort();
+		Row.SetNum(Algo::Unique(Row));
+	});
 
-		/* TODO, we can isolate the known new entries instead of just testing all of them. */
-		while (bCanGrowX || bCanGrowY || bCanGrowZ)
+	// Unreachable cells saved empty rows, they take their pairs from the reachable side and get skipped on lookup.
+	if (ReachableBuildCells.Num() > 0)
+	{
+		for (int32 BuildCell = 0; BuildCell < NumBuildCells; BuildCell++)
 		{
-			if (bCanGrowX)
+			if (!IsBuildCellReachable(BuildCell))
 			{
-				TSet<uint16> TempEntriesX;
-				
-				for (const uint16& Entry : Entries)
+				continue;
+			}
+			for (const int32 Other : Rows[BuildCell])
+			{
+				if (!IsBuildCellReachable(Other))
 				{
-					FIntVector Loc = IndexTo3D(Entry,GetGridSizeX(),GetGridSizeY());
-					const uint16 TestLocation = XYZToIndex(Loc + FIntVector(1,0,0), GetGridSizeX(),GetGridSizeY());
+					Rows[Other].Add(BuildCell);
+				}
+			}
+		}
+	}
 
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (InData.InvisibleRegions.Contains(TestLocation) && (!Processed.Contains(TestLocation) || MinimalMemoryOptimization))
-					{
-						TempEntriesX.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowX = false;
-						break;
-					}
+	// Every block row on its own, only the blocks on or right of the diagonal.
+	const int32 NumBlocks = GetNumPairBlocks();
+	TArray<TArray<FBlock>> BlockRows;
+	BlockRows.SetNum(NumBlocks);
+	ParallelFor(NumBlocks,[&](int32 Block)
+	{
+		TArray<FBlock>& Stored = BlockRows[Block];
+		TMap<int32,int32> ColumnToStored;
+		const uint64 ValidSlots = GetValidPairSlots(Block);
+		for (uint64 Slots = ValidSlots; Slots; Slots &= Slots - 1)
+		{
+			const int32 Slot = int32(FMath::CountTrailingZeros64(Slots));
+			for (const int32 Other : Rows[GetSlotBuildCell(Block,Slot)])
+			{
+				int32 OtherBlock, OtherSlot;
+				GetPairSlot(Other,OtherBlock,OtherSlot);
+				if (OtherBlock < Block)
+				{
+					continue;
 				}
-				
-				if (bCanGrowX)
+
+				int32* Index = ColumnToStored.Find(OtherBlock);
+				if (!Index)
 				{
-					X++;
-					NumEntriesBatched++;
-					Entries.Append(TempEntriesX);
+					Index = &ColumnToStored.Add(OtherBlock,Stored.Num());
+					Stored.AddZeroed_GetRef().Column = OtherBlock;
 				}
+				Stored[*Index].Words[Slot] |= uint64(1) << OtherSlot;
 			}
-			
-			if (bCanGrowY)
+		}
+
+		Stored.Sort([](const FBlock& A, const FBlock& B) { return A.Column < B.Column; });
+		for (FBlock& Entry : Stored)
+		{
+			const uint64 ValidOther = GetValidPairSlots(Entry.Column);
+			Entry.bFull = true;
+			for (uint64 Slots = ValidSlots; Slots && Entry.bFull; Slots &= Slots - 1)
 			{
-				TSet<uint16> TempEntriesY;
+				const int32 Slot = int32(FMath::CountTrailingZeros64(Slots));
+				Entry.bFull = Entry.Words[Slot] == (ValidOther & ~(Entry.Column == Block ? uint64(1) << Slot : 0));
+			}
+		}
+	});
 
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,GetGridSizeX(),GetGridSizeY());
-					const uint16 TestLocation = XYZToIndex(Loc + FIntVector(0,1,0), GetGridSizeX(),GetGridSizeY());
+	int32 NumStored = 0;
+	int32 NumFull = 0;
+	for (const TArray<FBlock>& Stored : BlockRows)
+	{
+		NumStored += Stored.Num();
+		NumFull += Algo::CountIf(Stored,[](const FBlock& Entry) { return Entry.bFull; });
+	}
 
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (InData.InvisibleRegions.Contains(TestLocation) && (!Processed.Contains(TestLocation) || MinimalMemoryOptimization))
-					{
-						TempEntriesY.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowY = false;
-						break;
-					}
-				}
+	TArray<TArray<TPair<int32,int32>>> Columns;
+	GatherColumns(BlockRows,Columns);
+	if (bPerSector)
+	{
+		// Each sector holds the block rows of the blocks whose first cell it has.
+		TArray<TArray<int32>> SectorRows;
+		SectorRows.SetNum(GetNumSectors());
+		for (int32 Block = 0; Block < NumBlocks; Block++)
+		{
+			SectorRows[GetPairBlockSector(Block)].Add(Block);
+		}
+		
+		OutBlocks.SetNum(SectorRows.Num());
+		ParallelFor(SectorRows.Num(),[&](int32 Sector)
+		{
+			if (SectorRows[Sector].Num() > 0)
+			{
+				Assemble(BlockRows,Columns,SectorRows[Sector],OutBlocks[Sector]);
+			}
+		});
+	}
+	else
+	{
+		Assemble(BlockRows,Columns,TArray<int32>(),OutBlocks.AddDefaulted_GetRef());
+	}
 
-				if (bCanGrowY)
-				{
-					Entries.Append(TempEntriesY);
-					NumEntriesBatched++;
-					Y++;
-				}
+	// Measured as saved, cell rows without hidden cells aren't saved with the sector chunks.
+	int64 RowsSize = 0;
+	int64 BlocksSize = 0;
+	{
+		TArray<uint8> Bytes;
+		FMemoryWriter Writer(Bytes);
+		for (int32 BuildCell = 0; BuildCell < GridCellData.Num(); BuildCell++)
+		{
+			FPackedCellData& Packed = GridCellData[BuildCell];
+			if (bPerSector && Packed.CellData.Num() == 0 && Packed.EncodedData.Num() == 0)
+			{
+				continue;
 			}
-			
-			if (bCanGrowZ)
+			if (bPerSector)
 			{
-				TSet<uint16> TempEntriesZ;
+				Writer << BuildCell;
+			}
+			Writer << Packed;
+		}
+		RowsSize = Bytes.Num();
+	}
+	{
+		TArray<uint8> Bytes;
+		FMemoryWriter Writer(Bytes);
+		for (FPVGPairBlocks& Blocks : OutBlocks)
+		{
+			Writer << Blocks;
+		}
+		BlocksSize = Bytes.Num();
+	}
+	
+	UE_LOG(LogTemp,Warning,TEXT("Pair blocks: %d blocks stored, %d of them full, %.1f KB %s against %.1f KB of cell rows, built in %.2f sec."),
+		NumStored,NumFull,BlocksSize / 1024.f,bPerSector ? TEXT("in sector chunks") : TEXT("resident"),RowsSize / 1024.f,FPlatformTime::Seconds() - StartTime);
 
-				for (const uint16& Entry : Entries)
-				{
-					FIntVector Loc = IndexTo3D(Entry,GetGridSizeX(),GetGridSizeY());
-					const uint16 TestLocation = XYZToIndex(Loc + FIntVector(0,0,1), GetGridSizeX(),GetGridSizeY());
+	// Sparse hidden sets can pack tighter per row, keep whichever is smaller.
+	if (BlocksSize >= RowsSize)
+	{
+		OutBlocks.Empty();
+		return false;
+	}
+	return true;
+}
 
-					if (Entries.Contains(TestLocation))
-					{
-						continue;	
-					}
-					
-					if (InData.InvisibleRegions.Contains(TestLocation) && (!Processed.Contains(TestLocation) || MinimalMemoryOptimization))
-					{
-						TempEntriesZ.Add(TestLocation);
-					}
-					else
-					{
-						bCanGrowZ = false;
-						break;
-					}
-				}
+void UPVGPrecomputedGridDataAsset::BuildSectorChunks(bool bStreamed, TArray<FPVGPairBlocks>&& SectorPairBlocks)
+{
+	TArray<TArray<int32>> SectorBuildCells;
+	SectorBuildCells.SetNum(GetNumSectors());
+	for (int32 BuildCell = 0; BuildCell < GridCellData.Num(); BuildCell++)
+	{
+		// Build cells without hidden cells aren't saved, missing from the chunk means nothing is hidden.
+		const FPackedCellData& Packed = GridCellData[BuildCell];
+		if (Packed.CellData.Num() > 0 || Packed.EncodedData.Num() > 0)
+		{
+			SectorBuildCells[GetBuildCellSector(BuildCell)].Add(BuildCell);
+		}
+	}
+
+	ChunkCompressionFormat = NAME_None;
+	if (bAllowRuntimeCompression)
+	{
+		switch (RuntimeCompressionFormat)
+		{
+		case EPVGCompressionFormat::Zlib:	ChunkCompressionFormat = NAME_Zlib; break;
+		case EPVGCompressionFormat::LZ4:	ChunkCompressionFormat = NAME_LZ4; break;
+		default:							ChunkCompressionFormat = NAME_Oodle; break;
+		}
+	}
+
+	TArray<TArray<uint8>> Payloads;
+	Payloads.SetNum(SectorBuildCells.Num());
+	std::atomic<int64> UncompressedSize = 0;
+	std::atomic<int64> TransitionSize = 0;
+	std::atomic<int64> PairBlocksSize = 0;
+	const bool bHasTransitions = TransitionOffsets.Num() == GetNumCells() * 3 + 1;
+	ParallelFor(SectorBuildCells.Num(),[&](int32 Sector)
+	{
+		TArray<uint8> Bytes;
+		FMemoryWriter Writer(Bytes);
+		int32 Num = SectorBuildCells[Sector].Num();
+		Writer << Num;
+		for (int32 BuildCell : SectorBuildCells[Sector])
+		{
+			Writer << BuildCell;
+			Writer << GridCellData[BuildCell];
+		}
 
-				if (bCanGrowZ)
+		// Transitions of the sector's grid cells, they are only needed while the player is around them too.
+		TArray<uint32> Offsets;
+		TArray<uint8> Data;
+		if (bHasTransitions)
+		{
+			const FIntVector Origin = GetSectorOrigin(Sector);
+			const FIntVector Extent = GetSectorExtent(Sector);
+			Offsets.Reserve(Extent.X * Extent.Y * Extent.Z * 3 + 1);
+			for (int32 z = 0; z < Extent.Z; z++)
+			{
+				for (int32 y = 0; y < Extent.Y; y++)
 				{
-					Entries.Append(TempEntriesZ);
-					NumEntriesBatched++;
-					Z++;
+					for (int32 x = 0; x < Extent.X; x++)
+					{
+						const int32 Entry = XYZToIndex(Origin.X + x,Origin.Y + y,Origin.Z + z,GridSizeX,GridSizeY) * 3;
+						for (int32 Axis = 0; Axis < 3; Axis++)
+						{
+							Offsets.Add(Data.Num());
+							Data.Append(TransitionData.GetData() + TransitionOffsets[Entry + Axis],TransitionOffsets[Entry + Axis + 1] - TransitionOffsets[Entry + Axis]);
+						}
+					}
 				}
 			}
+			Offsets.Add(Data.Num());
+			TransitionSize += Offsets.Num() * sizeof(uint32) + Data.Num();
 		}
+		Writer << Offsets;
+		Writer << Data;
 
-		
-		Processed.Append(Entries);
-		
-		int32 Entry = BoxedEntries.Add(FPackedVisibilityData(Origin,X,Y,Z));
-#if WITH_EDITORONLY_DATA && PVG_DEBUG
-		BoxedEntries[Entry].ReflectionData = Entries.Array();
-#endif
-		
-		// Skip cells we have processed already.
-		CurrentCell++;
-		while ( CurrentCell < InData.InvisibleRegions.Num() && Processed.Contains(InData.InvisibleRegions[CurrentCell]))
+		// Block rows of the sector last, chunks without them end after the transitions.
+		if (SectorPairBlocks.Num() > 0)
+		{
+			const int32 Start = Bytes.Num();
+			Writer << SectorPairBlocks[Sector];
+			PairBlocksSize += Bytes.Num() - Start;
+		}
+		UncompressedSize += Bytes.Num();
+
+		if (ChunkCompressionFormat.IsNone())
+		{
+			Payloads[Sector] = MoveTemp(Bytes);
+			return;
+		}
+
+		// Uncompressed size first, then the compressed bytes or the bytes as they are when compressing doesn't help.
+		TArray<uint8>& Payload = Payloads[Sector];
+		int32 RawSize = Bytes.Num();
+		FMemoryWriter SizeWriter(Payload);
+		SizeWriter << RawSize;
+		int32 CompressedSize = FCompression::CompressMemoryBound(ChunkCompressionFormat,RawSize);
+		Payload.AddUninitialized(CompressedSize);
+		if (FCompression::CompressMemory(ChunkCompressionFormat,Payload.GetData() + sizeof(int32),CompressedSize,Bytes.GetData(),RawSize) && CompressedSize < RawSize)
+		{
+			Payload.SetNum(sizeof(int32) + CompressedSize);
+		}
+		else
 		{
-			CurrentCell++;
+			Payload.SetNum(sizeof(int32));
+			Payload.Append(Bytes);
 		}
+	});
+
+	int64 TotalSize = 0;
+	int64 LargestSize = 0;
+	SectorChunks.Empty(Payloads.Num());
+	for (const TArray<uint8>& Payload : Payloads)
+	{
+		// Streamed chunks are kept out of the export, the payload is only read when its sector is requested.
+		FByteBulkData* Chunk = new FByteBulkData();
+		Chunk->SetBulkDataFlags(bStreamed ? BULKDATA_Force_NOT_InlinePayload : BULKDATA_ForceInlinePayload);
+		Chunk->Lock(LOCK_READ_WRITE);
+		FMemory::Memcpy(Chunk->Realloc(Payload.Num()),Payload.GetData(),Payload.Num());
+		Chunk->Unlock();
+		SectorChunks.Add(Chunk);
+
+		TotalSize += Payload.Num();
+		LargestSize = FMath::Max<int64>(LargestSize,Payload.Num());
 	}
 
-	// check boxes
-	int32 NumUnpacked = 0;
-#if 0
+	GridCellData.Empty();
+	TransitionOffsets.Empty();
+	TransitionData.Empty();
+	bStreamedSectors = true;
+	
+	UE_LOG(LogTemp,Warning,TEXT("Sector chunks (%s, %s): %d sectors, %.1f KB in total (%.1f KB uncompressed, %.1f KB of it transitions, %.1f KB pair blocks), largest %.1f KB."),
+		bStreamed ? TEXT("streamed") : TEXT("resident"),ChunkCompressionFormat.IsNone() ? TEXT("uncompressed") : *ChunkCompressionFormat.ToString(),
+		SectorChunks.Num(),TotalSize / 1024.f,UncompressedSize.load() / 1024.f,TransitionSize.load() / 1024.f,PairBlocksSize.load() / 1024.f,LargestSize / 1024.f);
+}
+
+void UPVGPrecomputedGridDataAsset::LoadAllSectors()
+{
+	using namespace PVGPairBlocks;
 	
-	TArray<uint16> unPacked;
-	if (!MinimalMemoryOptimization)
+	if (!bStreamedSectors)
 	{
-		for (int32 i = 0; i < BoxedEntries.Num(); i++)
-		{
-			TArray<uint16> t = FPackedVisibilityData::Unpack(BoxedEntries[i],this);
-			unPacked.Append(t);
-			NumUnpacked += t.Num();
-		}
+		return;
 	}
-	else
+	
+	ResetSectorCache();
+	GridCellData.Reset();
+	if (!bPairBlocks)
+	{
+		GridCellData.SetNum(GetNumBuildCells());
+	}
+
+	// Every block is saved once in its own orientation, with the sector of its block row.
+	TArray<TArray<FBlock>> BlockRows;
+	BlockRows.SetNum(bPairBlocks ? GetNumPairBlocks() : 0);
+	
+	FLoadedSector Loaded;
+	for (int32 Sector = 0; Sector < SectorChunks.Num(); Sector++)
 	{
-		TSet<uint16> UnpackedSet;
-		for (int32 i = 0; i < BoxedEntries.Num(); i++)
+		ReadSectorChunk(Sector,Loaded);
+		for (int32 i = 0; i < Loaded.BuildCells.Num(); i++)
 		{
-			TArray<uint16> t = FPackedVisibilityData::Unpack(BoxedEntries[i],this);
-			UnpackedSet.Append(t);
+			if (GridCellData.IsValidIndex(Loaded.BuildCells[i]))
+			{
+				GridCellData[Loaded.BuildCells[i]] = MoveTemp(Loaded.Cells[i]);
+			}
 		}
-		
-		unPacked = UnpackedSet.Array();
-		NumUnpacked = unPacked.Num();
+
+		const FPVGPairBlocks& Blocks = Loaded.PairBlocks;
+		for (int32 Row = 0; Row + 1 < Blocks.RowStart.Num() && bPairBlocks; Row++)
+		{
+			const int32 Block = Blocks.BlockRows.Num() > 0 ? Blocks.BlockRows[Row] : Row;
+			for (int32 i = Blocks.RowStart[Row]; i < Blocks.RowStart[Row + 1]; i++)
+			{
+				// Left of the diagonal is the copy of a block saved with another sector.
+				if (Blocks.RowColumns[i] < Block)
+				{
+					continue;
+				}
+				
+				FBlock& Stored = BlockRows[Block].AddZeroed_GetRef();
+				Stored.Column = Blocks.RowColumns[i];
+				Stored.bFull = Blocks.RowWords[i] == INDEX_NONE;
+				for (int32 Slot = 0; Slot < 64 && !Stored.bFull; Slot++)
+				{
+					Stored.Words[Slot] = Blocks.GetRowSlots(i,Slot);
+				}
+			}
+		}
+	}
+
+	if (bPairBlocks)
+	{
+		TArray<TArray<TPair<int32,int32>>> Columns;
+		GatherColumns(BlockRows,Columns);
+		PairBlocks = FPVGPairBlocks();
+		Assemble(BlockRows,Columns,TArray<int32>(),PairBlocks);
 	}
+
+	// Gets streamed again on the next save.
+	SectorChunks.Empty();
+	bStreamedSectors = false;
+}
 #endif
+
+void UPVGPrecomputedGridDataAsset::PickCellEncoding(const FRawRegionVisibilityData16& InData, FPackedCellData& Out)
+{
+	Out.Encoding = EPVGCellEncoding::Boxes;
+	Out.EncodedData.Reset();
+	if (InData.InvisibleRegions.Num() == 0)
+	{
+		return;
+	}
 	
-	UE_LOG(LogTemp,Log,TEXT("[%f MS]Boxes: %d ( %.4f kb)vs %d ( %.4f kb )entries, Batched: %d == %d Num Unpacked: %d(debug only) "),
-		(FPlatformTime::Seconds() - StartTime) / 1000.f,	
-		BoxedEntries.Num(),				float(float(BoxedEntries.Num() * sizeof(uint16)) * 4.f / 1000.f),
-		InData.InvisibleRegions.Num(),	float(float(InData.InvisibleRegions.Num() * sizeof(uint16)) / 1000.f),
-		Processed.Num(), InData.InvisibleRegions.Num(),NumUnpacked);
+	TArray<int32> Cells = InData.InvisibleRegions;
+	Cells.Sort();
+	Cells.SetNum(Algo::Unique(Cells));
 
-#if 0
-	// find dupes
-	if (InData.InvisibleRegions.Num() != NumUnpacked)
+	TArray<uint8> Bitset;
 	{
-		TSet<uint16> Relf;
-		bool bDupe = false;
-		for (int32 i = 0 ; i < unPacked.Num(); i++)
+		const int32 NumBits = Cells.Last() - Cells[0] + 1;
+		FPackedCellData::WriteVarint(Bitset,Cells[0]);
+		FPackedCellData::WriteVarint(Bitset,NumBits);
+		const int32 Offset = Bitset.Num();
+		Bitset.AddZeroed(FMath::DivideAndRoundUp(NumBits,8));
+		for (const int32 Cell : Cells)
 		{
-			Relf.Add(unPacked[i],&bDupe);
-			if (bDupe)
+			const int32 Bit = Cell - Cells[0];
+			Bitset[Offset + (Bit >> 3)] |= 1 << (Bit & 7);
+		}
+	}
+
+	TArray<uint8> RunLength;
+	TArray<uint8> Deltas;
+	{
+		int32 RunEnd = 0;
+		int32 Previous = -1;
+		for (int32 i = 0; i < Cells.Num();)
+		{
+			int32 Num = 1;
+			while (i + Num < Cells.Num() && Cells[i + Num] == Cells[i] + Num)
+			{
+				Num++;
+			}
+			FPackedCellData::WriteVarint(RunLength,Cells[i] - RunEnd);
+			FPackedCellData::WriteVarint(RunLength,Num);
+			RunEnd = Cells[i] + Num;
+
+			for (int32 j = i; j < i + Num; j++)
 			{
-				UE_LOG(LogTemp,Warning,TEXT("Dupe!"));
+				FPackedCellData::WriteVarint(Deltas,Cells[j] - Previous - 1);
+				Previous = Cells[j];
 			}
+			i += Num;
 		}
 	}
+
+	// Ties stay boxes, they are the cheapest to walk.
+	int32 BestSize = Out.CellData.Num() * 4 * sizeof(uint16);
+	TArray<uint8>* Best = nullptr;
+	auto Consider = [&](EPVGCellEncoding Encoding, TArray<uint8>& Data)
+	{
+		if (Data.Num() < BestSize)
+		{
+			BestSize = Data.Num();
+			Best = &Data;
+			Out.Encoding = Encoding;
+		}
+	};
+	Consider(EPVGCellEncoding::Bitset,Bitset);
+	Consider(EPVGCellEncoding::RunLength,RunLength);
+	Consider(EPVGCellEncoding::Deltas,Deltas);
+
+	if (Best)
+	{
+		Out.CellData.Empty();
+		Out.EncodedData = MoveTemp(*Best);
+	}
+}
+
+void UPVGPrecomputedGridDataAsset::CubeCompress(const FRawRegionVisibilityData16& InData, TArray<FPackedVisibilityData>& Out)
+{
+	const FIntVector GridSize(GetGridSizeX(),GetGridSizeY(),GetGridSizeZ());
+	const FIntVector SectorSize = GetSectorSize();
+	const bool bSingleSector = GetNumSectors() == 1;
+
+	// Group by sector, boxes never cross a sector border.
+	TArray<TPair<int32,int32>> SectorCells;
+	SectorCells.Reserve(InData.InvisibleRegions.Num());
+	for (const int32 Region : InData.InvisibleRegions)
+	{
+		const FIntVector Cell = IndexTo3D(Region,GridSize.X,GridSize.Y);
+		const int32 Sector = GetSectorIndex(Cell);
+		SectorCells.Emplace(Sector,XYZToIndex(Cell - GetSectorOrigin(Sector),SectorSize.X,SectorSize.Y));
+	}
+	SectorCells.Sort();
+
+	Out.Reset();
+	FPVGBitVolume Cells;
+	TArray<FPVGCellBox> Boxes;
+	for (int32 i = 0; i < SectorCells.Num();)
+	{
+		const int32 Sector = SectorCells[i].Key;
+		const FIntVector SectorOrigin = GetSectorOrigin(Sector);
+		Cells.Init(FIntVector(
+			FMath::Min(SectorSize.X,GridSize.X - SectorOrigin.X),
+			FMath::Min(SectorSize.Y,GridSize.Y - SectorOrigin.Y),
+			FMath::Min(SectorSize.Z,GridSize.Z - SectorOrigin.Z)));
+		
+		for (; i < SectorCells.Num() && SectorCells[i].Key == Sector; i++)
+		{
+			const FIntVector Local = IndexTo3D(SectorCells[i].Value,SectorSize.X,SectorSize.Y);
+			Cells.Set(Local.X,Local.Y,Local.Z);
+		}
+
+		// Overlapping boxes are fine here, a cell hidden twice is still hidden.
+		FPVGBoxDecomposition::Decompose(Cells,UPVGDeveloperSettings::GetBoxPacking(),true,Boxes);
+
+		if (!bSingleSector)
+		{
+			Out.Add(FPackedVisibilityData::MakeSectorMarker(Sector));
+		}
+		
+		for (const FPVGCellBox& Box : Boxes)
+		{
+			const FIntVector Size = Box.Max - Box.Min;
+			const int32 Entry = Out.Add(FPackedVisibilityData(XYZToIndex(Box.Min,SectorSize.X,SectorSize.Y),Size.X,Size.Y,Size.Z));
+#if WITH_EDITORONLY_DATA && PVG_DEBUG
+			FPackedVisibilityData::Unpack(Out[Entry],SectorOrigin,this,Out[Entry].ReflectionData);
 #endif
-	Out = BoxedEntries;
+		}
+	}
 }
 
 #if WITH_EDITOR
+void UPVGPrecomputedGridDataAsset::InitializeGrid(FIntVector GridSize, const FVector& InCellExtents, const FBox& InGridBounds,
+	const TArray<uint64>& InLeafCodes, const TArray<uint8>& InLeafLevels)
+{
+	Modify();
+	
+	GridSizeX = GridSize.X;
+	GridSizeY = GridSize.Y;
+	GridSizeZ = GridSize.Z;
+	CellExtents = InCellExtents;
+
+	// Small grids stay a single sector, larger ones get split in columns of less than MAX_uint16 cells.
+	if (int64(GridSize.X) * GridSize.Y * GridSize.Z < MAX_uint16)
+	{
+		SectorSize = GridSize;
+	}
+	else
+	{
+		const int32 SectorSizeZ = FMath::Min(GridSize.Z,256);
+		const int32 SectorSizeXY = FMath::Max(1,FMath::FloorToInt(FMath::Sqrt(float(MAX_uint16 - 1) / SectorSizeZ)));
+		SectorSize = FIntVector(FMath::Min(SectorSizeXY,GridSize.X),FMath::Min(SectorSizeXY,GridSize.Y),SectorSizeZ);
+	}
+	GridBounds = InGridBounds;
+	LeafCodes = InLeafCodes;
+	LeafLevels = InLeafLevels;
+
+	// Setup pair state, the per cell arrays get rebuilt from it on save.
+	GridData.Empty();
+	PairMatrix.Init(GetNumBuildCells());
+}
+
+void UPVGPrecomputedGridDataAsset::SetReachableBuildCells(const TBitArray<>& Reachable)
+{
+	ReachableBuildCells.Empty();
+	if (Reachable.Num() == 0 || Reachable.Find(false) == INDEX_NONE)
+	{
+		return;
+	}
+	
+	ReachableBuildCells.SetNumZeroed(FMath::DivideAndRoundUp(Reachable.Num(),64));
+	for (TConstSetBitIterator<> It(Reachable); It; ++It)
+	{
+		ReachableBuildCells[It.GetIndex() >> 6] |= uint64(1) << (It.GetIndex() & 63);
+	}
+}
+
 void UPVGPrecomputedGridDataAsset::SetDataCell(int32 Cell, int32 InvisibleRegion, bool bVisible)
 {
 	if (Cell == InvisibleRegion)
@@ -280,13 +1732,11 @@ void UPVGPrecomputedGridDataAsset::SetDataCell(int32 Cell, int32 InvisibleRegion
 	
 	if (bVisible)
 	{
-		GridData[Cell].VisibleRegions.Add(InvisibleRegion);
-		GridData[InvisibleRegion].VisibleRegions.Add(Cell);
+		PairMatrix.SetVisible(Cell,InvisibleRegion);
 	}
 	else
 	{
-		GridData[Cell].InvisibleRegions.Add(InvisibleRegion);
-		GridData[InvisibleRegion].InvisibleRegions.Add(Cell);
+		PairMatrix.SetOccluded(Cell,InvisibleRegion);
 	}
 }
 #endif
@@ -0,0 +1,120 @@
+#include "PVGRaySampler.h"
+
+FPVGRaySampler::FPVGRaySampler(const FBox& Source, const FBox& Target, uint32 Seed)
+	: SourceBox(Source)
+	, TargetBox(Target)
+{
+	GatherFaces(Source,Target,SourceFaces);
+	GatherFaces(Target,Source,TargetFaces);
+
+	const FRandomStream Stream(int32(Seed));
+	for (float& Value : Rotation)
+	{
+		Value = Stream.GetFraction();
+	}
+}
+
+void FPVGRaySampler::GetRay(uint32 Index, FVector& OutStart, FVector& OutEnd) const
+{
+	// Skip the first entry, all dimensions are 0 there.
+	Index++;
+	
+	constexpr uint32 Bases[6] = {2,3,5,7,11,13};
+	float Sample[6];
+	for (int32 i = 0; i < 6; i++)
+	{
+		Sample[i] = FMath::Frac(RadicalInverse(Index,Bases[i]) + Rotation[i]);
+	}
+
+	OutStart = SampleFaces(SourceFaces,SourceBox,Sample[0],Sample[1],Sample[2]);
+	OutEnd = SampleFaces(TargetFaces,TargetBox,Sample[3],Sample[4],Sample[5]);
+}
+
+int32 FPVGRaySampler::GetRequiredRays(float Confidence, float MinVisibleFraction, int32 MaxRays)
+{
+	Confidence = FMath::Clamp(Confidence,0.f,0.999999f);
+	MinVisibleFraction = FMath::Clamp(MinVisibleFraction,1e-6f,1.f);
+
+	// Chance that N rays all miss a visible fraction p is (1-p)^N.
+	if (MinVisibleFraction >= 1.f)
+	{
+		return 1;
+	}
+	const double NumRays = FMath::Loge(1.0 - Confidence) / FMath::Loge(1.0 - MinVisibleFraction);
+	return FMath::Clamp(FMath::CeilToInt(NumRays),1,FMath::Max(1,MaxRays));
+}
+
+void FPVGRaySampler::GatherFaces(const FBox& Box, const FBox& Other, FFaceArray& OutFaces)
+{
+	const FVector Size = Box.GetSize();
+	float TotalWeight = 0;
+	
+	for (int32 Axis = 0; Axis < 3; Axis++)
+	{
+		const int32 AxisU = (Axis + 1) % 3;
+		const int32 AxisV = (Axis + 2) % 3;
+		
+		for (int32 Side = 0; Side < 2; Side++)
+		{
+			// A segment can only pass the max face if the other box reaches beyond it, same for min.
+			// Any unblocked segment between both boxes contains an unblocked part between two of these faces.
+			const bool bMaxFace = Side == 1;
+			const bool bUsed = bMaxFace ? Other.Max[Axis] > Box.Max[Axis] : Other.Min[Axis] < Box.Min[Axis];
+			if (!bUsed)
+			{
+				continue;
+			}
+
+			FFace& Face = OutFaces.AddDefaulted_GetRef();
+			Face.Origin = Box.Min;
+			Face.Origin[Axis] = bMaxFace ? Box.Max[Axis] : Box.Min[Axis];
+			Face.AxisU = FVector::ZeroVector;
+			Face.AxisU[AxisU] = Size[AxisU];
+			Face.AxisV = FVector::ZeroVector;
+			Face.AxisV[AxisV] = Size[AxisV];
+			
+			TotalWeight += Size[AxisU] * Size[AxisV];
+			Face.CumulativeWeight = TotalWeight;
+		}
+	}
+
+	for (FFace& Face : OutFaces)
+	{
+		Face.CumulativeWeight /= TotalWeight;
+	}
+}
+
+FVector FPVGRaySampler::SampleFaces(const FFaceArray& Faces, const FBox& Fallback, float Selector, float U, float V)
+{
+	// Overlapping boxes, fall back to the volume.
+	if (Faces.Num() == 0)
+	{
+		return Fallback.Min + Fallback.GetSize() * FVector(Selector,U,V);
+	}
+	
+	for (const FFace& Face : Faces)
+	{
+		if (Selector < Face.CumulativeWeight)
+		{
+			return Face.Origin + Face.AxisU * U + Face.AxisV * V;
+		}
+	}
+	
+	const FFace& Face = Faces.Last();
+	return Face.Origin + Face.AxisU * U + Face.AxisV * V;
+}
+
+float FPVGRaySampler::RadicalInverse(uint32 Index, uint32 Base)
+{
+	const float InvBase = 1.f / Base;
+	float Fraction = InvBase;
+	float Result = 0;
+	
+	while (Index > 0)
+	{
+		Result += (Index % Base) * Fraction;
+		Index /= Base;
+		Fraction *= InvBase;
+	}
+	return Result;
+}
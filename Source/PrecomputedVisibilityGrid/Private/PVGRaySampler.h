@@ -0,0 +1,51 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+/*
+ * Generates the shotgun rays between two cell boxes.
+ * Ray end points lie on the faces a segment between both boxes can leave the source box through and enter the target
+ * box through. They follow a scrambled Halton sequence so the rays cover those faces evenly, and the same pair and
+ * seed always produce the same rays.
+ */
+class FPVGRaySampler
+{
+public:
+	FPVGRaySampler(const FBox& Source, const FBox& Target, uint32 Seed);
+
+	/* Ray Index of the sequence. */
+	void GetRay(uint32 Index, FVector& OutStart, FVector& OutEnd) const;
+
+	/* Amount of blocked rays needed before we can say, with the given confidence, that less than MinVisibleFraction
+	 * of the rays between both boxes could get through. */
+	static int32 GetRequiredRays(float Confidence, float MinVisibleFraction, int32 MaxRays);
+
+private:
+	struct FFace
+	{
+		FVector Origin;
+		FVector AxisU;
+		FVector AxisV;
+
+		/* Running sum of the face weights, used to pick a face from a single random value. */
+		float CumulativeWeight;
+	};
+	
+	typedef TArray<FFace,TInlineAllocator<6>> FFaceArray;
+
+	/* Faces of Box a segment between Box and Other can pass through. */
+	static void GatherFaces(const FBox& Box, const FBox& Other, FFaceArray& OutFaces);
+
+	static FVector SampleFaces(const FFaceArray& Faces, const FBox& Fallback, float Selector, float U, float V);
+
+	static float RadicalInverse(uint32 Index, uint32 Base);
+
+	FBox SourceBox;
+	FBox TargetBox;
+	
+	FFaceArray SourceFaces;
+	FFaceArray TargetFaces;
+
+	/* Cranley-Patterson rotation per dimension, derived from the seed. */
+	float Rotation[6];
+};
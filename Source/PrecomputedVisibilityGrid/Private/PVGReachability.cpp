@@ -0,0 +1,149 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGReachability.h"
+
+#include "EngineUtils.h"
+#include "NavigationSystem.h"
+#include "PrecomputedVisibilityGrid.h"
+#include "Async/ParallelFor.h"
+#include "GameFramework/PlayerStart.h"
+
+void FPVGReachability::Build(UWorld* World, EPVGReachability Mode, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, float MaxCameraHeight,
+	const TArray<EPVGOccupancy>& CellOccupancy, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, TBitArray<>& OutReachable)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	const int32 NumCells = GridSize.X * GridSize.Y * GridSize.Z;
+
+	bool bSuccess = false;
+	switch (Mode)
+	{
+	case EPVGReachability::NavMesh:
+		bSuccess = BuildFromNavMesh(World,GridSize,GridOrigin,CellSize,MaxCameraHeight,OutReachable);
+		break;
+	case EPVGReachability::FloodFill:
+		bSuccess = BuildFromFloodFill(World,GridSize,GridOrigin,CellSize,MaxCameraHeight,CellOccupancy,QueryParams,ResponseParams,OutReachable);
+		break;
+	default:
+		break;
+	}
+
+	if (!bSuccess)
+	{
+		OutReachable.Init(true,NumCells);
+		return;
+	}
+
+	UE_LOG(LogTemp,Warning,TEXT("Reachability: %d of %d cells are camera cells, found in %.2f sec."),
+		OutReachable.CountSetBits(),NumCells,FPlatformTime::Seconds() - StartTime);
+}
+
+bool FPVGReachability::BuildFromNavMesh(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, float MaxCameraHeight, TBitArray<>& OutReachable)
+{
+	const UNavigationSystemV1* NavSystem = FNavigationSystem::GetCurrent<UNavigationSystemV1>(World);
+	if (!NavSystem || !NavSystem->GetDefaultNavDataInstance(FNavigationSystem::DontCreate))
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Reachability: no nav mesh in the world, building from every cell."));
+		return false;
+	}
+
+	// Query box spans the cell and MaxCameraHeight below it, any nav mesh in there can put a camera in the cell.
+	const FVector QueryExtent = CellSize * 0.5f + FVector(0,0,MaxCameraHeight * 0.5f);
+	const FVector QueryOffset(0,0,-MaxCameraHeight * 0.5f);
+	
+	OutReachable.Init(false,GridSize.X * GridSize.Y * GridSize.Z);
+	for (int32 Cell = 0; Cell < OutReachable.Num(); Cell++)
+	{
+		const FVector Center = GridOrigin + (FVector(IndexTo3D(Cell,GridSize.X,GridSize.Y)) + FVector(0.5f)) * CellSize;
+		
+		FNavLocation NavLocation;
+		if (NavSystem->ProjectPointToNavigation(Center + QueryOffset,NavLocation,QueryExtent))
+		{
+			OutReachable[Cell] = true;
+		}
+	}
+	return true;
+}
+
+bool FPVGReachability::BuildFromFloodFill(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, float MaxCameraHeight,
+	const TArray<EPVGOccupancy>& CellOccupancy, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, TBitArray<>& OutReachable)
+{
+	const int32 NumCells = GridSize.X * GridSize.Y * GridSize.Z;
+
+	auto GetCellOf = [&](const FVector& Location)
+	{
+		const FVector Local = (Location - GridOrigin) / CellSize;
+		const FIntVector XYZ(FMath::FloorToInt(Local.X),FMath::FloorToInt(Local.Y),FMath::FloorToInt(Local.Z));
+		if (XYZ.X < 0 || XYZ.Y < 0 || XYZ.Z < 0 || XYZ.X >= GridSize.X || XYZ.Y >= GridSize.Y || XYZ.Z >= GridSize.Z)
+		{
+			return int32(INDEX_NONE);
+		}
+		return XYZToIndex(XYZ,GridSize.X,GridSize.Y);
+	};
+
+	TArray<int32> Queue;
+	for (TActorIterator<APlayerStart> It(World); It; ++It)
+	{
+		const int32 Cell = GetCellOf(It->GetActorLocation());
+		if (Cell != INDEX_NONE)
+		{
+			Queue.AddUnique(Cell);
+		}
+	}
+
+	if (Queue.Num() == 0)
+	{
+		UE_LOG(LogTemp,Warning,TEXT("Reachability: no player start inside the grid, building from every cell."));
+		return false;
+	}
+
+	// A camera can be in any cell that isn't buried and has ground close enough below it.
+	TArray<bool> Open;
+	Open.SetNumZeroed(NumCells);
+	ParallelFor(NumCells,[&](int32 Cell)
+	{
+		const FVector Min = GridOrigin + FVector(IndexTo3D(Cell,GridSize.X,GridSize.Y)) * CellSize;
+		const FBox Box(Min,Min + CellSize);
+		
+		const EPVGOccupancy Occupancy = CellOccupancy[Cell];
+		Open[Cell] = Occupancy == EPVGOccupancy::Partial;
+		if (Occupancy == EPVGOccupancy::Empty)
+		{
+			const FVector Start = Box.GetCenter();
+			const FVector End(Start.X,Start.Y,Box.Min.Z - MaxCameraHeight);
+			Open[Cell] = World->LineTraceTestByChannel(Start,End,ECC_Visibility,QueryParams,ResponseParams);
+		}
+	},EParallelForFlags::Unbalanced);
+
+	OutReachable.Init(false,NumCells);
+	for (const int32 Seed : Queue)
+	{
+		OutReachable[Seed] = true;
+	}
+
+	static const FIntVector Neighbours[6] = {
+		FIntVector(1,0,0),FIntVector(-1,0,0),
+		FIntVector(0,1,0),FIntVector(0,-1,0),
+		FIntVector(0,0,1),FIntVector(0,0,-1)};
+	
+	while (Queue.Num() > 0)
+	{
+		const FIntVector XYZ = IndexTo3D(Queue.Pop(),GridSize.X,GridSize.Y);
+		for (const FIntVector& Offset : Neighbours)
+		{
+			const FIntVector Next = XYZ + Offset;
+			if (Next.X < 0 || Next.Y < 0 || Next.Z < 0 || Next.X >= GridSize.X || Next.Y >= GridSize.Y || Next.Z >= GridSize.Z)
+			{
+				continue;
+			}
+			
+			const int32 NextCell = XYZToIndex(Next,GridSize.X,GridSize.Y);
+			if (Open[NextCell] && !OutReachable[NextCell])
+			{
+				OutReachable[NextCell] = true;
+				Queue.Add(NextCell);
+			}
+		}
+	}
+	return true;
+}
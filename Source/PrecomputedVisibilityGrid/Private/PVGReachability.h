@@ -0,0 +1,36 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "PVGOccupancyVolume.h"
+#include "PVGReachability.generated.h"
+
+UENUM()
+enum class EPVGReachability : uint8
+{
+	/* Every cell is a camera cell. */
+	Disabled,
+	/* Cells with nav mesh at most MaxCameraHeight below them. */
+	NavMesh,
+	/* Cells connected to a player start through open cells that have ground at most MaxCameraHeight below them. */
+	FloodFill,
+};
+
+/*
+ * Finds the grid cells a player camera can actually be in. Visibility only needs to be solved from those,
+ * the other cells are still targets.
+ */
+struct FPVGReachability
+{
+	/* Sets a bit for every reachable grid cell. Falls back to all cells reachable when the mode has nothing to work with.
+	 * The flood fill needs the occupancy of every cell, see FPVGOccupancyVolume::ClassifyCells. */
+	static void Build(UWorld* World, EPVGReachability Mode, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, float MaxCameraHeight,
+		const TArray<EPVGOccupancy>& CellOccupancy, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, TBitArray<>& OutReachable);
+
+private:
+	static bool BuildFromNavMesh(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, float MaxCameraHeight, TBitArray<>& OutReachable);
+	
+	static bool BuildFromFloodFill(UWorld* World, const FIntVector& GridSize, const FVector& GridOrigin, const FVector& CellSize, float MaxCameraHeight,
+		const TArray<EPVGOccupancy>& CellOccupancy, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, TBitArray<>& OutReachable);
+};
@@ -0,0 +1,108 @@
+#include "PVGRegression.h"
+
+#include "PVGPrecomputedGridDataAsset.h"
+#include "HAL/FileManager.h"
+
+namespace PVGRegression
+{
+	constexpr uint32 Magic = 0x50564752; // "PVGR"
+	constexpr int32 Version = 1;
+	constexpr int32 MaxReportedPairs = 32;
+
+	FArchive& operator<<(FArchive& Ar, FGolden& Golden)
+	{
+		uint32 FileMagic = Magic;
+		int32 FileVersion = Version;
+		Ar << FileMagic;
+		Ar << FileVersion;
+		if (Ar.IsLoading() && (FileMagic != Magic || FileVersion != Version))
+		{
+			Ar.SetError();
+			return Ar;
+		}
+		Ar << Golden.GridSignature;
+		Ar << Golden.HiddenCells;
+		return Ar;
+	}
+
+	void Capture(const UPVGPrecomputedGridDataAsset* Asset, FGolden& Out)
+	{
+		Out.GridSignature = Asset->GetGridSignature();
+		Out.HiddenCells.SetNum(Asset->GetNumCells());
+		for (int32 Cell = 0; Cell < Asset->GetNumCells(); Cell++)
+		{
+			Out.HiddenCells[Cell] = Asset->GetCellData(Cell);
+			Out.HiddenCells[Cell].Sort();
+		}
+	}
+
+	bool LoadGolden(const FString& Filename, FGolden& Out)
+	{
+		TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Filename));
+		if (!Reader)
+		{
+			UE_LOG(LogTemp, Error, TEXT("No golden file '%s', create one with -run=PVGRegression -Update."), *Filename);
+			return false;
+		}
+		*Reader << Out;
+		if (Reader->IsError())
+		{
+			UE_LOG(LogTemp, Error, TEXT("Golden file '%s' is broken or from an older version."), *Filename);
+			return false;
+		}
+		return true;
+	}
+
+	bool SaveGolden(const FString& Filename, FGolden& Golden)
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*Filename));
+		if (!Writer)
+		{
+			UE_LOG(LogTemp, Error, TEXT("Couldn't write golden file '%s'."), *Filename);
+			return false;
+		}
+		*Writer << Golden;
+		return Writer->Close();
+	}
+
+	FComparison Compare(const FGolden& Golden, const FGolden& Result)
+	{
+		FComparison Comparison;
+		Comparison.bLayoutMatches = Golden.GridSignature == Result.GridSignature && Golden.HiddenCells.Num() == Result.HiddenCells.Num();
+		if (!Comparison.bLayoutMatches)
+		{
+			return Comparison;
+		}
+
+		for (int32 Cell = 0; Cell < Result.HiddenCells.Num(); Cell++)
+		{
+			const TArray<int32>& Expected = Golden.HiddenCells[Cell];
+			const TArray<int32>& Actual = Result.HiddenCells[Cell];
+			Comparison.NumGoldenHidden += Expected.Num();
+
+			int32 i = 0, j = 0;
+			while (i < Expected.Num() || j < Actual.Num())
+			{
+				if (j == Actual.Num() || (i < Expected.Num() && Expected[i] < Actual[j]))
+				{
+					Comparison.NumLostHidden++;
+					i++;
+				}
+				else if (i == Expected.Num() || Actual[j] < Expected[i])
+				{
+					if (Comparison.NumWronglyHidden++ < MaxReportedPairs)
+					{
+						Comparison.WronglyHidden.Emplace(Cell, Actual[j]);
+					}
+					j++;
+				}
+				else
+				{
+					i++;
+					j++;
+				}
+			}
+		}
+		return Comparison;
+	}
+}
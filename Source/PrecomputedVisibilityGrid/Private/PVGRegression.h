@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class UPVGPrecomputedGridDataAsset;
+
+/* Golden file handling shared by the regression commandlet and the regression automation test. */
+namespace PVGRegression
+{
+	/* Sorted hidden grid cells of every grid cell. */
+	struct FGolden
+	{
+		uint32 GridSignature = 0;
+		TArray<TArray<int32>> HiddenCells;
+
+		friend FArchive& operator<<(FArchive& Ar, FGolden& Golden);
+	};
+
+	struct FComparison
+	{
+		bool bLayoutMatches = false;
+		int64 NumWronglyHidden = 0;
+		int64 NumLostHidden = 0;
+		int64 NumGoldenHidden = 0;
+
+		/* The first wrongly hidden pairs, (cell, hidden cell). */
+		TArray<FIntPoint> WronglyHidden;
+	};
+
+	void Capture(const UPVGPrecomputedGridDataAsset* Asset, FGolden& Out);
+
+	/* Both log why they failed. */
+	bool LoadGolden(const FString& Filename, FGolden& Out);
+	bool SaveGolden(const FString& Filename, FGolden& Golden);
+
+	/* Wrongly hidden cells pop out of view in game, lost hidden cells only cost performance. */
+	FComparison Compare(const FGolden& Golden, const FGolden& Result);
+}
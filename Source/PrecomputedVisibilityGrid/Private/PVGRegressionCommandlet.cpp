@@ -0,0 +1,96 @@
+#include "PVGRegressionCommandlet.h"
+
+#include "PVGBuilderCommandlet.h"
+#include "PVGDeveloperSettings.h"
+#include "PVGPrecomputedGridDataAsset.h"
+#include "PVGRegression.h"
+#include "HAL/FileManager.h"
+#include "Misc/Paths.h"
+#include "UObject/GCObjectScopeGuard.h"
+
+UPVGRegressionCommandlet::UPVGRegressionCommandlet(const FObjectInitializer& ObjectInitializer) : Super(ObjectInitializer)
+{}
+
+int32 UPVGRegressionCommandlet::Main(const FString& Params)
+{
+	TArray<FString> Tokens, Switches;
+	ParseCommandLine(*Params, Tokens, Switches);
+
+	if (Tokens.Num() != 1)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Missing world name"));
+		return 1;
+	}
+
+	UWorld* World = UPVGPrecomputedGridBuilder::LoadWorld(Tokens[0]);
+	if (!World)
+	{
+		return 1;
+	}
+
+	// Always a full build, rays are seeded per pair so the same settings give the same result on every machine.
+	UPVGPrecomputedGridBuilder* Builder = NewObject<UPVGPrecomputedGridBuilder>(GetTransientPackage());
+	FGCObjectScopeGuard BuilderGuard(Builder);
+
+	const double StartTime = FPlatformTime::Seconds();
+	if (!Builder->RunBuilder(World, FPVGBuildOptions()) || !Builder->BuiltAsset)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Build of '%s' failed."), *Tokens[0]);
+		return 1;
+	}
+	const double BuildTime = FPlatformTime::Seconds() - StartTime;
+
+	const UPVGPrecomputedGridDataAsset* Asset = Builder->BuiltAsset;
+	const int64 NumBuildCells = Asset->GetNumBuildCells();
+	const int64 NumPairs = NumBuildCells * (NumBuildCells - 1) / 2;
+	const FString PackageFileName = FPackageName::LongPackageNameToFilename(Asset->GetPackage()->GetName(), FPackageName::GetAssetPackageExtension());
+	const int64 AssetSize = IFileManager::Get().FileSize(*PackageFileName);
+
+	UE_LOG(LogTemp, Display, TEXT("Built %lld pairs of %s (%s) in %.2f sec, %.0f pairs/sec. Asset size %.1f KB."),
+		NumPairs, *Asset->GetName(), *StaticEnum<EPVGBuildMode>()->GetNameStringByValue((int64)UPVGDeveloperSettings::GetBuildMode()),
+		BuildTime, BuildTime > 0 ? NumPairs / BuildTime : 0.0, AssetSize / 1024.0);
+
+	PVGRegression::FGolden Result;
+	PVGRegression::Capture(Asset, Result);
+
+	FString GoldenFile = FPaths::ProjectDir() / TEXT("PVGGolden") / Asset->GetName() + TEXT(".pvggolden");
+	FParse::Value(*Params, TEXT("Golden="), GoldenFile);
+
+	if (Switches.Contains(TEXT("Update")))
+	{
+		if (!PVGRegression::SaveGolden(GoldenFile, Result))
+		{
+			return 1;
+		}
+		UE_LOG(LogTemp, Display, TEXT("Golden file '%s' updated."), *GoldenFile);
+		return 0;
+	}
+
+	PVGRegression::FGolden Golden;
+	if (!PVGRegression::LoadGolden(GoldenFile, Golden))
+	{
+		return 1;
+	}
+
+	const PVGRegression::FComparison Comparison = PVGRegression::Compare(Golden, Result);
+	if (!Comparison.bLayoutMatches)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Grid layout changed since the golden file was written, update it with -Update."));
+		return 1;
+	}
+
+	for (const FIntPoint& Pair : Comparison.WronglyHidden)
+	{
+		UE_LOG(LogTemp, Error, TEXT("Cell %d hides cell %d, which the golden file has visible."), Pair.X, Pair.Y);
+	}
+
+	UE_LOG(LogTemp, Display, TEXT("Compared %d cells against '%s': %lld wrongly hidden, %lld of %lld hidden cells lost."),
+		Result.HiddenCells.Num(), *GoldenFile, Comparison.NumWronglyHidden, Comparison.NumLostHidden, Comparison.NumGoldenHidden);
+
+	if (Comparison.NumWronglyHidden > 0)
+	{
+		UE_LOG(LogTemp, Error, TEXT("%lld cell pairs became wrongly hidden."), Comparison.NumWronglyHidden);
+		return 1;
+	}
+	return 0;
+}
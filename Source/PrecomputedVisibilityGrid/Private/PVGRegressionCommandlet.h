@@ -0,0 +1,20 @@
+#pragma once
+#include "Commandlets/Commandlet.h"
+#include "PVGRegressionCommandlet.generated.h"
+
+/*
+ * Builds a reference map and compares the visibility of every grid cell against a golden file.
+ * Cells that are hidden now but were visible in the golden file fail the run, cells that lost culling are only reported.
+ * Also logs the builder throughput and the asset size, so optimizations can be checked for speed and correctness at once.
+ * Usage: -run=PVGRegression <World> [-Golden=File] [-Update]
+ *	-Golden		Golden file to compare against, defaults to <Project>/PVGGolden/<Asset>.pvggolden.
+ *	-Update		Write the result as the new golden file instead of comparing.
+ * The PrecomputedVisibilityGrid.Regression.ReferenceScene automation test runs the same comparison without a map or
+ * golden file, on a scene it spawns whose visibility is known up front.
+ */
+UCLASS()
+class UPVGRegressionCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+	virtual int32 Main(const FString& Params) override;
+};
@@ -0,0 +1,308 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGSoftwareOcclusion.h"
+
+namespace PVGSoftwareOcclusion
+{
+	int32 GetMipOffset(int32 Level)
+	{
+		int32 Offset = 0;
+		for (int32 i = 0; i < Level; i++)
+		{
+			Offset += (FPVGSoftwareOcclusion::Resolution >> i) * (FPVGSoftwareOcclusion::Resolution >> i);
+		}
+		return Offset;
+	}
+	
+	// Corner indices of FBox::GetVertices per face, in winding order.
+	constexpr uint8 QuadFaces[6][4] {{0,1,6,2},{3,5,7,4},{0,1,5,3},{2,6,7,4},{0,2,4,3},{1,6,7,5}};
+}
+
+bool FPVGSoftwareOcclusion::SetupView(const FVector& InSource, const FBox& InTargetBox)
+{
+	Source = InSource;
+	TargetBox = InTargetBox;
+
+	const FVector ToTarget = TargetBox.GetCenter() - Source;
+	const double Distance = ToTarget.Size();
+	const double Radius = TargetBox.GetExtent().Size();
+	if (Distance <= Radius * 1.01)
+	{
+		return false;
+	}
+
+	Forward = ToTarget / Distance;
+	Forward.FindBestAxisVectors(Right,Up);
+
+	// Fit the view around the bounding sphere of the target.
+	const double TanHalfFOV = Radius / FMath::Sqrt(Distance * Distance - Radius * Radius) * 1.05;
+	InvTanHalfFOV = 1.0 / TanHalfFOV;
+
+	// Reversed-Z, zero is infinitely far away.
+	FMemory::Memzero(Depth);
+	return true;
+}
+
+void FPVGSoftwareOcclusion::RenderBox(const FBox& Box)
+{
+	FVector Corners[8];
+	Box.GetVertices(Corners);
+
+	FVector ViewCorners[8];
+	uint32 OutsideAll = 0x1F;
+	for (int32 i = 0; i < 8; i++)
+	{
+		const FVector& V = ViewCorners[i] = ToView(Corners[i]);
+		const double X = V.X * InvTanHalfFOV;
+		const double Y = V.Y * InvTanHalfFOV;
+		
+		uint32 Outside = 0;
+		Outside |= V.Z < NearPlane ? 1 : 0;
+		Outside |= X < -V.Z ? 2 : 0;
+		Outside |= X > V.Z ? 4 : 0;
+		Outside |= Y < -V.Z ? 8 : 0;
+		Outside |= Y > V.Z ? 16 : 0;
+		OutsideAll &= Outside;
+	}
+
+	// All corners on the wrong side of the same frustum plane.
+	if (OutsideAll)
+	{
+		return;
+	}
+
+	// Only faces with the source on their outer side can be seen.
+	const bool bFaceVisible[6] = {
+		Source.X < Box.Min.X, Source.X > Box.Max.X,
+		Source.Y < Box.Min.Y, Source.Y > Box.Max.Y,
+		Source.Z < Box.Min.Z, Source.Z > Box.Max.Z };
+
+	for (int32 Face = 0; Face < 6; Face++)
+	{
+		if (bFaceVisible[Face])
+		{
+			const FVector Quad[4] = {
+				ViewCorners[PVGSoftwareOcclusion::QuadFaces[Face][0]],
+				ViewCorners[PVGSoftwareOcclusion::QuadFaces[Face][1]],
+				ViewCorners[PVGSoftwareOcclusion::QuadFaces[Face][2]],
+				ViewCorners[PVGSoftwareOcclusion::QuadFaces[Face][3]] };
+			RasterizePolygon(Quad,4);
+		}
+	}
+}
+
+void FPVGSoftwareOcclusion::RasterizePolygon(const FVector* ViewVertices, int32 NumVertices)
+{
+	// Clip against the near plane, a quad gains at most one vertex.
+	FVector Clipped[8];
+	int32 NumClipped = 0;
+	for (int32 i = 0; i < NumVertices; i++)
+	{
+		const FVector& A = ViewVertices[i];
+		const FVector& B = ViewVertices[(i + 1) % NumVertices];
+		const bool bAInside = A.Z >= NearPlane;
+		const bool bBInside = B.Z >= NearPlane;
+
+		if (bAInside)
+		{
+			Clipped[NumClipped++] = A;
+		}
+		if (bAInside != bBInside)
+		{
+			Clipped[NumClipped++] = FMath::Lerp(A,B,(NearPlane - A.Z) / (B.Z - A.Z));
+		}
+	}
+
+	if (NumClipped < 3)
+	{
+		return;
+	}
+
+	FVector Screen[8];
+	for (int32 i = 0; i < NumClipped; i++)
+	{
+		Screen[i] = ToScreen(Clipped[i]);
+	}
+
+	// The whole face at once, splitting it into triangles would lose the pixels along the shared edges.
+	RasterizeConvex(Screen,NumClipped);
+}
+
+void FPVGSoftwareOcclusion::RasterizeConvex(const FVector* Screen, int32 NumVertices)
+{
+	// Depth plane from the largest triangle of the fan, the others can be degenerate after clipping.
+	double Area = 0;
+	int32 PlaneVertex = 2;
+	for (int32 i = 2; i < NumVertices; i++)
+	{
+		const double TriangleArea = (Screen[i - 1].X - Screen[0].X) * (Screen[i].Y - Screen[0].Y) - (Screen[i - 1].Y - Screen[0].Y) * (Screen[i].X - Screen[0].X);
+		if (FMath::Abs(TriangleArea) > FMath::Abs(Area))
+		{
+			Area = TriangleArea;
+			PlaneVertex = i;
+		}
+	}
+	if (FMath::Abs(Area) < UE_DOUBLE_SMALL_NUMBER)
+	{
+		return;
+	}
+
+	double MinXf = UE_DOUBLE_BIG_NUMBER, MinYf = UE_DOUBLE_BIG_NUMBER;
+	double MaxXf = -UE_DOUBLE_BIG_NUMBER, MaxYf = -UE_DOUBLE_BIG_NUMBER;
+	for (int32 i = 0; i < NumVertices; i++)
+	{
+		MinXf = FMath::Min(MinXf,Screen[i].X);
+		MinYf = FMath::Min(MinYf,Screen[i].Y);
+		MaxXf = FMath::Max(MaxXf,Screen[i].X);
+		MaxYf = FMath::Max(MaxYf,Screen[i].Y);
+	}
+
+	const int32 MinX = FMath::Max(0,FMath::FloorToInt(MinXf));
+	const int32 MinY = FMath::Max(0,FMath::FloorToInt(MinYf));
+	const int32 MaxX = FMath::Min(Resolution - 1,FMath::FloorToInt(MaxXf));
+	const int32 MaxY = FMath::Min(Resolution - 1,FMath::FloorToInt(MaxYf));
+	if (MinX > MaxX || MinY > MaxY)
+	{
+		return;
+	}
+
+	// Edge functions, positive inside for both windings. Normalized so clipped vertices far off screen keep float precision.
+	// Occluders only cover pixels they cover completely: the edges are pulled in so a pixel center passes only when the whole
+	// pixel square is inside, a partially covered pixel could still see the target past the occluder.
+	VectorRegister4Float EdgeA[8];
+	float EdgeB[8];
+	float EdgeC[8];
+	for (int32 i = 0; i < NumVertices; i++)
+	{
+		const FVector& Pi = Screen[i];
+		const FVector& Pj = Screen[(i + 1) % NumVertices];
+		const double A = Pi.Y - Pj.Y;
+		const double B = Pj.X - Pi.X;
+		const double C = -A * Pi.X - B * Pi.Y;
+		const double Length = FMath::Max(FMath::Abs(A),FMath::Abs(B));
+		if (Length < UE_DOUBLE_SMALL_NUMBER)
+		{
+			// Duplicate vertex from clipping, the edge is always inside.
+			EdgeA[i] = VectorZeroFloat();
+			EdgeB[i] = 0.f;
+			EdgeC[i] = 0.f;
+			continue;
+		}
+		
+		const double Scale = FMath::Sign(Area) / Length;
+		EdgeA[i] = VectorSetFloat1(float(A * Scale));
+		EdgeB[i] = float(B * Scale);
+		EdgeC[i] = float(C * Scale - 0.5 * (FMath::Abs(A) + FMath::Abs(B)) / Length);
+	}
+
+	// Reversed-Z is linear in screen space. Pixels store the farthest depth of their square, not the one at the center.
+	const FVector& P0 = Screen[0];
+	const FVector& P1 = Screen[PlaneVertex - 1];
+	const FVector& P2 = Screen[PlaneVertex];
+	const double DepthA = ((P1.Z - P0.Z) * (P2.Y - P0.Y) - (P2.Z - P0.Z) * (P1.Y - P0.Y)) / Area;
+	const double DepthB = ((P2.Z - P0.Z) * (P1.X - P0.X) - (P1.Z - P0.Z) * (P2.X - P0.X)) / Area;
+	const double DepthC = P0.Z - DepthA * P0.X - DepthB * P0.Y - 0.5 * (FMath::Abs(DepthA) + FMath::Abs(DepthB));
+	const VectorRegister4Float DepthAVec = VectorSetFloat1(float(DepthA));
+
+	// Sample pixel centers, 4 pixels at a time.
+	const VectorRegister4Float PixelOffsets = MakeVectorRegisterFloat(0.5f,1.5f,2.5f,3.5f);
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const int32 StartX = MinX & ~3;
+	
+	for (int32 y = MinY; y <= MaxY; y++)
+	{
+		const float PixelY = y + 0.5f;
+		VectorRegister4Float RowEdge[8];
+		for (int32 i = 0; i < NumVertices; i++)
+		{
+			RowEdge[i] = VectorSetFloat1(EdgeB[i] * PixelY + EdgeC[i]);
+		}
+		const VectorRegister4Float RowDepth = VectorSetFloat1(float(DepthB * PixelY + DepthC));
+		float* Row = Depth + y * Resolution;
+		
+		for (int32 x = StartX; x <= MaxX; x += 4)
+		{
+			const VectorRegister4Float PixelX = VectorAdd(VectorSetFloat1(float(x)),PixelOffsets);
+			
+			VectorRegister4Float Inside = VectorCompareGE(VectorMultiplyAdd(EdgeA[0],PixelX,RowEdge[0]),Zero);
+			for (int32 i = 1; i < NumVertices; i++)
+			{
+				Inside = VectorBitwiseAnd(Inside,VectorCompareGE(VectorMultiplyAdd(EdgeA[i],PixelX,RowEdge[i]),Zero));
+			}
+			if (!VectorMaskBits(Inside))
+			{
+				continue;
+			}
+
+			const VectorRegister4Float PixelDepth = VectorMax(VectorMultiplyAdd(DepthAVec,PixelX,RowDepth),Zero);
+			const VectorRegister4Float OldDepth = VectorLoadAligned(Row + x);
+			VectorStoreAligned(VectorSelect(Inside,VectorMax(OldDepth,PixelDepth),OldDepth),Row + x);
+		}
+	}
+}
+
+void FPVGSoftwareOcclusion::BuildHiZ()
+{
+	for (int32 Level = 1; Level < NumMips; Level++)
+	{
+		const int32 SourceSize = Resolution >> (Level - 1);
+		const int32 Size = Resolution >> Level;
+		const float* SourceMip = Depth + PVGSoftwareOcclusion::GetMipOffset(Level - 1);
+		float* Mip = Depth + PVGSoftwareOcclusion::GetMipOffset(Level);
+
+		// Keep the farthest depth, a texel only occludes what is behind all of its children.
+		for (int32 y = 0; y < Size; y++)
+		{
+			for (int32 x = 0; x < Size; x++)
+			{
+				const float* Texel = SourceMip + y * 2 * SourceSize + x * 2;
+				Mip[y * Size + x] = FMath::Min(FMath::Min(Texel[0],Texel[1]),FMath::Min(Texel[SourceSize],Texel[SourceSize + 1]));
+			}
+		}
+	}
+}
+
+bool FPVGSoftwareOcclusion::IsTargetOccluded() const
+{
+	FVector Corners[8];
+	TargetBox.GetVertices(Corners);
+
+	// The view is fitted around the target, all corners are in front of the source.
+	FVector2D RectMin(UE_BIG_NUMBER);
+	FVector2D RectMax(-UE_BIG_NUMBER);
+	double NearestDepth = 0;
+	for (int32 i = 0; i < 8; i++)
+	{
+		const FVector Screen = ToScreen(ToView(Corners[i]));
+		RectMin = FVector2D::Min(RectMin,FVector2D(Screen));
+		RectMax = FVector2D::Max(RectMax,FVector2D(Screen));
+		NearestDepth = FMath::Max(NearestDepth,Screen.Z);
+	}
+
+	const int32 MinX = FMath::Clamp(FMath::FloorToInt(RectMin.X),0,Resolution - 1);
+	const int32 MinY = FMath::Clamp(FMath::FloorToInt(RectMin.Y),0,Resolution - 1);
+	const int32 MaxX = FMath::Clamp(FMath::FloorToInt(RectMax.X),0,Resolution - 1);
+	const int32 MaxY = FMath::Clamp(FMath::FloorToInt(RectMax.Y),0,Resolution - 1);
+
+	// Coarsest mip where the rect still spans a few texels.
+	int32 Level = 0;
+	while (Level < NumMips - 1 && ((MaxX >> Level) - (MinX >> Level) >= 4 || (MaxY >> Level) - (MinY >> Level) >= 4))
+	{
+		Level++;
+	}
+
+	const int32 Size = Resolution >> Level;
+	const float* Mip = Depth + PVGSoftwareOcclusion::GetMipOffset(Level);
+	for (int32 y = MinY >> Level; y <= MaxY >> Level; y++)
+	{
+		for (int32 x = MinX >> Level; x <= MaxX >> Level; x++)
+		{
+			if (Mip[y * Size + x] <= NearestDepth)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+/*
+ * Tiny reversed-Z depth buffer looking from a source point at a single target box.
+ * Occluder boxes get rasterized into it so neighbouring occluders hide the target together,
+ * the target is tested with its screen rect against a min depth mip chain.
+ */
+class FPVGSoftwareOcclusion
+{
+public:
+	static constexpr int32 Resolution = 64;
+	static constexpr int32 NumMips = 7;
+
+	/* Fit the view around TargetBox, returns false when Source is too close to the target to test it. */
+	bool SetupView(const FVector& InSource, const FBox& InTargetBox);
+
+	/* Rasterize the faces of Box facing the source. */
+	void RenderBox(const FBox& Box);
+
+	/* Build the min depth chain, call once all occluders are rendered. */
+	void BuildHiZ();
+
+	/* True when the nearest point of the target is behind the occluders over its whole screen rect. */
+	bool IsTargetOccluded() const;
+
+private:
+	/* Source relative view space, Z is the distance along the view direction. */
+	FVector ToView(const FVector& WorldPosition) const
+	{
+		const FVector Delta = WorldPosition - Source;
+		return FVector(Delta | Right,Delta | Up,Delta | Forward);
+	}
+
+	/* Pixel position and reversed-Z depth, only valid in front of the near plane. */
+	FVector ToScreen(const FVector& ViewPosition) const
+	{
+		const double InvW = 1.0 / ViewPosition.Z;
+		return FVector(
+			(ViewPosition.X * InvTanHalfFOV * InvW * 0.5 + 0.5) * Resolution,
+			(0.5 - ViewPosition.Y * InvTanHalfFOV * InvW * 0.5) * Resolution,
+			NearPlane * InvW);
+	}
+
+	void RasterizePolygon(const FVector* ViewVertices, int32 NumVertices);
+
+	/* Inner-conservative, only pixels fully covered by the polygon get written. */
+	void RasterizeConvex(const FVector* Screen, int32 NumVertices);
+
+	static constexpr double NearPlane = 1.0;
+
+	FVector Source;
+	FBox TargetBox;
+	FVector Forward;
+	FVector Right;
+	FVector Up;
+	double InvTanHalfFOV = 1;
+
+	/* All mips back to back, level 0 first. */
+	static constexpr int32 NumTexels = (Resolution * Resolution * 4 - 1) / 3;
+	alignas(16) float Depth[NumTexels];
+};
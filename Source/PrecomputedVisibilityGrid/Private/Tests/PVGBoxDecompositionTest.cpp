@@ -0,0 +1,240 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGBoxDecomposition.h"
+
+#include "Math/RandomStream.h"
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace PVGBoxDecompositionTest
+{
+	/* Set based packing the kernel replaced, kept as the reference the kernel is checked against. Boxes are an origin index
+	 * and a size, growth works on linear indices so boxes can wrap around row ends. */
+	void DecomposeLegacy(const TArray<int32>& Cells, const FIntVector& GridSize, bool bAllowOverlap, TArray<FIntVector4>& OutBoxes)
+	{
+		auto ToIndex = [&](const FIntVector& Location) { return Location.X + Location.Y * GridSize.X + Location.Z * GridSize.X * GridSize.Y; };
+		auto To3D = [&](int32 Index) { return FIntVector(Index % GridSize.X,(Index / GridSize.X) % GridSize.Y,Index / (GridSize.X * GridSize.Y)); };
+
+		TSet<int32> Processed;
+		int32 Current = 0;
+		while (Current < Cells.Num())
+		{
+			const int32 Origin = Cells[Current];
+			FIntVector Size = FIntVector::ZeroValue;
+			bool bCanGrow[3] = { true,true,true };
+
+			TSet<int32> Entries;
+			Entries.Add(Origin);
+
+			while (bCanGrow[0] || bCanGrow[1] || bCanGrow[2])
+			{
+				for (int32 Axis = 0; Axis < 3; Axis++)
+				{
+					if (!bCanGrow[Axis])
+					{
+						continue;
+					}
+
+					FIntVector Step = FIntVector::ZeroValue;
+					Step[Axis] = 1;
+
+					TSet<int32> NewEntries;
+					for (const int32 Entry : Entries)
+					{
+						const int32 Test = ToIndex(To3D(Entry) + Step);
+						if (Entries.Contains(Test))
+						{
+							continue;
+						}
+						if (Cells.Contains(Test) && (bAllowOverlap || !Processed.Contains(Test)))
+						{
+							NewEntries.Add(Test);
+						}
+						else
+						{
+							bCanGrow[Axis] = false;
+							break;
+						}
+					}
+
+					if (bCanGrow[Axis])
+					{
+						Size[Axis]++;
+						Entries.Append(NewEntries);
+					}
+				}
+			}
+
+			Processed.Append(Entries);
+			OutBoxes.Add(FIntVector4(Origin,Size.X,Size.Y,Size.Z));
+
+			Current++;
+			while (Current < Cells.Num() && Processed.Contains(Cells[Current]))
+			{
+				Current++;
+			}
+		}
+	}
+
+	/* Random blobs of cells, similar to the occluded regions of an outdoor map. The last row and column stay empty so the
+	 * legacy packing can't wrap a box around a row end, where it is known to differ from first fit. */
+	void MakeTestVolume(const FIntVector& Size, float Density, int32 Seed, FPVGBitVolume& OutCells)
+	{
+		FRandomStream Random(Seed);
+		OutCells.Init(Size);
+
+		const int32 Target = FMath::RoundToInt((Size.X - 1) * (Size.Y - 1) * Size.Z * Density);
+		while (OutCells.CountSetBits() < Target)
+		{
+			const FIntVector Min(Random.RandHelper(Size.X - 1),Random.RandHelper(Size.Y - 1),Random.RandHelper(Size.Z));
+			const FIntVector Max(
+				FMath::Min(Size.X - 2,Min.X + Random.RandHelper(6)),
+				FMath::Min(Size.Y - 2,Min.Y + Random.RandHelper(6)),
+				FMath::Min(Size.Z - 1,Min.Z + Random.RandHelper(3)));
+			OutCells.SetBox(FPVGCellBox(Min,Max));
+		}
+	}
+
+	void GetCellList(const FPVGBitVolume& Cells, TArray<int32>& OutCells)
+	{
+		const FIntVector& Size = Cells.GetSize();
+		Cells.ForEachSetBit([&](int32 X, int32 Y, int32 Z)
+		{
+			OutCells.Add(X + Y * Size.X + Z * Size.X * Size.Y);
+		});
+	}
+
+	constexpr float Densities[] = { 0.1f,0.3f,0.6f,0.9f };
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPVGBoxDecompositionEquivalenceTest, "PrecomputedVisibilityGrid.BoxDecomposition.Equivalence",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FPVGBoxDecompositionEquivalenceTest::RunTest(const FString& Parameters)
+{
+	using namespace PVGBoxDecompositionTest;
+	const FIntVector Size(32,32,8);
+
+	for (const float Density : Densities)
+	{
+		for (int32 Overlap = 0; Overlap < 2; Overlap++)
+		{
+			const bool bAllowOverlap = Overlap == 1;
+			for (int32 Seed = 0; Seed < 4; Seed++)
+			{
+				FPVGBitVolume Cells;
+				MakeTestVolume(Size,Density,Seed,Cells);
+
+				TArray<int32> CellList;
+				GetCellList(Cells,CellList);
+
+				TArray<FIntVector4> LegacyBoxes;
+				DecomposeLegacy(CellList,Size,bAllowOverlap,LegacyBoxes);
+
+				for (int32 Packing = 0; Packing < 3; Packing++)
+				{
+					const FString Context = FString::Printf(TEXT("%s density %.1f seed %d%s"),
+						*UEnum::GetValueAsString(EPVGBoxPacking(Packing)),Density,Seed,bAllowOverlap ? TEXT(" overlapping") : TEXT(""));
+
+					TArray<FPVGCellBox> Boxes;
+					FPVGBoxDecomposition::Decompose(Cells,EPVGBoxPacking(Packing),bAllowOverlap,Boxes);
+
+					// Same cells as the input, each covered once unless overlap is allowed.
+					FPVGBitVolume Decoded(Size);
+					int32 NumCovered = 0;
+					bool bDisjoint = true;
+					for (const FPVGCellBox& Box : Boxes)
+					{
+						bDisjoint &= Decoded.CountSetBits() == NumCovered;
+						Decoded.SetBox(Box);
+						NumCovered += Box.GetNumCells();
+					}
+
+					int32 NumMatching = 0;
+					Cells.ForEachSetBit([&](int32 X, int32 Y, int32 Z) { NumMatching += Decoded.IsSet(X,Y,Z) ? 1 : 0; });
+					TestEqual(*(Context + TEXT(" covers the input")),NumMatching,CellList.Num());
+					TestEqual(*(Context + TEXT(" covers nothing else")),Decoded.CountSetBits(),CellList.Num());
+					if (!bAllowOverlap)
+					{
+						TestTrue(*(Context + TEXT(" boxes are disjoint")),bDisjoint);
+					}
+
+					// Without row ends to wrap around, first fit has to place the exact boxes of the original packing.
+					if (EPVGBoxPacking(Packing) == EPVGBoxPacking::FirstFit && TestEqual(*(Context + TEXT(" box count matches legacy")),Boxes.Num(),LegacyBoxes.Num()))
+					{
+						for (int32 i = 0; i < Boxes.Num(); i++)
+						{
+							const FIntVector BoxSize = Boxes[i].Max - Boxes[i].Min;
+							const int32 Origin = Boxes[i].Min.X + Boxes[i].Min.Y * Size.X + Boxes[i].Min.Z * Size.X * Size.Y;
+							if (!TestTrue(*(Context + TEXT(" box matches legacy")),FIntVector4(Origin,BoxSize.X,BoxSize.Y,BoxSize.Z) == LegacyBoxes[i]))
+							{
+								break;
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPVGBoxDecompositionBenchmarkTest, "PrecomputedVisibilityGrid.BoxDecomposition.Benchmark",
+	EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::PerfFilter)
+
+bool FPVGBoxDecompositionBenchmarkTest::RunTest(const FString& Parameters)
+{
+	using namespace PVGBoxDecompositionTest;
+	const FIntVector Size(64,64,16);
+	constexpr int32 NumRuns = 4;
+
+	for (const float Density : Densities)
+	{
+		for (int32 Overlap = 0; Overlap < 2; Overlap++)
+		{
+			const bool bAllowOverlap = Overlap == 1;
+			double LegacyTime = 0;
+			int32 LegacyBoxes = 0;
+			double KernelTime[3] = {};
+			int32 KernelBoxes[3] = {};
+
+			for (int32 Run = 0; Run < NumRuns; Run++)
+			{
+				FPVGBitVolume Cells;
+				MakeTestVolume(Size,Density,Run,Cells);
+
+				TArray<int32> CellList;
+				GetCellList(Cells,CellList);
+
+				{
+					TArray<FIntVector4> Boxes;
+					const double Start = FPlatformTime::Seconds();
+					DecomposeLegacy(CellList,Size,bAllowOverlap,Boxes);
+					LegacyTime += FPlatformTime::Seconds() - Start;
+					LegacyBoxes += Boxes.Num();
+				}
+
+				for (int32 Packing = 0; Packing < 3; Packing++)
+				{
+					TArray<FPVGCellBox> Boxes;
+					const double Start = FPlatformTime::Seconds();
+					FPVGBoxDecomposition::Decompose(Cells,EPVGBoxPacking(Packing),bAllowOverlap,Boxes);
+					KernelTime[Packing] += FPlatformTime::Seconds() - Start;
+					KernelBoxes[Packing] += Boxes.Num();
+				}
+			}
+
+			AddInfo(FString::Printf(TEXT("Density %.1f%s: legacy %d boxes %.3f ms | first fit %d boxes %.3f ms (%.1fx) | largest first %d boxes %.3f ms | morton %d boxes %.3f ms"),
+				Density,bAllowOverlap ? TEXT(" overlapping") : TEXT(""),
+				LegacyBoxes / NumRuns,LegacyTime * 1000.0 / NumRuns,
+				KernelBoxes[0] / NumRuns,KernelTime[0] * 1000.0 / NumRuns,LegacyTime / FMath::Max(KernelTime[0],UE_DOUBLE_SMALL_NUMBER),
+				KernelBoxes[1] / NumRuns,KernelTime[1] * 1000.0 / NumRuns,
+				KernelBoxes[2] / NumRuns,KernelTime[2] * 1000.0 / NumRuns));
+		}
+	}
+	return true;
+}
+
+#endif
@@ -0,0 +1,172 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PVGBuilderCommandlet.h"
+#include "PVGManager.h"
+#include "PVGPrecomputedGridDataAsset.h"
+#include "PVGRegression.h"
+
+#include "Components/BoxComponent.h"
+#include "Engine/StaticMesh.h"
+#include "Engine/StaticMeshActor.h"
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/PackageName.h"
+#include "Misc/ScopeExit.h"
+#include "UObject/GCObjectScopeGuard.h"
+#include "UObject/Package.h"
+
+#if WITH_DEV_AUTOMATION_TESTS && WITH_EDITOR
+
+namespace PVGRegressionTest
+{
+	/* Grid of 8x4x4 cells of the manager's default 500 units, centered on the origin. */
+	const FVector GridExtent(2000,1000,1000);
+
+	/* Package the built asset is saved to, away from the project content. */
+	const TCHAR* AssetPackageName = TEXT("/Temp/PVGRegression/PVGGrid_Reference");
+
+	/* Cube of the engine basic shapes, 100 units wide and centered on its pivot. */
+	AStaticMeshActor* SpawnBox(UWorld* World, UStaticMesh* Cube, const FVector& Center, const FVector& Size)
+	{
+		AStaticMeshActor* Actor = World->SpawnActor<AStaticMeshActor>(Center,FRotator::ZeroRotator);
+		Actor->GetStaticMeshComponent()->SetStaticMesh(Cube);
+		Actor->SetActorScale3D(Size / 100);
+		return Actor;
+	}
+
+	/*
+	 * A wall on the cell border at X = 0 and a floor on the one at Z = 0, both thin and reaching past the grid, split it
+	 * into four closed quadrants of open space. Cells hide exactly the cells of the other quadrants, the builder may lose
+	 * some of those next to the wall and floor but must never hide a cell of its own quadrant.
+	 */
+	UWorld* CreateReferenceWorld()
+	{
+		UWorld::InitializationValues IVS;
+		IVS.RequiresHitProxies(false);
+		IVS.ShouldSimulatePhysics(false);
+		IVS.EnableTraceCollision(true);
+		IVS.CreateNavigation(false);
+		IVS.CreateAISystem(false);
+		IVS.AllowAudioPlayback(false);
+		IVS.CreatePhysicsScene(true);
+		IVS.CreateWorldPartition(true);
+		UWorld* World = UWorld::CreateWorld(EWorldType::Editor,false,TEXT("PVGRegressionReference"),nullptr,true,ERHIFeatureLevel::Num,&IVS);
+		if (!World)
+		{
+			return nullptr;
+		}
+
+		UStaticMesh* Cube = LoadObject<UStaticMesh>(nullptr,TEXT("/Engine/BasicShapes/Cube.Cube"));
+		if (!Cube)
+		{
+			World->DestroyWorld(false);
+			World->RemoveFromRoot();
+			return nullptr;
+		}
+
+		APVGManager* Manager = World->SpawnActor<APVGManager>(FVector::ZeroVector,FRotator::ZeroRotator);
+		CastChecked<UBoxComponent>(Manager->GetRootComponent())->SetBoxExtent(GridExtent);
+
+		// The build saves into the manager's asset, without one it would create one under /Game.
+		UPackage* Package = CreatePackage(AssetPackageName);
+		UPVGPrecomputedGridDataAsset* Asset = NewObject<UPVGPrecomputedGridDataAsset>(Package,*FPackageName::GetShortName(AssetPackageName),RF_Public | RF_Standalone);
+		FindFProperty<FObjectProperty>(APVGManager::StaticClass(),TEXT("GridDataAsset"))->SetObjectPropertyValue_InContainer(Manager,Asset);
+
+		const FVector Reach = GridExtent * 1.5f;
+		SpawnBox(World,Cube,FVector::ZeroVector,FVector(20,Reach.Y * 2,Reach.Z * 2));
+		SpawnBox(World,Cube,FVector::ZeroVector,FVector(Reach.X * 2,Reach.Y * 2,20));
+		return World;
+	}
+
+	/* Hidden cells of every cell as the reference scene has them, the cells of the other quadrants. */
+	void GetExpected(const UPVGPrecomputedGridDataAsset* Asset, PVGRegression::FGolden& Out)
+	{
+		const int32 SizeX = Asset->GetGridSizeX();
+		const int32 SizeY = Asset->GetGridSizeY();
+		auto GetQuadrant = [&](int32 Cell)
+		{
+			const FIntVector Location = IndexTo3D(Cell,SizeX,SizeY);
+			return (Location.X < SizeX / 2 ? 0 : 1) | (Location.Z < Asset->GetGridSizeZ() / 2 ? 0 : 2);
+		};
+
+		Out.GridSignature = Asset->GetGridSignature();
+		Out.HiddenCells.SetNum(Asset->GetNumCells());
+		for (int32 Cell = 0; Cell < Asset->GetNumCells(); Cell++)
+		{
+			for (int32 Other = 0; Other < Asset->GetNumCells(); Other++)
+			{
+				if (GetQuadrant(Other) != GetQuadrant(Cell))
+				{
+					Out.HiddenCells[Cell].Add(Other);
+				}
+			}
+		}
+	}
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FPVGRegressionTest, "PrecomputedVisibilityGrid.Regression.ReferenceScene",
+	EAutomationTestFlags::EditorContext | EAutomationTestFlags::EngineFilter)
+
+bool FPVGRegressionTest::RunTest(const FString& Parameters)
+{
+	using namespace PVGRegressionTest;
+
+	UWorld* World = CreateReferenceWorld();
+	if (!TestNotNull(TEXT("Reference scene is created"),World))
+	{
+		return false;
+	}
+	ON_SCOPE_EXIT
+	{
+		World->DestroyWorld(false);
+		World->RemoveFromRoot();
+	};
+
+	UPVGPrecomputedGridBuilder* Builder = NewObject<UPVGPrecomputedGridBuilder>(GetTransientPackage());
+	FGCObjectScopeGuard BuilderGuard(Builder);
+	const double StartTime = FPlatformTime::Seconds();
+	if (!TestTrue(TEXT("Reference scene builds"),Builder->RunBuilder(World,FPVGBuildOptions()) && Builder->BuiltAsset != nullptr))
+	{
+		return false;
+	}
+	const double BuildTime = FPlatformTime::Seconds() - StartTime;
+
+	UPVGPrecomputedGridDataAsset* Asset = Builder->BuiltAsset;
+	const FString PackageFileName = FPackageName::LongPackageNameToFilename(Asset->GetPackage()->GetName(),FPackageName::GetAssetPackageExtension());
+	ON_SCOPE_EXIT
+	{
+		Asset->ClearFlags(RF_Public | RF_Standalone);
+		IFileManager::Get().Delete(*PackageFileName,false,false,true);
+	};
+
+	const int64 NumBuildCells = Asset->GetNumBuildCells();
+	const int64 NumPairs = NumBuildCells * (NumBuildCells - 1) / 2;
+	AddInfo(FString::Printf(TEXT("Built %lld pairs in %.2f sec, %.0f pairs/sec."),NumPairs,BuildTime,BuildTime > 0 ? NumPairs / BuildTime : 0.0));
+	AddInfo(FString::Printf(TEXT("Asset size %.1f KB."),IFileManager::Get().FileSize(*PackageFileName) / 1024.0));
+
+	if (!TestTrue(TEXT("Grid is 8x4x4 cells"),FIntVector(Asset->GetGridSizeX(),Asset->GetGridSizeY(),Asset->GetGridSizeZ()) == FIntVector(8,4,4)))
+	{
+		return false;
+	}
+
+	PVGRegression::FGolden Expected;
+	GetExpected(Asset,Expected);
+
+	PVGRegression::FGolden Result;
+	PVGRegression::Capture(Asset,Result);
+
+	const PVGRegression::FComparison Comparison = PVGRegression::Compare(Expected,Result);
+
+	// Only wrongly hidden cells fail, lost culling is reported so changes in culling efficiency show up in the log.
+	for (const FIntPoint& Pair : Comparison.WronglyHidden)
+	{
+		AddError(FString::Printf(TEXT("Cell %d hides cell %d of its own quadrant."),Pair.X,Pair.Y));
+	}
+	TestEqual(TEXT("Wrongly hidden pairs"),Comparison.NumWronglyHidden,int64(0));
+	TestTrue(TEXT("Wall and floor hide cells"),Comparison.NumLostHidden < Comparison.NumGoldenHidden);
+	AddInfo(FString::Printf(TEXT("%lld of %lld hidden cells lost against the reference scene."),Comparison.NumLostHidden,Comparison.NumGoldenHidden));
+	return true;
+}
+
+#endif
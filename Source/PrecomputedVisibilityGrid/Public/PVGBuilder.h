@@ -5,10 +5,47 @@
 #include "CoreMinimal.h"
 #include "Components/WorldPartitionStreamingSourceComponent.h"
 #include "GameFramework/Actor.h"
+#include "Tasks/Task.h"
+#include <atomic>
 #include "PVGBuilder.generated.h"
 
 
 class UPVGPrecomputedGridDataAsset;
+class FPVGOccupancyVolume;
+class FPVGCollisionBVH;
+class FPVGBuildStats;
+class FLoaderAdapterShape;
+enum class EPVGOccupancy : uint8;
+struct FPVGBuildFileHeader;
+
+UENUM()
+enum class EPVGBuildMode : uint8
+{
+	/* Resolve one source cell per frame, testing shells of target cells around it. */
+	CellShells,
+	/* Resolve every unique cell pair through a shared worker pool, requires the whole grid to be loaded. */
+	PairPool,
+	/* Sweep source cells in Morton order in batches, only loading the world within the view distance of the current batch.
+	 * The pair state is still held for the whole grid, so it has the FPVGPairMatrix::MaxCells limit of the other modes and
+	 * no adaptive cells. Maps of 2-4 km at 5 m cells are out of reach, 2 km already takes 160000 cells per layer. */
+	Streamed,
+};
+
+/* Per build overrides, mostly passed in from the commandlet. */
+struct FPVGBuildOptions
+{
+	/* Resolve only the pairs of this shard and write them to a partial file, INDEX_NONE builds the whole grid. */
+	int32 ShardIndex = INDEX_NONE;
+	int32 NumShards = 1;
+
+	/* Continue from the last checkpoint of this grid if there is one. */
+	bool bResume = false;
+
+	/* Keep the pairs of the existing grid data and only resolve the ones around changed geometry again. */
+	bool bIncremental = false;
+
+	bool IsSharded() const { return ShardIndex != INDEX_NONE; }
+};
 
 UCLASS()
 class PRECOMPUTEDVISIBILITYGRID_API APVGBuilder : public AActor
@@ -19,20 +56,126 @@ public:
 	// Sets default values for this actor's properties
 	APVGBuilder();
 
-	void Initialize(const TArray<FVector>& InLocations, FIntVector GridSize);
+	void Initialize(const TArray<FVector>& InLocations, FIntVector GridSize, const FPVGBuildOptions& Options = FPVGBuildOptions());
+
+	/* True once after a streamed batch released the region of the previous batch, commandlets collect garbage then.
+	 * The editor picks the same request up on its next tick. */
+	bool ConsumeGarbageCollectionRequest()
+	{
+		const bool bResult = bWantsGarbageCollection;
+		bWantsGarbageCollection = false;
+		return bResult;
+	}
 	
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
 	virtual UPVGPrecomputedGridDataAsset* GetOrCreateCellData(FIntVector GridSize);
 	
-	bool BoxOcclusion(uint16 Location, uint16 Target, FBox BaseBox);
+	/* Is TargetBox hidden behind the box scene as seen from the center of the Location cell. */
+	bool BoxOcclusion(int32 Location, const FBox& TargetBox);
+
+	/* Is TargetBox hidden behind the boxes of Scene as seen from CameraLocation, boxes around the camera are ignored.
+	 * Callers that are already spread over the workers pass bParallel false. */
+	bool BoxOcclusion(const FVector& CameraLocation, const FBox& TargetBox, const TArray<FBox>& Scene, bool bParallel = true) const;
+
+	/* Test the aligned blocks of SuperCellSize cells whose nearest cell lies on Ring against the box scene as a whole,
+	 * descending into the octants of blocks that aren't hidden. Cells of a hidden block still get the direct and corner
+	 * traces before they count as occluded. Returns the number of pairs resolved as occluded. */
+	int32 ResolveSuperCells(int32 Ring, int32 SuperCellSize);
+
+	int32 ResolveSuperCell(const FIntVector& BlockMin, const FIntVector& BlockMax);
+
+	/* Is any pair of corners of both boxes connected by a clear trace. */
+	bool BoxCornerTraceCheck(const FBox& ABox, const FBox& BBox);
 
-	bool BoxCornerTraceCheck(FVector A, FVector B, FBox Base);
+	/* World box of a build cell. */
+	FBox GetBuildCellBox(int32 Index) const;
+
+	/* Merge homogeneous blocks of grid cells into octree leaves and build those instead of the grid cells. */
+	void BuildAdaptiveCells(const FIntVector& GridSize);
+
+	/* Solid, partial or empty for every grid cell, only when a later pass needs it. */
+	void ClassifyCells(const FIntVector& GridSize);
+
+	/* Merge the solid grid cells into the boxes every box scene starts with. */
+	void BuildSolidOccluders(const FIntVector& GridSize);
+
+	/* Find the build cells a player camera can be in and skip the pairs between two cells it can't. */
+	void BuildReachability(const FIntVector& GridSize);
+
+	bool IsReachable(int32 Cell) const { return ReachableCells.Num() == 0 || ReachableCells[Cell]; }
+
+	/* Pairs without a reachable cell are never seen from a camera, they are left unresolved instead of written. */
+	bool IsPairNeeded(int32 A, int32 B) const { return IsReachable(A) || IsReachable(B); }
 
 	/* rebuild simplified occlusion scene.*/
 	void UpdateBoxScene();
+
+	/* Trace settings shared by all builder traces, a copy of the ones captured by the last RefreshTraceParams. */
+	void GetTraceParams(FCollisionQueryParams& OutQueryParams, FCollisionResponseParams& OutResponseParams) const;
+
+	/* Recapture the trace settings, needed whenever streaming could have loaded new foliage actors. */
+	void RefreshTraceParams();
+
+	/* Line test used by every builder trace, answered by the occupancy volume or the collision snapshot when they can and by
+	 * the physics scene otherwise.
+	 * Returns true when something blocks the segment. */
+	bool IsTraceBlocked(UWorld* World, const FVector& Start, const FVector& End, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams) const;
+
+	/* Voxelize the blocking collision inside Bounds, only covers what is loaded at this point. */
+	void BuildOccupancyVolume(const FBox& Bounds);
+
+	/* Copy the blocking collision inside Bounds into the collision BVH, only covers what is loaded at this point. */
+	void BuildCollisionSnapshot(const FBox& Bounds);
+
+	/* Fire seeded, stratified rays between both cells in growing batches, returns true when any of them got through. */
+	bool ShotgunTrace(int32 Source, int32 Target, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams, bool bParallel) const;
+
+	/* Launch the pair pool on a background task, the workers keep claiming jobs until all pairs are resolved. */
+	void StartPairPool();
+
+	/* Resolve all pairs of a single job, called from the pair pool workers. */
+	void ResolvePairJob(int64 Job, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams);
+
+	/* Trace a single pair and store the result, safe to call from worker threads. */
+	void ResolvePair(int32 A, int32 B, UWorld* World, const FCollisionQueryParams& QueryParams, const FCollisionResponseParams& ResponseParams);
+
+	/* Sort the source cells along the Morton curve for the streamed build. */
+	void SetupStreamedBuild();
+
+	/* Load the world around the next batch of source cells and resolve their pairs within the view distance. */
+	void ResolveStreamedBatch();
+
+	/* Cells within ViewDistance of Source, looked up in the grid around it. Pairs beyond it are never stored and read
+	 * as visible. */
+	void GetStreamedTargets(int32 Source, float ViewDistance, TArray<int32>& OutTargets) const;
+
+	/* Save the grid data and stop ticking. */
+	void FinishBuild();
+
+	/* Write the pairs resolved by this shard to its partial file. */
+	bool WriteShardResult();
+
+	/* Header describing the grid that is being built. */
+	void GetBuildFileHeader(FPVGBuildFileHeader& OutHeader) const;
+
+	FString GetCheckpointFilename() const;
+
+	/* Flush the pair state and progress to the checkpoint file. */
+	void WriteCheckpoint();
+
+	/* Load the checkpoint of this grid, returns false when there is none matching. */
+	bool ReadCheckpoint();
+
+	/* XOR of the blocking collision overlapping each cell, changes when anything that can block a trace moves. */
+	void ComputeCellGeometryHashes(TArray<uint32>& OutHashes) const;
+
+	/* Seed the pair state with the previous result and unresolve every pair whose connecting volume touches a changed cell.
+	 * Returns false when the previous result can't be reused. */
+	bool PrepareIncrementalBuild(uint32 PreviousSignature, const TArray<uint32>& PreviousHashes, const TArray<uint32>& CellHashes);
 	
 public:
 	// @Returns "true" when we are already at the location
@@ -45,9 +188,22 @@ private:
 	/* Did we run initialize ?*/
 	bool bIsInitialized = false;
 
-	/* Locations to build, assigned by "initialize" function called from the PVGManager*/
+	/* Centers of all grid cells, assigned by "initialize" function called from the PVGManager*/
+	TArray<FVector> GridLocations;
+	
+	/* Centers of the build cells, the grid cells themselves or the octree leaves of adaptive builds. */
 	TArray<FVector> LocationsToBuild;
 
+	/* Half size of each build cell, empty when every build cell is a single grid cell. */
+	TArray<FVector> BuildCellExtents;
+
+	/* Octree leaves of adaptive builds, see FPVGAdaptiveCells. */
+	TArray<uint64> LeafCodes;
+	TArray<uint8> LeafLevels;
+
+	/* Build cells a player camera can be in, empty when every cell is. */
+	TBitArray<> ReachableCells;
+
 	/* Are we in the trace stage? */
 	bool bTraceCheckStage = true;
 
@@ -58,9 +214,48 @@ private:
 	 * if not, we rotate them and test their result next frame. */
 	bool bAreLocationUpToDate = false;
 
-	TArray<uint16> ViewBlockers;
+	FPVGBuildOptions BuildOptions;
+	
+	/* Scheduling mode, copied from the developer settings on initialize. */
+	EPVGBuildMode BuildMode = EPVGBuildMode::CellShells;
+
+	/* Pair pool state. */
+	UE::Tasks::FTask PairPoolTask;
+	int64 NumPairJobs = 0;
+	int32 PairsPerJob = 0;
+	std::atomic<int64> NextPairJob = 0;
+	std::atomic<int64> NumPairJobsDone = 0;
+	std::atomic<bool> bCancelPairPool = false;
+	double LastProgressLogTime = 0;
+	double LastCheckpointTime = 0;
+
+	/* Streamed build state, source cells in Morton order and the region loaded for the current batch. */
+	TArray<int32> StreamedSources;
+	int32 NextStreamedSource = 0;
+	TSharedPtr<FLoaderAdapterShape> StreamedLoader;
+	bool bWantsGarbageCollection = false;
+
+	TArray<int32> ViewBlockers;
 	TArray<FBox> BoxScene;
 
+	/* Occupancy of every grid cell, empty when nothing needed it. */
+	TArray<EPVGOccupancy> CellOccupancy;
+
+	/* Boxes of cells fully inside blocking collision, these hide the same cells from every source so they are built once. */
+	TArray<FBox> SolidOccluders;
+
+	/* Voxelized blocking collision, only valid when enabled in the developer settings. */
+	TSharedPtr<FPVGOccupancyVolume> OccupancyVolume;
+
+	/* Counters and timings of the current build, written to the build report when it finishes. */
+	TSharedPtr<FPVGBuildStats> BuildStats;
+
+	/* Frozen copy of the blocking collision, only valid when enabled in the developer settings. */
+	TSharedPtr<FPVGCollisionBVH> CollisionBVH;
+
+	FCollisionQueryParams TraceQueryParams;
+	FCollisionResponseParams TraceResponseParams;
+
 	double BeginTime;
 
 	UPROPERTY()
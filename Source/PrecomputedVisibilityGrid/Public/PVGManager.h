@@ -8,6 +8,8 @@
 #include "PVGManager.generated.h"
 
 class UPVGPrecomputedGridDataAsset;
+struct FPVGBuildOptions;
+struct FPVGOcclusionSceneScratch;
 
 USTRUCT()
 struct FCellActorContainer
@@ -108,9 +110,18 @@ private:
 	
 	TArray<int32> CellsToHide;
 	TArray<int32> CellsToUnHide;
-	TArray<int32> HiddenCells;
+	TSet<int32> HiddenCells;
+
+	/* Cell the hidden cells were last updated for, transitions to its neighbours only apply the difference. */
+	int32 RegionCell = INDEX_NONE;
+
+	/* Hidden cells of the current cell, kept around to reuse the allocation. */
+	TBitArray<> RegionBits;
 
 	TArray<FBox> OcclusionScene;
+
+	/* Bit volumes and boxes of the occlusion scene update, reused every frame. */
+	TSharedPtr<FPVGOcclusionSceneScratch> OcclusionSceneScratch;
 	
 	//TSet<int32> HiddenPrimitives;
 	bool bIsEnabled = true;
@@ -123,6 +134,12 @@ public:
 	UFUNCTION(CallInEditor)
 	APVGBuilder* StartBuild();
 
+	APVGBuilder* StartBuildWithOptions(const FPVGBuildOptions& Options);
+
+	/* Rebuild only the pairs affected by geometry that changed since the last build. */
+	UFUNCTION(CallInEditor)
+	APVGBuilder* StartIncrementalBuild();
+
 	UFUNCTION(CallInEditor)
 	void DebugDrawCells();
 
@@ -0,0 +1,231 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include <atomic>
+
+/**
+ * Triangular bit matrix holding the build state of every unique cell pair, a pair is either unresolved, visible or occluded.
+ *
+ * Cells are grouped in runs of 64 and the state of two runs lives in a block of 64x64 pairs, blocks only get allocated
+ * once one of their pairs is written. Builds that only resolve pairs within a view distance only pay for the blocks
+ * around each cell, pairs that are never written read back as unresolved, or visible after SetAllVisible.
+ *
+ * The block table itself is dense, 8 bytes per block of 4096 pairs. MaxCells keeps it at 64 MB, a fully written matrix
+ * of that size would take 8 GB. Every build mode shares this limit, grids beyond it need bigger cells.
+ *
+ * Lookups and set operations are lock free, the builder's worker threads all share one matrix.
+ */
+class PRECOMPUTEDVISIBILITYGRID_API FPVGPairMatrix
+{
+public:
+	static constexpr int32 MaxCells = 1 << 18;
+
+	FPVGPairMatrix() = default;
+	FPVGPairMatrix(const FPVGPairMatrix& Other) { *this = Other; }
+	FPVGPairMatrix& operator=(const FPVGPairMatrix& Other);
+	~FPVGPairMatrix() { Empty(); }
+
+	/* Returns false when InNumCells is above MaxCells, the matrix is left empty then. */
+	bool Init(int32 InNumCells);
+	void Empty();
+
+	/* Save/load of the written blocks. */
+	void Serialize(FArchive& Ar);
+
+	/* Add every resolved pair of Other, both matrices need to cover the same amount of cells. */
+	void Merge(const FPVGPairMatrix& Other);
+
+	int32 GetNumCells() const { return NumCells; }
+	int64 GetNumPairs() const { return int64(NumCells) * (NumCells - 1) / 2; }
+
+	/* Memory of the block table and the written blocks. */
+	int64 GetAllocatedSize() const { return Blocks.GetAllocatedSize() + NumAllocatedBlocks * int64(sizeof(FBlock)); }
+
+	/* Linear index of the pair, only used to split the pairs into jobs. */
+	static int64 GetPairIndex(int32 A, int32 B)
+	{
+		checkSlow(A != B);
+		if (A > B)
+		{
+			Swap(A,B);
+		}
+		return int64(B) * (B - 1) / 2 + A;
+	}
+
+	/* Inverse of GetPairIndex, OutA < OutB. */
+	static void GetPairFromIndex(int64 Index, int32& OutA, int32& OutB)
+	{
+		int64 B = int64((1.0 + FMath::Sqrt(1.0 + 8.0 * double(Index))) * 0.5);
+
+		// Fix up floating point rounding.
+		while (B * (B - 1) / 2 > Index)
+		{
+			B--;
+		}
+		while ((B + 1) * B / 2 <= Index)
+		{
+			B++;
+		}
+
+		OutB = int32(B);
+		OutA = int32(Index - B * (B - 1) / 2);
+	}
+
+	bool IsVisible(int32 A, int32 B) const { return TestBit(Visible,A,B); }
+	bool IsOccluded(int32 A, int32 B) const { return TestBit(Occluded,A,B); }
+	bool IsResolved(int32 A, int32 B) const { return TestBit(Visible,A,B) || TestBit(Occluded,A,B); }
+
+	/* Mark the pair, returns false when the pair already had this state. */
+	bool SetVisible(int32 A, int32 B) { return SetBit(Visible,A,B); }
+	bool SetOccluded(int32 A, int32 B) { return SetBit(Occluded,A,B); }
+
+	/* Clear the pair so it gets resolved again. */
+	void Unresolve(int32 A, int32 B);
+
+	/* Mark every pair as visible, used to seed a matrix from a sparse list of occluded pairs. Frees all blocks, pairs
+	 * read as visible until they get written. */
+	void SetAllVisible();
+
+	int32 CountVisible(int32 Cell) const;
+	int32 CountOccluded(int32 Cell) const;
+	int32 CountUnresolved(int32 Cell) const { return NumCells - 1 - CountVisible(Cell) - CountOccluded(Cell); }
+
+	/* Calls Func(Other) for every cell that is occluded from Cell, in ascending order.
+	 * Not synchronized with writers, only use once the workers are done. */
+	template<typename FuncType>
+	void ForEachOccluded(int32 Cell, FuncType Func) const
+	{
+		ForEachInRow(Occluded, Cell, Func);
+	}
+
+	template<typename FuncType>
+	void ForEachVisible(int32 Cell, FuncType Func) const
+	{
+		ForEachInRow(Visible, Cell, Func);
+	}
+
+private:
+	static constexpr int32 BlockShift = 6;
+	static constexpr int32 BlockCells = 1 << BlockShift;
+
+	enum EPlane : int32
+	{
+		Visible,
+		Occluded,
+		NumPlanes,
+	};
+
+	/* Pairs of the runs (RunA,RunB) with RunA <= RunB, word B & 63 holds the pairs of cell B, bit A & 63 the other cell. */
+	struct FBlock
+	{
+		uint64 Words[NumPlanes][BlockCells];
+	};
+
+	static int64 GetBlockIndex(int32 RunA, int32 RunB)
+	{
+		return int64(RunB) * (RunB + 1) / 2 + RunA;
+	}
+
+	/* Bits of word Word in block (RunA,RunB) that belong to real pairs. */
+	uint64 GetValidMask(int32 RunA, int32 RunB, int32 Word) const
+	{
+		const int32 B = (RunB << BlockShift) + Word;
+		if (B >= NumCells)
+		{
+			return 0;
+		}
+
+		// The diagonal block only holds A < B, partial runs at the end only their cells.
+		const int32 NumA = FMath::Min(RunA == RunB ? Word : BlockCells,NumCells - (RunA << BlockShift));
+		return NumA >= 64 ? ~uint64(0) : (uint64(1) << NumA) - 1;
+	}
+
+	const FBlock* FindBlock(int32 RunA, int32 RunB) const
+	{
+		return (const FBlock*)UPTRINT(FPlatformAtomics::AtomicRead((volatile const int64*)&Blocks[GetBlockIndex(RunA,RunB)]));
+	}
+
+	FBlock* FindOrAddBlock(int32 RunA, int32 RunB);
+
+	bool TestBit(EPlane Plane, int32 A, int32 B) const
+	{
+		checkSlow(A != B);
+		if (A > B)
+		{
+			Swap(A,B);
+		}
+
+		const FBlock* Block = FindBlock(A >> BlockShift,B >> BlockShift);
+		if (!Block)
+		{
+			return Plane == Visible && bAllVisible;
+		}
+
+		const int64 Word = FPlatformAtomics::AtomicRead((volatile const int64*)&Block->Words[Plane][B & (BlockCells - 1)]);
+		return (uint64(Word) >> (A & (BlockCells - 1))) & 1;
+	}
+
+	bool SetBit(EPlane Plane, int32 A, int32 B)
+	{
+		checkSlow(A != B);
+		if (A > B)
+		{
+			Swap(A,B);
+		}
+
+		FBlock* Block = FindOrAddBlock(A >> BlockShift,B >> BlockShift);
+		const int64 Mask = int64(uint64(1) << (A & (BlockCells - 1)));
+		const int64 Old = FPlatformAtomics::InterlockedOr((volatile int64*)&Block->Words[Plane][B & (BlockCells - 1)], Mask);
+		return (Old & Mask) == 0;
+	}
+
+	template<typename FuncType>
+	void ForEachInRow(EPlane Plane, int32 Cell, FuncType& Func) const
+	{
+		const int32 CellRun = Cell >> BlockShift;
+		const int32 CellBit = Cell & (BlockCells - 1);
+		const bool bUnwrittenSet = Plane == Visible && bAllVisible;
+
+		// Pairs with a lower cell are one word per block.
+		for (int32 Run = 0; Run <= CellRun; Run++)
+		{
+			const FBlock* Block = FindBlock(Run,CellRun);
+			uint64 Word = (Block ? Block->Words[Plane][CellBit] : (bUnwrittenSet ? ~uint64(0) : 0)) & GetValidMask(Run,CellRun,CellBit);
+			while (Word)
+			{
+				Func((Run << BlockShift) + int32(FMath::CountTrailingZeros64(Word)));
+				Word &= Word - 1;
+			}
+		}
+
+		// Pairs with a higher cell are one bit per word.
+		const int32 NumRuns = FMath::DivideAndRoundUp(NumCells,BlockCells);
+		for (int32 Run = CellRun; Run < NumRuns; Run++)
+		{
+			const FBlock* Block = FindBlock(CellRun,Run);
+			if (!Block && !bUnwrittenSet)
+			{
+				continue;
+			}
+
+			for (int32 Other = FMath::Max(Run << BlockShift,Cell + 1); Other < FMath::Min((Run + 1) << BlockShift,NumCells); Other++)
+			{
+				if (!Block || ((Block->Words[Plane][Other & (BlockCells - 1)] >> CellBit) & 1))
+				{
+					Func(Other);
+				}
+			}
+		}
+	}
+
+	int32 NumCells = 0;
+
+	/* Pairs without a block read as visible instead of unresolved. */
+	bool bAllVisible = false;
+
+	/* One entry per pair of runs, null until written. */
+	TArray64<FBlock*> Blocks;
+	std::atomic<int64> NumAllocatedBlocks = 0;
+};
@@ -3,7 +3,12 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Algo/BinarySearch.h"
 #include "Engine/DataAsset.h"
+#include "PrecomputedVisibilityGrid.h"
+#include "PVGPairMatrix.h"
+#include "Serialization/BulkData.h"
+#include "Tasks/Task.h"
 #include "PVGPrecomputedGridDataAsset.generated.h"
 
 /**
@@ -16,13 +21,15 @@ struct FRawRegionVisibilityData16
 	GENERATED_BODY()
 	
 	UPROPERTY(VisibleAnywhere)
-	TArray<uint16> InvisibleRegions;
+	TArray<int32> InvisibleRegions;
 #if WITH_EDITORONLY_DATA
 	UPROPERTY(VisibleAnywhere,SkipSerialization)
-	TArray<uint16> VisibleRegions;
+	TArray<int32> VisibleRegions;
 #endif
 };
 
+/* Box of hidden cells, Location is the cell index of its min corner local to the current sector.
+ * Grids with more than one sector start every run of boxes with a sector marker. */
 USTRUCT()
 struct FPackedVisibilityData
 {
@@ -51,11 +58,34 @@ struct FPackedVisibilityData
 	{
 	}
 #if WITH_EDITORONLY_DATA
-	TArray<uint16> ReflectionData;
+	TArray<int32> ReflectionData;
 #endif
+
+	/* Marks all following boxes as local to Sector. */
+	static FPackedVisibilityData MakeSectorMarker(uint16 Sector)
+	{
+		return FPackedVisibilityData(Sector,MAX_uint16,0,0);
+	}
+	
+	bool IsSectorMarker() const { return SizeX == MAX_uint16; }
 	
 public:
-	static TArray<uint16> Unpack(const FPackedVisibilityData& Entry, const UPVGPrecomputedGridDataAsset* Self);
+	/* Append the global cell indices of the box, SectorOrigin is the first cell of the sector the box is in. */
+	static void Unpack(const FPackedVisibilityData& Entry, const FIntVector& SectorOrigin, const UPVGPrecomputedGridDataAsset* Self, TArray<int32>& Out);
+};
+
+/* How the hidden cells of a build cell are stored, saving picks the smallest. */
+UENUM()
+enum class EPVGCellEncoding : uint8
+{
+	/* Packed boxes in CellData. */
+	Boxes,
+	/* Varint first cell, varint number of bits and a bit per cell from the first to the last hidden one. */
+	Bitset,
+	/* Varint lengths of alternating visible and hidden runs of cell indices, starting with a visible run at cell 0. */
+	RunLength,
+	/* Varint gaps minus one between the sorted hidden cells, the first one counted from cell -1. */
+	Deltas,
 };
 
 USTRUCT()
@@ -65,18 +95,253 @@ struct FPackedCellData
 	
 	UPROPERTY()
 	TArray<FPackedVisibilityData> CellData;
+
+	UPROPERTY()
+	EPVGCellEncoding Encoding = EPVGCellEncoding::Boxes;
+
+	/* Payload of every encoding but boxes. */
+	UPROPERTY()
+	TArray<uint8> EncodedData;
+
+	static void WriteVarint(TArray<uint8>& Out, uint32 Value)
+	{
+		for (; Value >= 0x80; Value >>= 7)
+		{
+			Out.Add(uint8(Value | 0x80));
+		}
+		Out.Add(uint8(Value));
+	}
+
+	/* False when the varint runs past End or past 32 bits, Data is left at End then. */
+	static bool ReadVarint(const uint8*& Data, const uint8* End, uint32& OutValue)
+	{
+		OutValue = 0;
+		for (int32 Shift = 0; Data < End && Shift < 32; Shift += 7)
+		{
+			const uint8 Byte = *Data++;
+			OutValue |= uint32(Byte & 0x7f) << Shift;
+			if (!(Byte & 0x80))
+			{
+				return true;
+			}
+		}
+		Data = End;
+		return false;
+	}
+
+	/* Calls Visitor(int32 First, int32 Num) for every run of consecutive hidden cell indices, in ascending order.
+	 * Only for the encodings other than boxes. */
+	template<typename FunctorType>
+	void ForEachRun(FunctorType&& Visitor) const
+	{
+		const uint8* Data = EncodedData.GetData();
+		const uint8* End = Data + EncodedData.Num();
+		if (Data == End)
+		{
+			return;
+		}
+		
+		switch (Encoding)
+		{
+		case EPVGCellEncoding::Bitset:
+			{
+				uint32 SavedFirst, NumSaved;
+				if (!ReadVarint(Data,End,SavedFirst) || !ReadVarint(Data,End,NumSaved))
+				{
+					break;
+				}
+				// Bits past the payload can't be read.
+				const int32 First = int32(SavedFirst);
+				const int32 NumBits = int32(FMath::Min<int64>(NumSaved,int64(End - Data) * 8));
+				int32 RunStart = INDEX_NONE;
+				for (int32 Bit = 0; Bit < NumBits;)
+				{
+					// Whole bytes without a run change are skipped at once.
+					const uint8 Byte = Data[Bit >> 3];
+					if ((Bit & 7) == 0 && Byte == (RunStart == INDEX_NONE ? 0x00 : 0xff))
+					{
+						Bit += 8;
+						continue;
+					}
+					
+					const bool bHidden = (Byte >> (Bit & 7)) & 1;
+					if (bHidden && RunStart == INDEX_NONE)
+					{
+						RunStart = Bit;
+					}
+					else if (!bHidden && RunStart != INDEX_NONE)
+					{
+						Visitor(First + RunStart,Bit - RunStart);
+						RunStart = INDEX_NONE;
+					}
+					Bit++;
+				}
+				if (RunStart != INDEX_NONE)
+				{
+					Visitor(First + RunStart,NumBits - RunStart);
+				}
+				break;
+			}
+		case EPVGCellEncoding::RunLength:
+			{
+				int32 Cell = 0;
+				bool bHidden = false;
+				uint32 Length;
+				while (ReadVarint(Data,End,Length))
+				{
+					if (bHidden)
+					{
+						Visitor(Cell,int32(Length));
+					}
+					Cell += int32(Length);
+					bHidden = !bHidden;
+				}
+				break;
+			}
+		case EPVGCellEncoding::Deltas:
+			{
+				int32 RunStart = 0;
+				int32 RunLength = 0;
+				int32 Cell = -1;
+				uint32 Gap;
+				while (ReadVarint(Data,End,Gap))
+				{
+					Cell += 1 + int32(Gap);
+					if (RunLength > 0 && Cell == RunStart + RunLength)
+					{
+						RunLength++;
+						continue;
+					}
+					if (RunLength > 0)
+					{
+						Visitor(RunStart,RunLength);
+					}
+					RunStart = Cell;
+					RunLength = 1;
+				}
+				if (RunLength > 0)
+				{
+					Visitor(RunStart,RunLength);
+				}
+				break;
+			}
+		default:
+			break;
+		}
+	}
+
+	/* Binary layout inside the streamed sector chunks. */
+	friend FArchive& operator<<(FArchive& Ar, FPackedCellData& Packed);
 };
 
+/*
+ * Occluded build cell pairs stored once instead of in the rows of both cells, as a blocked upper triangular bit matrix.
+ * Build cells are grouped in blocks of 64 slots, bricks of 4x4x4 grid cells or runs of 64 leaves on adaptive grids.
+ * Block (I,J) with I <= J is saved when any of its pairs is occluded, word R holds the occluded slots of J as seen from
+ * slot R of I. Only the non-zero words are saved, behind a mask of which words they are, blocks with all pairs occluded
+ * save no words. A row of I comes from its own blocks, the rows of blocks I < J from reading the column of the slot in
+ * the blocks of the transposed index.
+ *
+ * Grids saved as sector chunks keep the block rows of every sector in its chunk. Blocks between two sectors are saved
+ * with both, each in the orientation of the sector's own block row.
+ */
 USTRUCT()
-struct FRawRegionVisibilityCompressed
+struct FPVGPairBlocks
 {
 	GENERATED_BODY()
-	
+
+	/* Blocks whose rows are held, sorted. Empty when all are, row I is block I then. */
 	UPROPERTY()
-	TArray<uint8> CompressedData;
-	
+	TArray<int32> BlockRows;
+
+	/* Stored blocks of row I are RowStart[I] to RowStart[I + 1], sorted by their block column. */
+	UPROPERTY()
+	TArray<int32> RowStart;
+
+	UPROPERTY()
+	TArray<int32> RowColumns;
+
+	/* Index of the block's word mask in Words, INDEX_NONE when every pair is occluded. */
 	UPROPERTY()
-	int32 NumEntries = 0;
+	TArray<int32> RowWords;
+
+	/* Transposed index of the held blocks above the diagonal, row J lists the block rows I < J and the stored block. */
+	UPROPERTY()
+	TArray<int32> ColumnStart;
+
+	UPROPERTY()
+	TArray<int32> ColumnRows;
+
+	UPROPERTY()
+	TArray<int32> ColumnBlocks;
+
+	UPROPERTY()
+	TArray<uint64> Words;
+
+	bool IsEmpty() const { return RowStart.Num() == 0; }
+
+	/* Row of a block, INDEX_NONE when it isn't held. */
+	int32 FindBlockRow(int32 Block) const
+	{
+		if (BlockRows.Num() == 0)
+		{
+			return RowStart.IsValidIndex(Block + 1) ? Block : INDEX_NONE;
+		}
+		return Algo::BinarySearch(BlockRows,Block);
+	}
+
+	/* Occluded slots of the block column as seen from Slot of the block row, for stored blocks with words. */
+	uint64 GetRowSlots(int32 Entry, int32 Slot) const
+	{
+		const int32 Index = RowWords[Entry];
+		const uint64 Mask = Words[Index];
+		return (Mask >> Slot) & 1 ? Words[Index + 1 + FMath::CountBits(Mask & ((uint64(1) << Slot) - 1))] : 0;
+	}
+
+	/* Occluded slots of the block row as seen from Slot of the block column. */
+	uint64 GetColumnSlots(int32 Entry, int32 Slot) const
+	{
+		const int32 Index = RowWords[Entry];
+		const uint64* Data = Words.GetData() + Index + 1;
+		uint64 Slots = 0;
+		for (uint64 Mask = Words[Index]; Mask; Mask &= Mask - 1)
+		{
+			Slots |= ((*Data++ >> Slot) & 1) << FMath::CountTrailingZeros64(Mask);
+		}
+		return Slots;
+	}
+
+	/* Indices in range of each other and of NumBlocks, for blocks read from a sector chunk. */
+	bool IsValid(int32 NumBlocks) const;
+
+	int64 GetAllocatedSize() const
+	{
+		return BlockRows.GetAllocatedSize() + RowStart.GetAllocatedSize() + RowColumns.GetAllocatedSize() + RowWords.GetAllocatedSize()
+			+ ColumnStart.GetAllocatedSize() + ColumnRows.GetAllocatedSize() + ColumnBlocks.GetAllocatedSize() + Words.GetAllocatedSize();
+	}
+
+	/* Binary layout inside the streamed sector chunks. */
+	friend FArchive& operator<<(FArchive& Ar, FPVGPairBlocks& Blocks);
+};
+
+/* Engine compression formats the sector chunks can be saved with. */
+UENUM()
+enum class EPVGCompressionFormat : uint8
+{
+	Oodle,
+	Zlib,
+	LZ4,
+};
+
+/* Sector cache counters since the asset was loaded. Every GetCellData or GetCellDataBits call is either a hit or a miss,
+ * misses are blocking loads. Prefetch requests count the sectors requested ahead of the player, once each. */
+struct FPVGSectorCacheStats
+{
+	int64 Hits = 0;
+	int64 Misses = 0;
+	int64 PrefetchRequests = 0;
+	int64 BlockingLoads = 0;
+	int64 Evictions = 0;
 };
 
 UCLASS()
@@ -85,9 +350,183 @@ class PRECOMPUTEDVISIBILITYGRID_API UPVGPrecomputedGridDataAsset : public UDataA
 	GENERATED_BODY()
 public:
 	
-	TArray<uint16> GetCellData(int32 CellId) const;
+	TArray<int32> GetCellData(int32 CellId) const { return GetBuildCellData(GetBuildCellIndex(CellId)); }
+
+	/* Decode into the caller's buffer, no allocation once it has grown big enough. */
+	void GetCellData(int32 CellId, TArray<int32>& Out) const { GetBuildCellData(GetBuildCellIndex(CellId),Out); }
+
+	/* Hidden grid cells as bits, Out is resized to the number of grid cells only when it doesn't match already. */
+	void GetCellDataBits(int32 CellId, TBitArray<>& Out) const;
+
+	/* Hidden grid cells as seen from a build cell. */
+	TArray<int32> GetBuildCellData(int32 BuildCell) const;
+	void GetBuildCellData(int32 BuildCell, TArray<int32>& Out) const;
+
+	/* Calls Visitor(const FIntVector& Min, const FIntVector& Max) for every packed box of hidden cells, bounds inclusive.
+	 * Cells that aren't saved as boxes come out as runs along X. */
+	template<typename FunctorType>
+	void ForEachHiddenBox(int32 BuildCell, FunctorType&& Visitor) const
+	{
+		if (bPairBlocks)
+		{
+			ForEachHiddenPairBox(BuildCell,Visitor);
+			return;
+		}
+		
+		const FPackedCellData* PackedPtr = FindCellData(BuildCell);
+		if (!PackedPtr)
+		{
+			return;
+		}
+		
+		const FPackedCellData& Packed = *PackedPtr;
+		if (Packed.Encoding != EPVGCellEncoding::Boxes)
+		{
+			// Runs of cell indices wrap from one row to the next, split them at the row ends.
+			Packed.ForEachRun([this,&Visitor](int32 First, int32 Num)
+			{
+				while (Num > 0)
+				{
+					const FIntVector Min = IndexTo3D(First,GridSizeX,GridSizeY);
+					const int32 RowNum = FMath::Min(Num,GridSizeX - Min.X);
+					Visitor(Min,Min + FIntVector(RowNum - 1,0,0));
+					First += RowNum;
+					Num -= RowNum;
+				}
+			});
+			return;
+		}
+		
+		const FIntVector Size = GetSectorSize();
+		FIntVector SectorOrigin = FIntVector::ZeroValue;
+		for (const FPackedVisibilityData& Entry : Packed.CellData)
+		{
+			if (Entry.IsSectorMarker())
+			{
+				SectorOrigin = GetSectorOrigin(Entry.Location);
+				continue;
+			}
+			const FIntVector Min = SectorOrigin + IndexTo3D(Entry.Location,Size.X,Size.Y);
+			Visitor(Min,Min + FIntVector(Entry.SizeX,Entry.SizeY,Entry.SizeZ));
+		}
+	}
+
+	/* Calls Visitor(int32 Block, uint64 Slots) with the hidden slots of every pair block that has any, as seen from a
+	 * build cell. Only for grids saved with pair blocks. */
+	template<typename FunctorType>
+	void ForEachHiddenSlots(int32 BuildCell, FunctorType&& Visitor) const
+	{
+		if (!IsBuildCellReachable(BuildCell))
+		{
+			return;
+		}
+		
+		int32 Block, Slot;
+		GetPairSlot(BuildCell,Block,Slot);
+		const FPVGPairBlocks* BlocksPtr = FindPairBlocks(Block);
+		const int32 BlockRow = BlocksPtr ? BlocksPtr->FindBlockRow(Block) : INDEX_NONE;
+		if (BlockRow == INDEX_NONE)
+		{
+			return;
+		}
+		const FPVGPairBlocks& Blocks = *BlocksPtr;
+
+		// Blocks left of the diagonal, the slot's column of the stored block above it.
+		for (int32 i = Blocks.ColumnStart[BlockRow]; i < Blocks.ColumnStart[BlockRow + 1]; i++)
+		{
+			const int32 Row = Blocks.ColumnRows[i];
+			const int32 Entry = Blocks.ColumnBlocks[i];
+			const uint64 Slots = Blocks.RowWords[Entry] == INDEX_NONE ? GetValidPairSlots(Row) : Blocks.GetColumnSlots(Entry,Slot);
+			if (Slots)
+			{
+				Visitor(Row,Slots);
+			}
+		}
+
+		// The slot's row, the diagonal and right of it, and left of it for blocks stored with another sector.
+		for (int32 i = Blocks.RowStart[BlockRow]; i < Blocks.RowStart[BlockRow + 1]; i++)
+		{
+			const int32 Column = Blocks.RowColumns[i];
+			const uint64 Slots = Blocks.RowWords[i] == INDEX_NONE
+				? GetValidPairSlots(Column) & ~(Column == Block ? uint64(1) << Slot : 0)
+				: Blocks.GetRowSlots(i,Slot);
+			if (Slots)
+			{
+				Visitor(Column,Slots);
+			}
+		}
+	}
+
+	/* ForEachHiddenBox for grids saved with pair blocks. Whole bricks come out as one box, the rest as runs along X. */
+	template<typename FunctorType>
+	void ForEachHiddenPairBox(int32 BuildCell, FunctorType& Visitor) const
+	{
+		ForEachHiddenSlots(BuildCell,[this,&Visitor](int32 Block, uint64 Slots)
+		{
+			if (LeafCodes.Num() > 0)
+			{
+				for (; Slots; Slots &= Slots - 1)
+				{
+					FIntVector Min, Max;
+					GetBuildCellRange(Block * 64 + int32(FMath::CountTrailingZeros64(Slots)),Min,Max);
+					Visitor(Min,Max);
+				}
+				return;
+			}
+
+			const FIntVector Origin = GetPairBrickOrigin(Block);
+			if (Slots == GetValidPairSlots(Block))
+			{
+				Visitor(Origin,FIntVector(FMath::Min(Origin.X + 3,GridSizeX - 1),FMath::Min(Origin.Y + 3,GridSizeY - 1),FMath::Min(Origin.Z + 3,GridSizeZ - 1)));
+				return;
+			}
+
+			// Slots are ordered X first, every 4 bits are a row of the brick.
+			for (int32 Row = 0; Row < 16; Row++)
+			{
+				uint32 Bits = uint32(Slots >> (Row * 4)) & 0xf;
+				while (Bits)
+				{
+					const int32 First = FMath::CountTrailingZeros(Bits);
+					const int32 Num = FMath::CountTrailingZeros(~(Bits >> First));
+					const FIntVector Min = Origin + FIntVector(First,Row & 3,Row >> 2);
+					Visitor(Min,Min + FIntVector(Num - 1,0,0));
+					Bits &= ~(((1u << Num) - 1) << First);
+				}
+			}
+		});
+	}
+
+	/* Calls Visitor(int32 Cell) for every hidden grid cell as seen from CellId, in the same order GetCellData returns them.
+	 * The order depends on how the cell was encoded. */
+	template<typename FunctorType>
+	void ForEachHiddenCell(int32 CellId, FunctorType&& Visitor) const
+	{
+		ForEachHiddenBox(GetBuildCellIndex(CellId),[this,&Visitor](const FIntVector& Min, const FIntVector& Max)
+		{
+			for (int32 x = Min.X; x <= Max.X; x++)
+			{
+				for (int32 y = Min.Y; y <= Max.Y; y++)
+				{
+					for (int32 z = Min.Z; z <= Max.Z; z++)
+					{
+						Visitor(XYZToIndex(x,y,z,GridSizeX,GridSizeY));
+					}
+				}
+			}
+		});
+	}
 
 	int32 GetNumCells() const {return GridSizeX * GridSizeY * GridSizeZ; }
+
+	/* Cells the builder resolved pairs for, octree leaves when the grid was built with adaptive cells and grid cells otherwise. */
+	int32 GetNumBuildCells() const { return LeafCodes.Num() > 0 ? LeafCodes.Num() : GetNumCells(); }
+
+	/* Build cell holding a grid cell, a binary search over the leaves of adaptive grids. */
+	int32 GetBuildCellIndex(int32 Cell) const;
+
+	/* Inclusive grid cell range of a build cell. */
+	void GetBuildCellRange(int32 BuildCell, FIntVector& OutMin, FIntVector& OutMax) const;
 	
 	FBox GetCellBox() const
 	{
@@ -96,23 +535,198 @@ public:
 
 	int32 IsCellIndexValid(int32 Index) const
 	{
-		return GridCellData.IsValidIndex(Index);// || CompressedGridData.IsValidIndex(Index);
+		return Index >= 0 && Index < GetNumCells() && (bStreamedSectors || bPairBlocks || GridCellData.IsValidIndex(GetBuildCellIndex(Index)));
 	}
 
 	FBox GetGridBounds() const { return GridBounds;}
 	int32 GetGridSizeX() const { return GridSizeX; }
 	int32 GetGridSizeY() const { return GridSizeY; }
 	int32 GetGridSizeZ() const { return GridSizeZ; }
+	FVector GetCellExtents() const { return CellExtents; }
+
+	/* Cells per sector along each axis, every sector has less than MAX_uint16 cells so packed boxes keep 16 bit locations.
+	 * Grids that fit in a single sector use the grid size, older assets don't store it. */
+	FIntVector GetSectorSize() const { return SectorSize == FIntVector::ZeroValue ? FIntVector(GridSizeX,GridSizeY,GridSizeZ) : SectorSize; }
+	FIntVector GetNumSectors3D() const;
+	int32 GetNumSectors() const { const FIntVector Num = GetNumSectors3D(); return Num.X * Num.Y * Num.Z; }
+	int32 GetSectorIndex(const FIntVector& Cell) const;
+	FIntVector GetSectorOrigin(int32 Sector) const;
+
+	/* Build cells with saved data, whichever way it was saved. */
+	int32 GetNumSavedBuildCells() const { return bStreamedSectors || bPairBlocks ? GetNumBuildCells() : GridCellData.Num(); }
+
+	/* Pair block and slot of a build cell, and back. Slots outside the grid have no build cell. */
+	void GetPairSlot(int32 BuildCell, int32& OutBlock, int32& OutSlot) const;
+	int32 GetSlotBuildCell(int32 Block, int32 Slot) const;
+	int32 GetNumPairBlocks() const;
+
+	/* Slots of a pair block that hold a build cell. */
+	uint64 GetValidPairSlots(int32 Block) const;
+
+	/* First grid cell of the brick of a pair block, grids without adaptive cells only. */
+	FIntVector GetPairBrickOrigin(int32 Block) const;
+
+	/* Cells without a camera position hide nothing, the builder's reachability. */
+	bool IsBuildCellReachable(int32 BuildCell) const
+	{
+		return !ReachableBuildCells.IsValidIndex(BuildCell >> 6) || ((ReachableBuildCells[BuildCell >> 6] >> (BuildCell & 63)) & 1);
+	}
+
+	/* Hash of the grid layout, results of builds with a different signature can't be combined. */
+	uint32 GetGridSignature() const;
+
+	/* Calls Visitor(int32 Cell, bool bHide) for every cell whose visibility changes when stepping from FromCell to its face
+	 * neighbour ToCell. Returns false without visiting anything when there is no saved transition between the two, or when
+	 * it was saved with a sector that isn't resident. */
+	template<typename FunctorType>
+	bool ForEachTransitionChange(int32 FromCell, int32 ToCell, FunctorType&& Visitor) const
+	{
+		const uint8* Data;
+		const uint8* End;
+		if (!FindTransition(FromCell,ToCell,Data,End))
+		{
+			return false;
+		}
+
+		if (Data == End)
+		{
+			return true;
+		}
+
+		// Entries are saved for the step towards the higher cell index, the way back swaps both lists.
+		const bool bForward = FromCell < ToCell;
+		uint32 NumNewlyHidden, Gap;
+		if (!FPackedCellData::ReadVarint(Data,End,NumNewlyHidden))
+		{
+			return true;
+		}
+		int32 Cell = -1;
+		for (uint32 i = 0; FPackedCellData::ReadVarint(Data,End,Gap); i++)
+		{
+			if (i == NumNewlyHidden)
+			{
+				Cell = -1;
+			}
+			Cell += 1 + int32(Gap);
+			Visitor(Cell,(i < NumNewlyHidden) == bForward);
+		}
+		return true;
+	}
+
+	/* Requests the sector holding CellId and the neighbouring ones within the prefetch distance, and moves finished loads
+	 * into the sector cache. Call once per frame with the player cell, does nothing unless the grid was saved as sector chunks. */
+	void StreamSectorsAround(int32 CellId);
+
+	/* True when reading the data of CellId doesn't need a blocking load, also for sectors that failed to load. */
+	bool IsCellDataResident(int32 CellId) const;
+
+	/* Saved as sector chunks, streamed or resident compressed, rather than as GridCellData. */
+	bool HasStreamedSectors() const { return bStreamedSectors; }
+	int64 GetResidentSectorBytes() const { return LoadedSectorBytes; }
+	const FPVGSectorCacheStats& GetSectorCacheStats() const { return SectorCacheStats; }
+
+#if WITH_EDITOR
+	/* Setup the grid layout and reset the pair state. */
+	void InitializeGrid(FIntVector GridSize, const FVector& InCellExtents, const FBox& InGridBounds,
+		const TArray<uint64>& InLeafCodes = TArray<uint64>(), const TArray<uint8>& InLeafLevels = TArray<uint8>());
+
+	FPVGPairMatrix& GetPairMatrix() { return PairMatrix; }
+
+	/* Build cells a camera can be in, empty when all are. Unreachable cells save no data. */
+	void SetReachableBuildCells(const TBitArray<>& Reachable);
+#endif
 
 protected:
-	//static void CompressData(const FRawRegionVisibilityData16& Source, FRawRegionVisibilityCompressed& Target);
-	//static TArray<uint16> UnCompressData(const FRawRegionVisibilityCompressed& Target);
 	virtual void PreSave(FObjectPreSaveContext SaveContext) override;
+	virtual void Serialize(FArchive& Ar) override;
+	virtual void BeginDestroy() override;
+
+	struct FLoadedSector
+	{
+		TArray<int32> BuildCells;
+		TArray<FPackedCellData> Cells;
+
+		/* Transitions from the grid cells of the sector, same layout as the resident ones with the cells in sector order. */
+		TArray<uint32> TransitionOffsets;
+		TArray<uint8> TransitionData;
+
+		/* Block rows of the sector, for grids saved with pair blocks. */
+		FPVGPairBlocks PairBlocks;
+		int64 AllocatedSize = 0;
+		uint64 LastUse = 0;
+	};
+
+	/* Packed data of a build cell, null when nothing is hidden from it. Sectors missing from the cache get loaded
+	 * blocking, the manager avoids that by waiting for StreamSectorsAround. Game thread only. */
+	const FPackedCellData* FindCellData(int32 BuildCell) const;
+
+	/* Pair blocks holding the row of a block, the resident ones or those of its cached sector. Loads like FindCellData. */
+	const FPVGPairBlocks* FindPairBlocks(int32 Block) const;
+
+	/* Cached sector for a lookup, null when it couldn't be loaded. Doesn't count towards the cache stats. */
+	FLoadedSector* FindLoadedSector(int32 Sector) const;
+
+	/* Hit or miss of a cell data lookup, counted once by the public lookups and not by debug draws or repeated passes. */
+	void CountSectorLookup(int32 BuildCell) const;
+
+	/* Sector a build cell's data is streamed with, the one of its min corner or with pair blocks the one of its block. */
+	int32 GetBuildCellSector(int32 BuildCell) const;
+
+	/* Sector holding the row of a pair block, the one of its first cell. */
+	int32 GetPairBlockSector(int32 Block) const;
+
+	/* Cells of the sector along each axis, sectors on the far border of the grid are cut off. */
+	FIntVector GetSectorExtent(int32 Sector) const;
+
+	/* Chunk layout: number of build cells, then every build cell index followed by its packed data, sorted by index. The
+	 * transition offsets and data of the sector's grid cells follow, empty without transitions, and the pair blocks of the
+	 * sector when the grid was saved with them. Compressed chunks start with the uncompressed size, followed by the
+	 * compressed layout or the layout itself when compressing didn't make it smaller. Safe to call from any thread. */
+	static void DecodeSectorChunk(FName Format, int32 NumPairBlocks, TArrayView<const uint8> Chunk, FLoadedSector& Out);
+	void ReadSectorChunk(int32 Sector, FLoadedSector& Out) const;
+
+	/* Decode a chunk on a worker thread, takes ownership of Data. */
+	UE::Tasks::TTask<FLoadedSector> LaunchSectorDecode(uint8* Data, int64 Size) const;
+
+	/* Insert into the cache as the most recently used sector, evicting nothing yet. */
+	void AddLoadedSector(int32 Sector, FLoadedSector&& Loaded) const;
+	void LoadSectorBlocking(int32 Sector) const;
+
+	/* Drop least recently used sectors until the cache fits the budget, sectors used at or after PinnedUse stay. */
+	void TrimSectorCache(uint64 PinnedUse) const;
+
+	/* Drop the cache and cancel the loads in flight. */
+	void ResetSectorCache();
 	
 	void CubeCompress(const FRawRegionVisibilityData16& InData, TArray<FPackedVisibilityData>& Out);
+
+	/* Replace the boxes of Out with another encoding when that is smaller. */
+	static void PickCellEncoding(const FRawRegionVisibilityData16& InData, FPackedCellData& Out);
+
+	/* Lower cell and axis of a step between two face neighbours, the transition is saved with the lower cell. */
+	bool GetTransitionStep(int32 FromCell, int32 ToCell, int32& OutBase, int32& OutAxis) const;
+
+	/* Saved changes of the step, from the resident transitions or the cached sector of the lower cell. Game thread only. */
+	bool FindTransition(int32 FromCell, int32 ToCell, const uint8*& OutData, const uint8*& OutEnd) const;
+
+#if WITH_EDITOR
+	/* Diff the hidden cells of every grid cell and its +X, +Y and +Z neighbours into the transition data. */
+	void BuildTransitions();
+
+	/* Store the occluded pairs of GridData once, in one set of pair blocks or in a set per sector. Returns false and leaves
+	 * OutBlocks empty when that isn't smaller than the packed rows. */
+	bool BuildPairBlocks(bool bPerSector, TArray<FPVGPairBlocks>& OutBlocks);
+
+	/* Move GridCellData, the transitions and the pair blocks of every sector into a bulk data chunk per sector, streamed
+	 * chunks are kept out of the export and the others load along with the asset. */
+	void BuildSectorChunks(bool bStreamed, TArray<FPVGPairBlocks>&& SectorPairBlocks);
+
+	/* Decode every streamed sector back into GridCellData or PairBlocks, for the builder which reads them from many threads. */
+	void LoadAllSectors();
+#endif
 	
 #if WITH_EDITOR
-	// Assign visibility data to the cell, will assign to both tested and testing cell.
+	// Assign visibility data to the cell pair, safe to call from the builder's worker threads.
 	void SetDataCell(int32 Cell, int32 InvisibleRegion,bool bVisible);
 #endif
 
@@ -133,18 +747,87 @@ private:
 	UPROPERTY(VisibleDefaultsOnly)
 	int32 GridSizeZ;
 
-	/* Allow for runtime compression & decompression */
+	UPROPERTY(VisibleDefaultsOnly)
+	FIntVector SectorSize = FIntVector::ZeroValue;
+
+	/* Octree leaves of adaptive grids, sorted Morton codes of their min corner and their level. Empty when every grid cell
+	 * was built on its own. */
+	UPROPERTY()
+	TArray<uint64> LeafCodes;
+
+	UPROPERTY()
+	TArray<uint8> LeafLevels;
+
+	/* Allow for runtime compression & decompression. Saves the cell data compressed per sector, decompressed on worker
+	 * threads into the sector cache when the player gets close. For platforms where even the packed data is too large. */
 	UPROPERTY(EditDefaultsOnly)
 	bool bAllowRuntimeCompression;
 
+	UPROPERTY(EditDefaultsOnly, meta=(EditCondition="bAllowRuntimeCompression"))
+	EPVGCompressionFormat RuntimeCompressionFormat = EPVGCompressionFormat::Oodle;
+
 #if WITH_EDITORONLY_DATA
 	// Transient data, either de-compressed on load or dynamically.
 	UPROPERTY()
 	TArray<FRawRegionVisibilityData16> GridData;
+
+	/* Pair state filled by the builder, flattened into GridData on save. */
+	FPVGPairMatrix PairMatrix;
+
+	/* Hash of the collision overlapping each cell at build time, incremental builds only redo pairs around cells whose hash changed. */
+	UPROPERTY()
+	TArray<uint32> CellGeometryHashes;
 #endif
 	
 	UPROPERTY()
 	TArray<FPackedCellData> GridCellData;
 
+	/* Changes between face neighbours, entry Cell * 3 + Axis holds the step from Cell to its neighbour along +Axis:
+	 * varint number of newly hidden cells, then the newly hidden and the newly visible cells as sorted varint deltas.
+	 * Empty when the grid was saved without transitions, or when they were saved with the sector chunks. */
+	UPROPERTY()
+	TArray<uint8> TransitionData;
+
+	/* Start of every entry in TransitionData, one more than there are entries. */
+	UPROPERTY()
+	TArray<uint32> TransitionOffsets;
+
+	/* Bit per build cell a camera can be in, set by the builder. Empty when all are. */
+	UPROPERTY()
+	TArray<uint64> ReachableBuildCells;
+
+	/* Set when the occluded pairs were stored once instead of GridCellData, in PairBlocks or in the sector chunks. */
+	UPROPERTY()
+	bool bPairBlocks = false;
+
+	/* Pair blocks of the whole grid, empty when they were saved with the sector chunks. */
+	UPROPERTY()
+	FPVGPairBlocks PairBlocks;
+
+	/* Set when GridCellData was saved as SectorChunks instead. */
+	UPROPERTY()
+	bool bStreamedSectors = false;
+
+	/* Format the sector chunks were compressed with, none when they are stored as is. */
+	UPROPERTY()
+	FName ChunkCompressionFormat;
+
+	/* Packed data of the build cells with hidden cells, one chunk per sector. Serialized by hand after the properties. */
+	TIndirectArray<FByteBulkData> SectorChunks;
+
+	/* Decoded sectors, queries are const but still bump the LRU and may load. */
+	mutable TMap<int32,FLoadedSector> LoadedSectors;
+	mutable int64 LoadedSectorBytes = 0;
+	mutable uint64 SectorUseCounter = 0;
+
+	mutable FPVGSectorCacheStats SectorCacheStats;
+
+	/* Sectors whose chunk couldn't be read, treated as resident with nothing hidden instead of being read again. */
+	mutable TSet<int32> FailedSectors;
+
+	/* Async loads in flight per sector, then their decodes. */
+	TMap<int32,TUniquePtr<IBulkDataIORequest>> SectorRequests;
+	mutable TMap<int32,UE::Tasks::TTask<FLoadedSector>> SectorDecodes;
+
 	friend class APVGBuilder;
 };
@@ -7,26 +7,57 @@
 
 #define PVG_DEBUG 0
 
-inline FIntVector IndexTo3D(uint16 Index, uint16 MaxX, uint16 MaxY)
+inline FIntVector IndexTo3D(int32 Index, int32 MaxX, int32 MaxY)
 {
-	uint16 z = Index / (MaxX * MaxY);
+	int32 z = Index / (MaxX * MaxY);
 	Index -= (z * MaxX * MaxY);
-	uint16 y = Index / MaxX;
-	uint16 x = Index % MaxX;
+	int32 y = Index / MaxX;
+	int32 x = Index % MaxX;
 	
 	return FIntVector(x,y,z);
 }
 
-inline int32 XYZToIndex(int32 x, int32 y, int32 z, uint16 MaxX, uint16 MaxY)
+inline int32 XYZToIndex(int32 x, int32 y, int32 z, int32 MaxX, int32 MaxY)
 {
 	return (z * MaxX * MaxY) + (y * MaxX) + x;
 }
 
-inline uint16 XYZToIndex(FIntVector XYZ, uint16 MaxX, uint16 MaxY)
+inline int32 XYZToIndex(FIntVector XYZ, int32 MaxX, int32 MaxY)
 {
 	return (XYZ.Z * MaxX * MaxY) + (XYZ.Y * MaxX) + XYZ.X;
 }
 
+/* Interleave the bits of the cell coordinates, X lowest. Supports up to 2^21 cells per axis. */
+inline uint64 CellToMortonCode(const FIntVector& Cell)
+{
+	auto SpreadBits = [](uint64 Value)
+	{
+		Value &= 0x1FFFFF;
+		Value = (Value | Value << 32) & 0x1F00000000FFFF;
+		Value = (Value | Value << 16) & 0x1F0000FF0000FF;
+		Value = (Value | Value << 8) & 0x100F00F00F00F00F;
+		Value = (Value | Value << 4) & 0x10C30C30C30C30C3;
+		Value = (Value | Value << 2) & 0x1249249249249249;
+		return Value;
+	};
+	return SpreadBits(Cell.X) | SpreadBits(Cell.Y) << 1 | SpreadBits(Cell.Z) << 2;
+}
+
+inline FIntVector MortonCodeToCell(uint64 Code)
+{
+	auto CompactBits = [](uint64 Value)
+	{
+		Value &= 0x1249249249249249;
+		Value = (Value ^ (Value >> 2)) & 0x10C30C30C30C30C3;
+		Value = (Value ^ (Value >> 4)) & 0x100F00F00F00F00F;
+		Value = (Value ^ (Value >> 8)) & 0x1F0000FF0000FF;
+		Value = (Value ^ (Value >> 16)) & 0x1F00000000FFFF;
+		Value = (Value ^ (Value >> 32)) & 0x1FFFFF;
+		return int32(Value);
+	};
+	return FIntVector(CompactBits(Code),CompactBits(Code >> 1),CompactBits(Code >> 2));
+}
+
 class FPrecomputedVisibilityGridModule : public IModuleInterface
 {
 public: